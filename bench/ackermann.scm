@@ -0,0 +1,5 @@
+; Ackermann function: very deep recursion, mostly calls
+(define (ack m n) (if (= m 0) (+ n 1) (if (= n 0) (ack (- m 1) 1) (ack (- m 1) (ack m (- n 1))))))
+
+(define (run) (ack 2 400))
+(define expected 803)
@@ -0,0 +1,10 @@
+; closure heavy: chains of adder closures composed into one function
+(define (adder z) (lambda (x) (+ z x)))
+(define (compose f g) (lambda (x) (g (f x))))
+
+(define (chain n f) (if (= n 0) f (chain (- n 1) (compose f (adder n)))))
+
+(define (repeat i acc) (if (= i 0) acc (repeat (- i 1) (+ acc ((chain 500 (lambda (x) x)) i)))))
+
+(define (run) (repeat 40 0))
+(define expected 5010820)
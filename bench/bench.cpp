@@ -0,0 +1,279 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../scheme.h"
+
+
+
+
+/**	scheme-bench [--engine tree|bytecode|both] [--warmup n] [--repetitions n] [--dir path] [--json file] [--baseline file] [--threshold fraction] [kernel...]
+ * 	runs the kernels (bench/<name>.scm, all of them by default) through SchemeInterpreter::eval, on a new interpreter for each kernel and engine
+ * 	a kernel defines (run) and the value it must return, expected - the warmup calls are not measured, the repetitions are
+ * 	prints the median and 95th percentile wall time and the allocations of one call of every kernel, --json writes them in the format of the baseline
+ * 	with --baseline, kernels whose median time or allocations grew more than threshold (0.15 by default) over the baseline are regressions
+ * 	the allocations are the same on every machine, the times only compare to a baseline written on the same one
+ * 	the exit status is 1 if a kernel failed, returned the wrong value or regressed */
+
+namespace
+{
+	const char* const KERNELS[] = {"fib", "tak", "ackermann", "nqueens", "deep-recursion", "adder"};
+
+	struct Result
+	{
+		std::string name;
+		std::string engine;
+		double medianMilliseconds;
+		double p95Milliseconds;
+		size_t allocations;
+		size_t allocatedBytes;
+	};
+
+	struct Options
+	{
+		std::vector<Engine> engines{Engine::TREE, Engine::BYTECODE};
+		int warmup = 2;
+		int repetitions = 10;
+		std::string dir = "bench";
+		std::string json;
+		std::string baseline;
+		double threshold = 0.15;
+		std::vector<std::string> kernels;
+	};
+
+	const char* engineName(Engine engine)
+	{
+		return engine == Engine::TREE ? "tree" : "bytecode";
+	}
+
+	std::string toString(const std::shared_ptr<Sexp>& s)
+	{
+		std::ostringstream os;
+		if(s != nullptr)
+			os << *s;
+		return os.str();
+	}
+
+	/**	the value at fraction of the sorted times (0.5 is the median) */
+	double percentile(std::vector<double> times, double fraction)
+	{
+		std::sort(times.begin(), times.end());
+		size_t index = static_cast<size_t>(std::ceil(fraction * times.size()));
+		return times[index == 0 ? 0 : index - 1];
+	}
+
+	bool run(const Options& options, const std::string& name, Engine engine, Result& result)
+	{
+		SchemeInterpreter si;
+		si.setEngine(engine);
+		if(!si.load(options.dir + "/" + name + ".scm"))
+			return false;
+		std::string expected = toString(si.eval(std::string("expected")));
+
+		for(int i = 0; i < options.warmup; i++)
+			si.eval(std::string("(run)"));
+
+		std::vector<double> times;
+		for(int i = 0; i < options.repetitions; i++)
+		{
+			HeapStats before = si.getHeapStats();
+			auto start = std::chrono::steady_clock::now();
+			std::shared_ptr<Sexp> value = si.eval(std::string("(run)"));
+			auto end = std::chrono::steady_clock::now();
+			HeapStats after = si.getHeapStats();
+			if(toString(value) != expected)
+			{
+				std::cerr << name << " (" << engineName(engine) << ") returned " << toString(value) << " instead of " << expected << "\n";
+				return false;
+			}
+			times.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+			//the kernels are deterministic, every call allocates the same
+			result.allocations = after.allocations - before.allocations;
+			result.allocatedBytes = after.allocatedBytes - before.allocatedBytes;
+		}
+		result.name = name;
+		result.engine = engineName(engine);
+		result.medianMilliseconds = percentile(times, 0.5);
+		result.p95Milliseconds = percentile(times, 0.95);
+		return true;
+	}
+
+	void writeJson(std::ostream& os, const Options& options, const std::vector<Result>& results)
+	{
+		os << "{\n\t\"warmup\": " << options.warmup << ",\n\t\"repetitions\": " << options.repetitions << ",\n\t\"results\": [\n";
+		for(size_t i = 0; i < results.size(); i++)
+		{
+			const Result& r = results[i];
+			os << "\t\t{\"name\": \"" << r.name << "\", \"engine\": \"" << r.engine << "\", \"median_ms\": " << std::fixed << std::setprecision(3) << r.medianMilliseconds
+				<< ", \"p95_ms\": " << r.p95Milliseconds << ", \"allocations\": " << r.allocations << ", \"allocated_bytes\": " << r.allocatedBytes << "}"
+				<< (i + 1 < results.size() ? "," : "") << "\n";
+		}
+		os << "\t]\n}\n";
+	}
+
+	/**	the value of "key": in a flat JSON object, without the quotes of strings */
+	std::string field(const std::string& object, const std::string& key)
+	{
+		size_t pos = object.find("\"" + key + "\"");
+		if(pos == std::string::npos)
+			return "";
+		pos = object.find(':', pos);
+		if(pos == std::string::npos)
+			return "";
+		pos = object.find_first_not_of(" \t\n", pos + 1);
+		if(pos == std::string::npos)
+			return "";
+		if(object[pos] == '"')
+			return object.substr(pos + 1, object.find('"', pos + 1) - pos - 1);
+		return object.substr(pos, object.find_first_of(",}\n", pos) - pos);
+	}
+
+	/**	the results of a file written by writeJson */
+	bool readJson(const std::string& path, std::vector<Result>& results)
+	{
+		std::ifstream in{path};
+		if(!in)
+		{
+			std::cerr << "can't read " << path << "\n";
+			return false;
+		}
+		std::stringstream buffer;
+		buffer << in.rdbuf();
+		std::string text = buffer.str();
+		size_t pos = text.find("\"results\"");
+		while(pos != std::string::npos && (pos = text.find('{', pos)) != std::string::npos)
+		{
+			size_t end = text.find('}', pos);
+			if(end == std::string::npos)
+				break;
+			std::string object = text.substr(pos, end - pos + 1);
+			Result r;
+			r.name = field(object, "name");
+			r.engine = field(object, "engine");
+			r.medianMilliseconds = std::atof(field(object, "median_ms").c_str());
+			r.p95Milliseconds = std::atof(field(object, "p95_ms").c_str());
+			r.allocations = std::strtoull(field(object, "allocations").c_str(), nullptr, 10);
+			r.allocatedBytes = std::strtoull(field(object, "allocated_bytes").c_str(), nullptr, 10);
+			results.push_back(r);
+			pos = end;
+		}
+		return true;
+	}
+
+	/**	prints the change of every result against the baseline, false if any of them regressed */
+	bool compare(const std::vector<Result>& results, const std::vector<Result>& baseline, double threshold)
+	{
+		bool passed = true;
+		std::cout << "\nagainst the baseline (threshold " << std::fixed << std::setprecision(0) << threshold * 100 << "%):\n";
+		for(const Result& r : results)
+		{
+			auto it = std::find_if(baseline.begin(), baseline.end(), [&r](const Result& b) {return b.name == r.name && b.engine == r.engine;});
+			if(it == baseline.end())
+			{
+				std::cout << std::left << std::setw(16) << r.name << std::setw(10) << r.engine << "not in the baseline\n";
+				continue;
+			}
+			double time = it->medianMilliseconds > 0 ? r.medianMilliseconds / it->medianMilliseconds - 1 : 0;
+			double allocations = it->allocations > 0 ? static_cast<double>(r.allocations) / it->allocations - 1 : 0;
+			bool regressed = time > threshold || allocations > threshold;
+			passed = passed && !regressed;
+			std::cout << std::left << std::setw(16) << r.name << std::setw(10) << r.engine << std::right << std::showpos << std::fixed << std::setprecision(1)
+				<< "time " << std::setw(7) << time * 100 << "%   allocations " << std::setw(7) << allocations * 100 << "%" << std::noshowpos
+				<< (regressed ? "   REGRESSION" : "") << "\n";
+		}
+		return passed;
+	}
+
+	bool parse(int argc, char* argv[], Options& options)
+	{
+		for(int i = 1; i < argc; i++)
+		{
+			std::string arg = argv[i];
+			if(arg.compare(0, 2, "--") != 0)
+			{
+				options.kernels.push_back(arg);
+				continue;
+			}
+			if(i + 1 >= argc)
+			{
+				std::cerr << arg << " needs a value\n";
+				return false;
+			}
+			std::string value = argv[++i];
+			if(arg == "--engine" && (value == "tree" || value == "bytecode" || value == "both"))
+				options.engines = value == "both" ? std::vector<Engine>{Engine::TREE, Engine::BYTECODE} : std::vector<Engine>{value == "tree" ? Engine::TREE : Engine::BYTECODE};
+			else if(arg == "--warmup")
+				options.warmup = std::atoi(value.c_str());
+			else if(arg == "--repetitions" && std::atoi(value.c_str()) > 0)
+				options.repetitions = std::atoi(value.c_str());
+			else if(arg == "--dir")
+				options.dir = value;
+			else if(arg == "--json")
+				options.json = value;
+			else if(arg == "--baseline")
+				options.baseline = value;
+			else if(arg == "--threshold")
+				options.threshold = std::atof(value.c_str());
+			else
+			{
+				std::cerr << "invalid option: " << arg << " " << value << "\n";
+				return false;
+			}
+		}
+		if(options.kernels.empty())
+			options.kernels.assign(std::begin(KERNELS), std::end(KERNELS));
+		return true;
+	}
+}
+
+
+int main(int argc, char* argv[])
+{
+	Options options;
+	if(!parse(argc, argv, options))
+		return 1;
+
+	bool passed = true;
+	std::vector<Result> results;
+	std::cout << std::left << std::setw(16) << "kernel" << std::setw(10) << "engine" << std::right
+		<< std::setw(12) << "median ms" << std::setw(12) << "p95 ms" << std::setw(14) << "allocations" << "\n";
+	for(const std::string& name : options.kernels)
+	{
+		for(Engine engine : options.engines)
+		{
+			Result r;
+			if(!run(options, name, engine, r))
+			{
+				passed = false;
+				continue;
+			}
+			results.push_back(r);
+			std::cout << std::left << std::setw(16) << r.name << std::setw(10) << r.engine << std::right << std::fixed << std::setprecision(3)
+				<< std::setw(12) << r.medianMilliseconds << std::setw(12) << r.p95Milliseconds << std::setw(14) << r.allocations << "\n";
+		}
+	}
+
+	if(!options.json.empty())
+	{
+		std::ofstream out{options.json};
+		writeJson(out, options, results);
+		if(!out)
+		{
+			std::cerr << "can't write " << options.json << "\n";
+			passed = false;
+		}
+	}
+	if(!options.baseline.empty())
+	{
+		std::vector<Result> baseline;
+		passed = readJson(options.baseline, baseline) && compare(results, baseline, options.threshold) && passed;
+	}
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,7 @@
+; a long chain of pending non-tail calls
+(define (count n) (if (= n 0) 0 (+ 1 (count (- n 1)))))
+
+(define (repeat i acc) (if (= i 0) acc (repeat (- i 1) (+ acc (count 5000)))))
+
+(define (run) (repeat 20 0))
+(define expected 100000)
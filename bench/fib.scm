@@ -0,0 +1,5 @@
+; doubly recursive fibonacci: calls and integer arithmetic
+(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))
+
+(define (run) (fib 25))
+(define expected 75025)
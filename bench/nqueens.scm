@@ -0,0 +1,19 @@
+; number of ways to place n queens on an n by n board
+; the board is a closure from a row to the column of its queen, each placed queen extends it with another closure
+; the tests are nested ifs rather than and/or, which the bytecode compiler leaves to the tree walking evaluator
+(define (extend board row col) (lambda (r) (if (= r row) col (board r))))
+
+(define (safe? c col d) (if (= c col) #f (if (= c (+ col d)) #f (not (= c (- col d))))))
+
+; if a queen at (row, col) is not attacked by the queens in the rows from r to row - 1
+(define (ok? board r row col) (if (= r row) #t (if (safe? (board r) col (- row r)) (ok? board (+ r 1) row col) #f)))
+
+(define (try board row col n)
+	(if (= col n)
+		0
+		(+ (if (ok? board 0 row col) (place (extend board row col) (+ row 1) n) 0) (try board row (+ col 1) n))))
+
+(define (place board row n) (if (= row n) 1 (try board row 0 n)))
+
+(define (run) (place (lambda (r) 0) 0 8))
+(define expected 92)
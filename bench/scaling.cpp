@@ -0,0 +1,213 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../scheme.h"
+
+
+
+
+/**	scheme-scaling [--engine tree|bytecode|both] [--threads n] [--runs n] [kernel...]
+ * 	stress test of independent interpreters: for 1, 2, 4... up to n threads (the number of cores by default),
+ * 	every thread makes its own SchemeInterpreter, defines the kernel (fib by default) and calls (run) runs times
+ * 	the threads start together once all of them are ready, the wall time is measured until the last one is done
+ * 	prints the throughput (calls per second of all the threads) and the speedup over one thread: the interpreters
+ * 	only share the symbol table, so it should follow the number of threads up to the number of cores
+ * 	the exit status is 1 if a kernel failed or returned the wrong value */
+
+namespace
+{
+	struct Options
+	{
+		std::vector<Engine> engines{Engine::TREE, Engine::BYTECODE};
+		int threads = std::max(1, (int)std::thread::hardware_concurrency());
+		int runs = 10;
+		std::vector<std::string> kernels;
+	};
+
+	/**	the definitions of a kernel define run, which is called runs times and returns expected */
+	struct Kernel
+	{
+		std::string name;
+		std::vector<std::string> definitions;
+		std::string expected;
+	};
+
+	const Kernel KERNELS[] =
+	{
+		{"fib", {"(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))", "(define (run) (fib 25))"}, "75025"},
+		{"closures", {"(define (adder z) (lambda (x) (+ z x)))", "(define (loop i acc) (if (= i 0) acc (loop (- i 1) ((adder i) acc))))",
+			"(define (run) (loop 200000 0))"}, "20000100000"},
+	};
+
+	const Kernel* findKernel(const std::string& name)
+	{
+		for(const Kernel& kernel : KERNELS)
+			if(name == kernel.name)
+				return &kernel;
+		return nullptr;
+	}
+
+	const char* engineName(Engine engine)
+	{
+		return engine == Engine::TREE ? "tree" : "bytecode";
+	}
+
+	std::string toString(const std::shared_ptr<Sexp>& s)
+	{
+		std::ostringstream os;
+		if(s != nullptr)
+			os << *s;
+		return os.str();
+	}
+
+	/**	the threads wait for each other here, the last one to arrive starts the clock */
+	class StartGate
+	{
+		std::mutex mutex;
+		std::condition_variable arrived;
+		int waiting;
+		std::chrono::steady_clock::time_point start;
+	public:
+		StartGate(int threads) : waiting{threads} {}
+
+		void wait()
+		{
+			std::unique_lock<std::mutex> lock{mutex};
+			if(--waiting == 0)
+			{
+				start = std::chrono::steady_clock::now();
+				arrived.notify_all();
+			}
+			else
+				arrived.wait(lock, [this] {return waiting == 0;});
+		}
+
+		std::chrono::steady_clock::time_point getStart() const {return start;}
+	};
+
+	/**	runs the kernel on threads interpreters at once, false if one of them failed, seconds is the wall time of the calls */
+	bool run(const Options& options, const Kernel& kernel, Engine engine, int threads, double& seconds)
+	{
+		StartGate gate{threads};
+		std::vector<std::thread> workers;
+		std::vector<char> passed(threads, 0);
+		for(int t = 0; t < threads; t++)
+		{
+			workers.emplace_back([&, t]
+			{
+				SchemeInterpreter si;
+				si.setEngine(engine);
+				bool defined = true;
+				for(const std::string& definition : kernel.definitions)
+					defined = defined && si.eval(definition) != nullptr;
+				gate.wait();
+				bool correct = defined;
+				for(int i = 0; i < options.runs && correct; i++)
+					correct = toString(si.eval(std::string("(run)"))) == kernel.expected;
+				passed[t] = correct;
+			});
+		}
+		for(std::thread& worker : workers)
+			worker.join();
+		seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - gate.getStart()).count();
+
+		for(int t = 0; t < threads; t++)
+		{
+			if(!passed[t])
+			{
+				std::cerr << kernel.name << " (" << engineName(engine) << ") failed on thread " << t << " of " << threads << "\n";
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool parse(int argc, char* argv[], Options& options)
+	{
+		for(int i = 1; i < argc; i++)
+		{
+			std::string arg = argv[i];
+			if(arg.compare(0, 2, "--") != 0)
+			{
+				if(findKernel(arg) == nullptr)
+				{
+					std::cerr << "unknown kernel: " << arg << "\n";
+					return false;
+				}
+				options.kernels.push_back(arg);
+				continue;
+			}
+			if(i + 1 >= argc)
+			{
+				std::cerr << arg << " needs a value\n";
+				return false;
+			}
+			std::string value = argv[++i];
+			if(arg == "--engine" && (value == "tree" || value == "bytecode" || value == "both"))
+				options.engines = value == "both" ? std::vector<Engine>{Engine::TREE, Engine::BYTECODE} : std::vector<Engine>{value == "tree" ? Engine::TREE : Engine::BYTECODE};
+			else if(arg == "--threads" && std::atoi(value.c_str()) > 0)
+				options.threads = std::atoi(value.c_str());
+			else if(arg == "--runs" && std::atoi(value.c_str()) > 0)
+				options.runs = std::atoi(value.c_str());
+			else
+			{
+				std::cerr << "invalid option: " << arg << " " << value << "\n";
+				return false;
+			}
+		}
+		if(options.kernels.empty())
+			options.kernels.push_back("fib");
+		return true;
+	}
+}
+
+
+int main(int argc, char* argv[])
+{
+	Options options;
+	if(!parse(argc, argv, options))
+		return 1;
+
+	std::vector<int> counts;
+	for(int threads = 1; threads < options.threads; threads *= 2)
+		counts.push_back(threads);
+	counts.push_back(options.threads);
+
+	bool passed = true;
+	std::cout << std::thread::hardware_concurrency() << " cores\n";
+	std::cout << std::left << std::setw(16) << "kernel" << std::setw(10) << "engine" << std::right
+		<< std::setw(8) << "threads" << std::setw(12) << "seconds" << std::setw(14) << "calls/s" << std::setw(10) << "speedup" << std::setw(12) << "efficiency" << "\n";
+	for(const std::string& name : options.kernels)
+	{
+		for(Engine engine : options.engines)
+		{
+			double single = 0;
+			for(int threads : counts)
+			{
+				double seconds;
+				if(!run(options, *findKernel(name), engine, threads, seconds))
+				{
+					passed = false;
+					break;
+				}
+				double throughput = threads * options.runs / seconds;
+				if(threads == 1)
+					single = throughput;
+				double speedup = single > 0 ? throughput / single : 0;
+				std::cout << std::left << std::setw(16) << name << std::setw(10) << engineName(engine) << std::right << std::fixed
+					<< std::setw(8) << threads << std::setprecision(3) << std::setw(12) << seconds << std::setprecision(1) << std::setw(14) << throughput
+					<< std::setprecision(2) << std::setw(10) << speedup << std::setw(11) << speedup / threads * 100 << "%\n";
+			}
+		}
+	}
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,398 @@
+#include <algorithm>
+
+#include "bignum.h"
+
+
+//magnitude arithmetic
+namespace
+{
+	using Limbs = BigInt::Limbs;
+
+	void trim(Limbs& a)
+	{
+		while(!a.empty() && a.back() == 0)
+			a.pop_back();
+	}
+
+	int compareMagnitude(const Limbs& a, const Limbs& b)
+	{
+		if(a.size() != b.size())
+			return a.size() < b.size() ? -1 : 1;
+		for(size_t i = a.size(); i-- > 0;)
+		{
+			if(a[i] != b[i])
+				return a[i] < b[i] ? -1 : 1;
+		}
+		return 0;
+	}
+
+	Limbs addMagnitude(const Limbs& a, const Limbs& b)
+	{
+		const Limbs& longer = a.size() >= b.size() ? a : b;
+		const Limbs& shorter = a.size() >= b.size() ? b : a;
+		Limbs sum(longer.size() + 1);
+		uint64_t carry = 0;
+		for(size_t i = 0; i < longer.size(); i++)
+		{
+			uint64_t s = (uint64_t)longer[i] + (i < shorter.size() ? shorter[i] : 0) + carry;
+			sum[i] = (uint32_t)s;
+			carry = s >> 32;
+		}
+		sum[longer.size()] = (uint32_t)carry;
+		trim(sum);
+		return sum;
+	}
+
+	/**	a - b, a must not be less than b */
+	Limbs subtractMagnitude(const Limbs& a, const Limbs& b)
+	{
+		Limbs difference(a.size());
+		int64_t borrow = 0;
+		for(size_t i = 0; i < a.size(); i++)
+		{
+			int64_t d = (int64_t)a[i] - (i < b.size() ? b[i] : 0) - borrow;
+			borrow = d < 0 ? 1 : 0;
+			difference[i] = (uint32_t)(d + (borrow << 32));
+		}
+		trim(difference);
+		return difference;
+	}
+
+	/**	acc += x * 2^(32 * shift), acc has to be long enough for the result */
+	void addShifted(Limbs& acc, const Limbs& x, size_t shift)
+	{
+		uint64_t carry = 0;
+		size_t i = 0;
+		for(; i < x.size(); i++)
+		{
+			uint64_t s = (uint64_t)acc[i + shift] + x[i] + carry;
+			acc[i + shift] = (uint32_t)s;
+			carry = s >> 32;
+		}
+		for(; carry != 0; i++)
+		{
+			uint64_t s = (uint64_t)acc[i + shift] + carry;
+			acc[i + shift] = (uint32_t)s;
+			carry = s >> 32;
+		}
+	}
+
+	Limbs schoolbookMultiply(const Limbs& a, const Limbs& b)
+	{
+		Limbs product(a.size() + b.size());
+		for(size_t i = 0; i < a.size(); i++)
+		{
+			uint64_t carry = 0;
+			for(size_t j = 0; j < b.size(); j++)
+			{
+				uint64_t p = (uint64_t)a[i] * b[j] + product[i + j] + carry;
+				product[i + j] = (uint32_t)p;
+				carry = p >> 32;
+			}
+			product[i + b.size()] = (uint32_t)carry;
+		}
+		trim(product);
+		return product;
+	}
+
+	Limbs slice(const Limbs& a, size_t from, size_t to)
+	{
+		from = std::min(from, a.size());
+		to = std::min(to, a.size());
+		Limbs part(a.begin() + from, a.begin() + to);
+		trim(part);
+		return part;
+	}
+
+	Limbs multiplyMagnitude(const Limbs& a, const Limbs& b)
+	{
+		if(a.empty() || b.empty())
+			return Limbs();
+		if(a.size() < BigInt::KARATSUBA_THRESHOLD || b.size() < BigInt::KARATSUBA_THRESHOLD)
+			return schoolbookMultiply(a, b);
+
+		const Limbs& longer = a.size() >= b.size() ? a : b;
+		const Limbs& shorter = a.size() >= b.size() ? b : a;
+
+		//unbalanced operands: the longer one is multiplied in pieces of the shorter one's size
+		if(shorter.size() * 2 <= longer.size())
+		{
+			Limbs product(longer.size() + shorter.size() + 1);
+			for(size_t offset = 0; offset < longer.size(); offset += shorter.size())
+				addShifted(product, multiplyMagnitude(slice(longer, offset, offset + shorter.size()), shorter), offset);
+			trim(product);
+			return product;
+		}
+
+		//a * b = z2 * B^2m + z1 * B^m + z0, with three half sized multiplications
+		size_t m = longer.size() / 2;
+		Limbs a0 = slice(a, 0, m), a1 = slice(a, m, a.size());
+		Limbs b0 = slice(b, 0, m), b1 = slice(b, m, b.size());
+		Limbs z0 = multiplyMagnitude(a0, b0);
+		Limbs z2 = multiplyMagnitude(a1, b1);
+		Limbs z1 = subtractMagnitude(subtractMagnitude(multiplyMagnitude(addMagnitude(a0, a1), addMagnitude(b0, b1)), z0), z2);
+
+		Limbs product(a.size() + b.size() + 1);
+		addShifted(product, z0, 0);
+		addShifted(product, z1, m);
+		addShifted(product, z2, 2 * m);
+		trim(product);
+		return product;
+	}
+
+	/**	a = q * d + r for a single limb d */
+	Limbs divideMagnitude(const Limbs& a, uint32_t d, uint32_t& r)
+	{
+		Limbs q(a.size());
+		uint64_t rest = 0;
+		for(size_t i = a.size(); i-- > 0;)
+		{
+			uint64_t current = (rest << 32) | a[i];
+			q[i] = (uint32_t)(current / d);
+			rest = current % d;
+		}
+		r = (uint32_t)rest;
+		trim(q);
+		return q;
+	}
+
+	/**	a = q * b + r, Knuth's algorithm D (The Art of Computer Programming, 4.3.1) */
+	void divideMagnitude(const Limbs& a, const Limbs& b, Limbs& q, Limbs& r)
+	{
+		if(compareMagnitude(a, b) < 0)
+		{
+			q.clear();
+			r = a;
+			return;
+		}
+		if(b.size() == 1)
+		{
+			uint32_t rest;
+			q = divideMagnitude(a, b[0], rest);
+			r = rest == 0 ? Limbs() : Limbs{rest};
+			return;
+		}
+
+		size_t n = b.size();
+		size_t m = a.size();
+		//normalize, so the top limb of the divisor has its highest bit set
+		int s = __builtin_clz(b[n - 1]);
+		Limbs v(n);
+		Limbs u(m + 1);
+		for(size_t i = n - 1; i > 0; i--)
+			v[i] = (b[i] << s) | (s == 0 ? 0 : (uint32_t)((uint64_t)b[i - 1] >> (32 - s)));
+		v[0] = b[0] << s;
+		u[m] = s == 0 ? 0 : (uint32_t)((uint64_t)a[m - 1] >> (32 - s));
+		for(size_t i = m - 1; i > 0; i--)
+			u[i] = (a[i] << s) | (s == 0 ? 0 : (uint32_t)((uint64_t)a[i - 1] >> (32 - s)));
+		u[0] = a[0] << s;
+
+		const uint64_t base = (uint64_t)1 << 32;
+		q.assign(m - n + 1, 0);
+		for(size_t j = m - n + 1; j-- > 0;)
+		{
+			//estimate the quotient limb from the top two limbs, it is at most 2 too large
+			uint64_t top = ((uint64_t)u[j + n] << 32) | u[j + n - 1];
+			uint64_t qhat = top / v[n - 1];
+			uint64_t rhat = top % v[n - 1];
+			while(qhat >= base || qhat * v[n - 2] > ((rhat << 32) | u[j + n - 2]))
+			{
+				qhat--;
+				rhat += v[n - 1];
+				if(rhat >= base)
+					break;
+			}
+
+			//multiply and subtract
+			int64_t borrow = 0;
+			int64_t t;
+			for(size_t i = 0; i < n; i++)
+			{
+				uint64_t p = qhat * v[i];
+				t = (int64_t)u[i + j] - borrow - (int64_t)(p & 0xFFFFFFFF);
+				u[i + j] = (uint32_t)t;
+				borrow = (int64_t)(p >> 32) - (t >> 32);
+			}
+			t = (int64_t)u[j + n] - borrow;
+			u[j + n] = (uint32_t)t;
+
+			q[j] = (uint32_t)qhat;
+			//subtracted too much, add back
+			if(t < 0)
+			{
+				q[j]--;
+				uint64_t carry = 0;
+				for(size_t i = 0; i < n; i++)
+				{
+					uint64_t sum = (uint64_t)u[i + j] + v[i] + carry;
+					u[i + j] = (uint32_t)sum;
+					carry = sum >> 32;
+				}
+				u[j + n] += (uint32_t)carry;
+			}
+		}
+		trim(q);
+
+		//unnormalize the remainder
+		r.assign(n, 0);
+		for(size_t i = 0; i < n; i++)
+			r[i] = (u[i] >> s) | (s == 0 ? 0 : (uint32_t)((uint64_t)u[i + 1] << (32 - s)));
+		trim(r);
+	}
+}
+
+
+//BigInt
+
+BigInt::BigInt(bool negative, Limbs limbs) : negative{negative}, limbs{std::move(limbs)}
+{
+	trim(this->limbs);
+	if(this->limbs.empty())
+		this->negative = false;
+}
+
+BigInt::BigInt(int64_t value) : negative{value < 0}
+{
+	//the magnitude of INT64_MIN doesn't fit in int64_t, but it does in uint64_t
+	uint64_t magnitude = value < 0 ? ~(uint64_t)value + 1 : (uint64_t)value;
+	while(magnitude != 0)
+	{
+		limbs.push_back((uint32_t)magnitude);
+		magnitude >>= 32;
+	}
+}
+
+bool BigInt::parse(const std::string& text, BigInt& result)
+{
+	size_t start = text.size() > 1 && (text[0] == '-' || text[0] == '+') ? 1 : 0;
+	if(start == text.size())
+		return false;
+	for(size_t i = start; i < text.size(); i++)
+	{
+		if(text[i] < '0' || text[i] > '9')
+			return false;
+	}
+
+	//9 digits at a time: magnitude = magnitude * 10^k + chunk
+	Limbs magnitude;
+	for(size_t i = start; i < text.size();)
+	{
+		size_t end = std::min(text.size(), i + 9);
+		uint64_t multiplier = 1;
+		uint64_t chunk = 0;
+		for(; i < end; i++)
+		{
+			multiplier *= 10;
+			chunk = chunk * 10 + (text[i] - '0');
+		}
+		uint64_t carry = chunk;
+		for(uint32_t& limb : magnitude)
+		{
+			uint64_t p = limb * multiplier + carry;
+			limb = (uint32_t)p;
+			carry = p >> 32;
+		}
+		if(carry != 0)
+			magnitude.push_back((uint32_t)carry);
+	}
+	result = BigInt{text[0] == '-', std::move(magnitude)};
+	return true;
+}
+
+bool BigInt::isZero() const
+{
+	return limbs.empty();
+}
+
+bool BigInt::isNegative() const
+{
+	return negative;
+}
+
+bool BigInt::fitsInt64() const
+{
+	if(limbs.size() > 2)
+		return false;
+	uint64_t magnitude = limbs.empty() ? 0 : limbs[0] | (limbs.size() > 1 ? (uint64_t)limbs[1] << 32 : 0);
+	return negative ? magnitude <= (uint64_t)1 << 63 : magnitude < (uint64_t)1 << 63;
+}
+
+int64_t BigInt::toInt64() const
+{
+	uint64_t magnitude = limbs.empty() ? 0 : limbs[0] | (limbs.size() > 1 ? (uint64_t)limbs[1] << 32 : 0);
+	return negative ? (int64_t)(~magnitude + 1) : (int64_t)magnitude;
+}
+
+std::string BigInt::toString() const
+{
+	if(limbs.empty())
+		return "0";
+	//9 digits at a time, from the lowest
+	std::string digits;
+	Limbs rest = limbs;
+	while(!rest.empty())
+	{
+		uint32_t chunk;
+		rest = divideMagnitude(rest, 1000000000, chunk);
+		for(int i = 0; i < 9 && (!rest.empty() || chunk != 0); i++)
+		{
+			digits.push_back('0' + chunk % 10);
+			chunk /= 10;
+		}
+	}
+	if(negative)
+		digits.push_back('-');
+	std::reverse(digits.begin(), digits.end());
+	return digits;
+}
+
+int BigInt::compare(const BigInt& left, const BigInt& right)
+{
+	if(left.negative != right.negative)
+		return left.negative ? -1 : 1;
+	int magnitude = compareMagnitude(left.limbs, right.limbs);
+	return left.negative ? -magnitude : magnitude;
+}
+
+BigInt BigInt::operator-() const
+{
+	return BigInt{!negative, limbs};
+}
+
+BigInt operator+(const BigInt& left, const BigInt& right)
+{
+	if(left.negative == right.negative)
+		return BigInt{left.negative, addMagnitude(left.limbs, right.limbs)};
+	if(compareMagnitude(left.limbs, right.limbs) >= 0)
+		return BigInt{left.negative, subtractMagnitude(left.limbs, right.limbs)};
+	return BigInt{right.negative, subtractMagnitude(right.limbs, left.limbs)};
+}
+
+BigInt operator-(const BigInt& left, const BigInt& right)
+{
+	return left + -right;
+}
+
+BigInt operator*(const BigInt& left, const BigInt& right)
+{
+	return BigInt{left.negative != right.negative, multiplyMagnitude(left.limbs, right.limbs)};
+}
+
+BigInt operator/(const BigInt& left, const BigInt& right)
+{
+	Limbs q, r;
+	divideMagnitude(left.limbs, right.limbs, q, r);
+	return BigInt{left.negative != right.negative, std::move(q)};
+}
+
+BigInt operator%(const BigInt& left, const BigInt& right)
+{
+	Limbs q, r;
+	divideMagnitude(left.limbs, right.limbs, q, r);
+	return BigInt{left.negative, std::move(r)};
+}
+
+std::ostream& operator<<(std::ostream& os, const BigInt& b)
+{
+	return os << b.toString();
+}
@@ -0,0 +1,57 @@
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+
+
+
+#pragma once
+
+
+/**	BigInt is an arbitrary precision integer, Numbers that don't fit in a fixnum hold one
+ * 	it is stored as a sign and a magnitude: little endian base 2^32 limbs, without leading zero limbs (zero has no limbs) */
+class BigInt
+{
+public:
+	using Limbs = std::vector<uint32_t>;
+
+	/**	operands with at least this many limbs are multiplied with Karatsuba's algorithm, smaller ones with the schoolbook method */
+	enum : size_t {KARATSUBA_THRESHOLD = 32};
+
+private:
+	bool negative;
+	Limbs limbs;
+
+	BigInt(bool negative, Limbs limbs);
+
+public:
+	BigInt(int64_t value = 0);
+
+	/**	parses an optionally signed decimal integer literal, returns false if text is not one */
+	static bool parse(const std::string& text, BigInt& result);
+
+	bool isZero() const;
+	bool isNegative() const;
+
+	/**	if the value is in the range of int64_t */
+	bool fitsInt64() const;
+	int64_t toInt64() const;
+
+	std::string toString() const;
+
+	/**	-1, 0 or 1 if left is less than, equal to, or greater than right */
+	static int compare(const BigInt& left, const BigInt& right);
+
+	BigInt operator-() const;
+	friend BigInt operator+(const BigInt& left, const BigInt& right);
+	friend BigInt operator-(const BigInt& left, const BigInt& right);
+	friend BigInt operator*(const BigInt& left, const BigInt& right);
+
+	/**	division truncating towards zero, like int64_t's, right must not be zero */
+	friend BigInt operator/(const BigInt& left, const BigInt& right);
+	/**	remainder with the sign of left, like int64_t's, right must not be zero */
+	friend BigInt operator%(const BigInt& left, const BigInt& right);
+};
+
+std::ostream& operator<<(std::ostream& os, const BigInt& b);
@@ -0,0 +1,756 @@
+#include <iomanip>
+
+#include "bytecode.h"
+#include "optimizer.h"
+#include "future.h"
+#include "profiler.h"
+
+//computed goto dispatch is a GCC/Clang extension, other compilers use a switch
+#if defined(__GNUC__)
+#define SCHEME_COMPUTED_GOTO
+#endif
+
+
+//Bytecode
+
+const char* Bytecode::opcodeName(int32_t op)
+{
+	static const char* names[] = {
+		"CONST", "LOCAL_REF", "GLOBAL_REF", "DEFINE", "CLOSURE", "CALL", "TAIL_CALL", "RETURN",
+		"JUMP", "JUMP_IF_FALSE", "POP", "EVAL",
+		"ADD", "SUB", "MUL", "DIV", "LESS", "GREATER", "EQUAL", "GUARD", "GLOBAL_CALLEE", "CALLEE"
+	};
+	static_assert(sizeof(names) / sizeof(names[0]) == OPCODE_COUNT, "every opcode needs a name");
+	return op >= 0 && op < OPCODE_COUNT ? names[op] : "???";
+}
+
+int Bytecode::operandCount(int32_t op)
+{
+	switch(op)
+	{
+		case GUARD:
+		case GLOBAL_CALLEE:
+			return 3;
+		case LOCAL_REF:
+		case CALLEE:
+			return 2;
+		case CONST:
+		case GLOBAL_REF:
+		case DEFINE:
+		case CLOSURE:
+		case CALL:
+		case TAIL_CALL:
+		case JUMP:
+		case JUMP_IF_FALSE:
+		case EVAL:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+
+//CodeObject
+
+void CodeObject::emit(int32_t op)
+{
+	code.push_back(op);
+}
+
+void CodeObject::emit(int32_t op, int32_t operand)
+{
+	code.push_back(op);
+	code.push_back(operand);
+}
+
+void CodeObject::emit(int32_t op, int32_t operand1, int32_t operand2)
+{
+	code.push_back(op);
+	code.push_back(operand1);
+	code.push_back(operand2);
+}
+
+void CodeObject::emit(int32_t op, int32_t operand1, int32_t operand2, int32_t operand3)
+{
+	code.push_back(op);
+	code.push_back(operand1);
+	code.push_back(operand2);
+	code.push_back(operand3);
+}
+
+int32_t CodeObject::addConstant(std::shared_ptr<Sexp> constant)
+{
+	constants.push_back(constant);
+	return constants.size() - 1;
+}
+
+int32_t CodeObject::addGlobal(std::shared_ptr<GlobalCell> cell)
+{
+	for(size_t i = 0; i < globals.size(); i++)
+	{
+		if(globals[i] == cell)
+			return i;
+	}
+	globals.push_back(cell);
+	return globals.size() - 1;
+}
+
+void CodeObject::dump(std::ostream& os, int indent) const
+{
+	std::string margin(indent, ' ');
+	os << margin << "code for " << *source << ":\n";
+	for(size_t ip = 0; ip < code.size(); )
+	{
+		int32_t op = code[ip];
+		os << margin << std::setw(5) << ip << "  " << std::left << std::setw(14) << Bytecode::opcodeName(op) << std::right;
+		int operands = Bytecode::operandCount(op);
+		for(int i = 1; i <= operands; i++)
+			os << " " << code[ip + i];
+		switch(op)
+		{
+			case Bytecode::CONST:
+			case Bytecode::EVAL:
+				os << "\t; " << *constants[code[ip + 1]];
+				break;
+			case Bytecode::GLOBAL_REF:
+			case Bytecode::DEFINE:
+			case Bytecode::GUARD:
+			case Bytecode::GLOBAL_CALLEE:
+				os << "\t; " << SymbolTable::name(globals[code[ip + 1]]->id);
+				break;
+			default:
+				break;
+		}
+		os << "\n";
+		ip += 1 + operands;
+	}
+	for(const auto& lambda : lambdas)
+		lambda->dump(os, indent + 2);
+}
+
+
+//BytecodeCompiler
+
+BytecodeCompiler::BytecodeCompiler(std::shared_ptr<Environment> global) : global{global.get()} {}
+
+bool BytecodeCompiler::isLocal(int id) const
+{
+	for(const std::vector<int>* scope : scopes)
+	{
+		for(int name : *scope)
+		{
+			if(name == id)
+				return true;
+		}
+	}
+	return false;
+}
+
+std::shared_ptr<Sexp> BytecodeCompiler::globalForm(std::shared_ptr<Sexp> head) const
+{
+	//from the expansions of inlined lambdas of the tree walking evaluator
+	if(head->getKind() == Kind::GLOBAL_VARIABLE)
+		return static_cast<const GlobalVariable*>(head.get())->getCell()->value;
+	Symbol* symbol = dynamic_cast<Symbol*>(head.get());
+	if(symbol == nullptr || isLocal(symbol->getId()))
+		return nullptr;
+	return global->getValue(symbol->getId());
+}
+
+std::shared_ptr<CodeObject> BytecodeCompiler::compileTopLevel(std::shared_ptr<Sexp> exp)
+{
+	std::shared_ptr<CodeObject> code = std::make_shared<CodeObject>();
+	code->arglist = Heap::make<List>();
+	code->args = std::make_shared<std::vector<int>>();
+	code->source = exp;
+	code->body = exp;
+	compile(exp, *code, true);
+	return code;
+}
+
+std::shared_ptr<CodeObject> BytecodeCompiler::compileLambda(std::shared_ptr<List> arglist, std::shared_ptr<Sexp> body, std::shared_ptr<Sexp> source)
+{
+	std::shared_ptr<CodeObject> code = std::make_shared<CodeObject>();
+	code->arglist = arglist;
+	code->args = Lambda::argumentIds(arglist);
+	code->source = source;
+	//compiled lambdas print their body, and the optimizer inlines it: the one written is kept
+	std::shared_ptr<Sexp> written = OptimizedBody::unwrap(body);
+	code->body = written != nullptr ? written : body;
+	scopes.insert(scopes.begin(), code->args.get());
+	compile(body, *code, true);
+	scopes.erase(scopes.begin());
+	return code;
+}
+
+void BytecodeCompiler::compile(std::shared_ptr<Sexp> exp, CodeObject& code, bool tail)
+{
+	if(Symbol* symbol = dynamic_cast<Symbol*>(exp.get()))
+	{
+		bool found = false;
+		for(size_t depth = 0; depth < scopes.size() && !found; depth++)
+		{
+			const std::vector<int>& scope = *scopes[depth];
+			for(size_t slot = 0; slot < scope.size(); slot++)
+			{
+				if(scope[slot] == symbol->getId())
+				{
+					code.emit(Bytecode::LOCAL_REF, depth, slot);
+					found = true;
+					break;
+				}
+			}
+		}
+		if(!found)
+			code.emit(Bytecode::GLOBAL_REF, code.addGlobal(global->getCell(symbol->getId())));
+	}
+	else if(exp->getKind() == Kind::GLOBAL_VARIABLE)
+	{
+		code.emit(Bytecode::GLOBAL_REF, code.addGlobal(static_cast<const GlobalVariable*>(exp.get())->getCell()));
+	}
+	else if(std::shared_ptr<List> list = std::dynamic_pointer_cast<List>(exp))
+	{
+		compileList(list, code, tail);
+		return;
+	}
+	else
+	{
+		//numbers and other self evaluating atoms
+		code.emit(Bytecode::CONST, code.addConstant(exp));
+	}
+
+	if(tail)
+		code.emit(Bytecode::RETURN);
+}
+
+void BytecodeCompiler::compileList(std::shared_ptr<List> list, CodeObject& code, bool tail)
+{
+	if(list->Car() == nullptr)
+	{
+		code.emit(Bytecode::CONST, code.addConstant(list));
+		if(tail)
+			code.emit(Bytecode::RETURN);
+		return;
+	}
+
+	int size = list->size();
+
+	// (inlined name function expansion call)
+	if(dynamic_cast<InlinedCall*>(list->Car().get()) != nullptr && size == 5 && globalForm(list->Cdr()->Car()) != nullptr)
+	{
+		std::shared_ptr<List> rest = list->Cdr();
+		std::shared_ptr<GlobalCell> cell = rest->Car()->getKind() == Kind::GLOBAL_VARIABLE
+			? static_cast<const GlobalVariable*>(rest->Car().get())->getCell()
+			: global->getCell(static_cast<const Symbol*>(rest->Car().get())->getId());
+		code.emit(Bytecode::GUARD, code.addGlobal(cell), code.addConstant(rest->Cdr()->Car()), 0);
+		size_t jumpToCall = code.code.size() - 1;
+		rest = rest->Cdr()->Cdr();
+		compile(rest->Car(), code, tail);
+		size_t jumpToEnd = 0;
+		if(!tail)
+		{
+			code.emit(Bytecode::JUMP, 0);
+			jumpToEnd = code.code.size() - 1;
+		}
+		code.code[jumpToCall] = code.code.size();
+		compile(rest->Cdr()->Car(), code, tail);
+		if(!tail)
+			code.code[jumpToEnd] = code.code.size();
+		return;
+	}
+
+	std::shared_ptr<Sexp> form = globalForm(list->Car());
+
+	// (lambda (args...) body)
+	if(dynamic_cast<CreateLambda*>(form.get()) != nullptr && size >= 3 && Lambda::isArglist(list->Cdr()->Car()))
+	{
+		std::shared_ptr<List> arglist = std::static_pointer_cast<List>(list->Cdr()->Car());
+		code.lambdas.push_back(compileLambda(arglist, list->Cdr()->Cdr()->Car(), list));
+		code.emit(Bytecode::CLOSURE, code.lambdas.size() - 1);
+		if(tail)
+			code.emit(Bytecode::RETURN);
+		return;
+	}
+
+	// (define name exp), (define (fun vars...) body)
+	if(dynamic_cast<DefineFunction*>(form.get()) != nullptr && size >= 3)
+	{
+		std::shared_ptr<Sexp> target = list->Cdr()->Car();
+		std::shared_ptr<Sexp> body = list->Cdr()->Cdr()->Car();
+		if(Symbol* name = dynamic_cast<Symbol*>(target.get()))
+		{
+			compile(body, code, false);
+			code.emit(Bytecode::DEFINE, code.addGlobal(global->getCell(name->getId())));
+		}
+		else
+		{
+			std::shared_ptr<List> header = std::dynamic_pointer_cast<List>(target);
+			Symbol* function = header == nullptr ? nullptr : dynamic_cast<Symbol*>(header->Car().get());
+			if(function == nullptr || (header->Cdr() != nullptr && !Lambda::isArglist(header->Cdr())))
+			{
+				//define or CreateLambda reports the error when it runs
+				code.emit(Bytecode::EVAL, code.addConstant(list));
+			}
+			else
+			{
+				std::shared_ptr<List> arglist = header->Cdr() == nullptr ? Heap::make<List>() : header->Cdr();
+				std::vector<std::shared_ptr<Sexp>> source;
+				source.push_back(Symbol::intern("lambda"));
+				source.push_back(arglist);
+				source.push_back(body);
+				code.lambdas.push_back(compileLambda(arglist, body, Heap::make<List>(source)));
+				code.emit(Bytecode::CLOSURE, code.lambdas.size() - 1);
+				code.emit(Bytecode::DEFINE, code.addGlobal(global->getCell(function->getId())));
+			}
+		}
+		if(tail)
+			code.emit(Bytecode::RETURN);
+		return;
+	}
+
+	// (if test trueExp falseExp)
+	if(dynamic_cast<IfLambda*>(form.get()) != nullptr && size >= 3)
+	{
+		compile(list->Cdr()->Car(), code, false);
+		code.emit(Bytecode::JUMP_IF_FALSE, 0);
+		size_t jumpToFalse = code.code.size() - 1;
+		compile(list->Cdr()->Cdr()->Car(), code, tail);
+		size_t jumpToEnd = 0;
+		if(!tail)
+		{
+			code.emit(Bytecode::JUMP, 0);
+			jumpToEnd = code.code.size() - 1;
+		}
+		code.code[jumpToFalse] = code.code.size();
+		std::shared_ptr<List> falseBranch = list->Cdr()->Cdr()->Cdr();
+		if(falseBranch != nullptr)
+			compile(falseBranch->Car(), code, tail);
+		else
+		{
+			code.emit(Bytecode::GLOBAL_REF, code.addGlobal(global->getCell(SymbolTable::False)));
+			if(tail)
+				code.emit(Bytecode::RETURN);
+		}
+		if(!tail)
+			code.code[jumpToEnd] = code.code.size();
+		return;
+	}
+
+	//other syntax is left to the tree walking evaluator
+	if(dynamic_cast<SyntaxLambda*>(form.get()) != nullptr)
+	{
+		code.emit(Bytecode::EVAL, code.addConstant(list));
+		if(tail)
+			code.emit(Bytecode::RETURN);
+		return;
+	}
+
+	//open coded primitives
+	int32_t op = -1;
+	if(dynamic_cast<AddFunction*>(form.get()) != nullptr)
+		op = Bytecode::ADD;
+	else if(dynamic_cast<MinusFunction*>(form.get()) != nullptr)
+		op = Bytecode::SUB;
+	else if(dynamic_cast<MultiplyFunction*>(form.get()) != nullptr)
+		op = Bytecode::MUL;
+	else if(dynamic_cast<DivisionFunction*>(form.get()) != nullptr)
+		op = Bytecode::DIV;
+	else if(dynamic_cast<LessFunction*>(form.get()) != nullptr && size == 3)
+		op = Bytecode::LESS;
+	else if(dynamic_cast<GreaterFunction*>(form.get()) != nullptr && size == 3)
+		op = Bytecode::GREATER;
+	else if(dynamic_cast<EqualFunction*>(form.get()) != nullptr && size == 3)
+		op = Bytecode::EQUAL;
+
+	if(op != -1 && size >= 3)
+	{
+		// (+ a b c) is compiled as (+ (+ a b) c)
+		compile(list->Cdr()->Car(), code, false);
+		for(auto s : *list->Cdr()->Cdr())
+		{
+			compile(s, code, false);
+			code.emit(op);
+		}
+		if(tail)
+			code.emit(Bytecode::RETURN);
+		return;
+	}
+
+	//function call - if the head is not a function, the list evaluates to itself, without evaluating the arguments
+	std::shared_ptr<Sexp> head = list->Car();
+	if(head->getKind() != Kind::SYMBOL && head->getKind() != Kind::GLOBAL_VARIABLE && head->getKind() != Kind::LIST)
+	{
+		code.emit(Bytecode::CONST, code.addConstant(list));
+		if(tail)
+			code.emit(Bytecode::RETURN);
+		return;
+	}
+	if(head->getKind() == Kind::GLOBAL_VARIABLE)
+		code.emit(Bytecode::GLOBAL_CALLEE, code.addGlobal(static_cast<const GlobalVariable*>(head.get())->getCell()), code.addConstant(list), 0);
+	else if(head->getKind() == Kind::SYMBOL && !isLocal(static_cast<const Symbol*>(head.get())->getId()))
+		code.emit(Bytecode::GLOBAL_CALLEE, code.addGlobal(global->getCell(static_cast<const Symbol*>(head.get())->getId())), code.addConstant(list), 0);
+	else
+	{
+		compile(head, code, false);
+		code.emit(Bytecode::CALLEE, code.addConstant(list), 0);
+	}
+	size_t jumpToEnd = code.code.size() - 1;
+	if(list->Cdr() != nullptr)
+	{
+		for(auto s : *list->Cdr())
+			compile(s, code, false);
+	}
+	code.emit(tail ? Bytecode::TAIL_CALL : Bytecode::CALL, size - 1);
+	code.code[jumpToEnd] = code.code.size();
+	if(tail)
+		code.emit(Bytecode::RETURN);
+}
+
+
+//CompiledLambda
+
+CompiledLambda::CompiledLambda(std::shared_ptr<Environment> env, std::shared_ptr<const CodeObject> code)
+	: Lambda{Kind::COMPILED_CLOSURE, env, code->arglist, code->args, code->body}, code{code} {}
+
+std::shared_ptr<Sexp> CompiledLambda::evalFrame(std::shared_ptr<Environment> frame, TailCall& tail) const
+{
+	return VirtualMachine::run(code, frame, this);
+}
+
+std::shared_ptr<const CodeObject> CompiledLambda::getCode() const
+{
+	return code;
+}
+
+
+//VirtualMachine
+
+namespace
+{
+	/**	saved state of a caller while the callee runs */
+	struct CallFrame
+	{
+		std::shared_ptr<const CodeObject> code;
+		size_t ip;
+		std::shared_ptr<Environment> env;
+		size_t base;
+	};
+
+	/**	returns from the closures the VM entered on the stack of the profiler when the VM returns, after an error too */
+	struct ProfilerUnwind
+	{
+		Profiler* profiler;
+		size_t depth;
+		ProfilerUnwind(Profiler* profiler) : profiler{profiler}, depth{profiler != nullptr ? profiler->depth() : 0} {}
+		~ProfilerUnwind()
+		{
+			if(profiler != nullptr)
+				profiler->unwind(depth);
+		}
+	};
+
+	Number* arithmeticOperand(const std::shared_ptr<Sexp>& s)
+	{
+		if(s == nullptr)
+			return nullptr;
+		return CommonInteger::ConvertAndCheck(s.get());
+	}
+}
+
+std::shared_ptr<Sexp> VirtualMachine::run(std::shared_ptr<const CodeObject> entry, std::shared_ptr<Environment> entryEnv, const Lambda* function)
+{
+	Profiler* profiler = Profiler::active();
+	ProfilerUnwind unwind{profiler};
+	if(profiler != nullptr && function != nullptr)
+		profiler->enter(function);
+
+	std::vector<CallFrame> frames;
+	std::vector<std::shared_ptr<Sexp>> stack;
+
+	std::shared_ptr<const CodeObject> current = entry;
+	std::shared_ptr<Environment> env = entryEnv;
+	const int32_t* code = current->code.data();
+	size_t ip = 0;
+	//stack height when the current function was entered
+	size_t base = 0;
+
+	int32_t argc = 0;
+	bool tail = false;
+
+//pops the current function's frame, and pushes its result for the caller
+#define VM_RETURN() \
+	{ \
+		if(profiler != nullptr && profiler->depth() > unwind.depth) \
+			profiler->exit(); \
+		std::shared_ptr<Sexp> result = stack.back(); \
+		stack.resize(base); \
+		if(frames.empty()) \
+			return result; \
+		CallFrame& caller = frames.back(); \
+		current = caller.code; \
+		ip = caller.ip; \
+		env = caller.env; \
+		base = caller.base; \
+		code = current->code.data(); \
+		frames.pop_back(); \
+		stack.push_back(result); \
+	}
+
+#ifdef SCHEME_COMPUTED_GOTO
+	//computed gotos don't run destructors, so no local with a destructor may be in scope where VM_DISPATCH is used
+	static void* dispatchTable[] = {
+		&&op_CONST, &&op_LOCAL_REF, &&op_GLOBAL_REF, &&op_DEFINE, &&op_CLOSURE, &&op_CALL, &&op_TAIL_CALL, &&op_RETURN,
+		&&op_JUMP, &&op_JUMP_IF_FALSE, &&op_POP, &&op_EVAL,
+		&&op_ADD, &&op_SUB, &&op_MUL, &&op_DIV, &&op_LESS, &&op_GREATER, &&op_EQUAL, &&op_GUARD, &&op_GLOBAL_CALLEE, &&op_CALLEE
+	};
+	static_assert(sizeof(dispatchTable) / sizeof(dispatchTable[0]) == Bytecode::OPCODE_COUNT, "every opcode needs a label");
+#define VM_DISPATCH() goto *dispatchTable[code[ip++]]
+#define VM_CASE(op) op_##op:
+	VM_DISPATCH();
+	{
+		{
+#else
+#define VM_DISPATCH() continue
+#define VM_CASE(op) case Bytecode::op:
+	for(;;)
+	{
+		switch(code[ip++])
+		{
+#endif
+
+	VM_CASE(CONST)
+	{
+		stack.push_back(current->constants[code[ip++]]);
+		VM_DISPATCH();
+	}
+	VM_CASE(LOCAL_REF)
+	{
+		const std::shared_ptr<Sexp>& value = env->getSlot(code[ip], code[ip + 1]);
+		ip += 2;
+		if(value == nullptr)
+		{
+			loge << "variable is unbound\n";
+			return nullptr;
+		}
+		stack.push_back(value);
+		VM_DISPATCH();
+	}
+	VM_CASE(GLOBAL_REF)
+	{
+		const GlobalCell& cell = *current->globals[code[ip++]];
+		if(cell.value == nullptr)
+		{
+			loge << "variable " << SymbolTable::name(cell.id) << " is unbound\n";
+			return nullptr;
+		}
+		stack.push_back(cell.value);
+		VM_DISPATCH();
+	}
+	VM_CASE(DEFINE)
+	{
+		if(Future::running())
+		{
+			loge << "define can't be used in a future\n";
+			return nullptr;
+		}
+		current->globals[code[ip++]]->value = stack.back();
+		VM_DISPATCH();
+	}
+	VM_CASE(CLOSURE)
+	{
+		stack.push_back(Heap::make<CompiledLambda>(env, current->lambdas[code[ip++]]));
+		VM_DISPATCH();
+	}
+	VM_CASE(TAIL_CALL)
+	{
+		argc = code[ip++];
+		tail = true;
+		goto call;
+	}
+	VM_CASE(CALL)
+	{
+		argc = code[ip++];
+		tail = false;
+	call:
+		Heap::collectIfNeeded();
+		size_t calleeIndex = stack.size() - argc - 1;
+		if(!stack[calleeIndex]->isLambda())
+		{
+			loge << *stack[calleeIndex] << " is not a function\n";
+			return nullptr;
+		}
+		Lambda* lambda = static_cast<Lambda*>(stack[calleeIndex].get());
+
+		if(lambda->getKind() != Kind::COMPILED_CLOSURE)
+		{
+			if(lambda->getKind() == Kind::SPECIAL_FORM)
+			{
+				loge << *lambda << " can't be called with evaluated arguments\n";
+				return nullptr;
+			}
+			//lambdas of the tree walking evaluator get their arguments in their frame, primitives in a list
+			{
+				std::shared_ptr<Sexp> result;
+				std::shared_ptr<Environment> frame = lambda->makeFrame();
+				if(frame != nullptr)
+				{
+					if((size_t)argc != frame->getSlotCount())
+					{
+						loge << "wrong number of arguments for " << *lambda << ". (Expected: " << frame->getSlotCount() << ", got: " << argc << ")\n";
+						return nullptr;
+					}
+					for(int32_t i = 0; i < argc; i++)
+						frame->setSlot(i, std::move(stack[calleeIndex + 1 + i]));
+					result = lambda->run(std::move(frame));
+				}
+				else if(argc == 2)
+					result = lambda->evalBinary(stack[calleeIndex + 1], stack[calleeIndex + 2]);
+				else
+					result = lambda->eval(nullptr, Heap::make<List>(stack.data() + calleeIndex + 1, (size_t)argc));
+				if(result == nullptr)
+					return nullptr;
+				stack.resize(calleeIndex);
+				stack.push_back(std::move(result));
+			}
+			if(tail)
+				VM_RETURN();
+			VM_DISPATCH();
+		}
+
+		{
+			CompiledLambda* compiled = static_cast<CompiledLambda*>(lambda);
+			std::shared_ptr<const CodeObject> calleeCode = compiled->getCode();
+			if((size_t)argc != calleeCode->args->size())
+			{
+				loge << "wrong number of arguments for " << *compiled << ". (Expected: " << calleeCode->args->size() << ", got: " << argc << ")\n";
+				return nullptr;
+			}
+			//before the callee is popped from the stack, it may be the only reference to it
+			if(profiler != nullptr)
+			{
+				if(tail && profiler->depth() > unwind.depth)
+					profiler->exit();
+				profiler->enter(compiled);
+			}
+			std::shared_ptr<Environment> frame = Heap::make<Environment>(compiled->getEnv(), calleeCode->args);
+			for(int32_t i = 0; i < argc; i++)
+				frame->setSlot(i, std::move(stack[calleeIndex + 1 + i]));
+			stack.resize(calleeIndex);
+
+			if(tail)
+			{
+				//the current function's operands are dead, the callee returns directly to our caller
+				stack.resize(base);
+			}
+			else
+			{
+				frames.push_back(CallFrame{current, ip, env, base});
+				base = stack.size();
+			}
+			current = std::move(calleeCode);
+			env = std::move(frame);
+		}
+		code = current->code.data();
+		ip = 0;
+		VM_DISPATCH();
+	}
+	VM_CASE(RETURN)
+	{
+		VM_RETURN();
+		VM_DISPATCH();
+	}
+	VM_CASE(JUMP)
+	{
+		ip = code[ip];
+		VM_DISPATCH();
+	}
+	VM_CASE(JUMP_IF_FALSE)
+	{
+		bool test = (bool)*stack.back();
+		stack.pop_back();
+		ip = test ? ip + 1 : code[ip];
+		VM_DISPATCH();
+	}
+	VM_CASE(POP)
+	{
+		stack.pop_back();
+		VM_DISPATCH();
+	}
+	VM_CASE(GUARD)
+	{
+		if(current->globals[code[ip]]->value == current->constants[code[ip + 1]])
+			ip += 3;
+		else
+			ip = code[ip + 2];
+		VM_DISPATCH();
+	}
+	VM_CASE(GLOBAL_CALLEE)
+	{
+		const std::shared_ptr<Sexp>& value = current->globals[code[ip]]->value;
+		if(value != nullptr && value->isLambda())
+		{
+			stack.push_back(value);
+			ip += 3;
+		}
+		else
+		{
+			stack.push_back(current->constants[code[ip + 1]]);
+			ip = code[ip + 2];
+		}
+		VM_DISPATCH();
+	}
+	VM_CASE(CALLEE)
+	{
+		if(stack.back()->isLambda())
+			ip += 2;
+		else
+		{
+			stack.back() = current->constants[code[ip]];
+			ip = code[ip + 1];
+		}
+		VM_DISPATCH();
+	}
+	VM_CASE(EVAL)
+	{
+		stack.push_back(current->constants[code[ip++]]->eval(env));
+		if(stack.back() == nullptr)
+			return nullptr;
+		VM_DISPATCH();
+	}
+
+#define VM_ARITHMETIC(op, expression, check) \
+	VM_CASE(op) \
+	{ \
+		Number* right = arithmeticOperand(stack.back()); \
+		Number* left = arithmeticOperand(stack[stack.size() - 2]); \
+		if(left == nullptr || right == nullptr) \
+			return nullptr; \
+		check \
+		{ \
+			std::shared_ptr<Sexp> result = expression; \
+			stack.pop_back(); \
+			stack.back() = std::move(result); \
+		} \
+		VM_DISPATCH(); \
+	}
+
+	VM_ARITHMETIC(ADD, CommonInteger::add(*left, *right), )
+	VM_ARITHMETIC(SUB, CommonInteger::subtract(*left, *right), )
+	VM_ARITHMETIC(MUL, CommonInteger::multiply(*left, *right), )
+	VM_ARITHMETIC(DIV, CommonInteger::divide(*left, *right), if(right->isFixnum() && right->getFixnum() == 0) { loge << "division by zero.\n"; return nullptr; })
+	VM_ARITHMETIC(LESS, Symbol::boolean(CommonInteger::compare(*left, *right) < 0), )
+	VM_ARITHMETIC(GREATER, Symbol::boolean(CommonInteger::compare(*left, *right) > 0), )
+	VM_ARITHMETIC(EQUAL, Symbol::boolean(CommonInteger::compare(*left, *right) == 0), )
+
+#ifndef SCHEME_COMPUTED_GOTO
+			default:
+				loge << "invalid opcode " << code[ip - 1] << "\n";
+				return nullptr;
+#endif
+		}
+	}
+#undef VM_ARITHMETIC
+#undef VM_CASE
+#undef VM_DISPATCH
+#undef VM_RETURN
+}
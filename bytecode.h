@@ -0,0 +1,131 @@
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "scheme.h"
+
+
+#pragma once
+
+
+/**	Bytecode execution engine
+ * 	Top level forms are compiled by BytecodeCompiler into CodeObjects, and run by VirtualMachine.
+ * 	The Sexp classes stay the front-end representation: the compiler works on what SchemeInterpreter::read returns,
+ * 	and the VM uses the same values, Environments (as frames of compiled lambdas) and primitive functions as the tree walking evaluator.
+ * 	The engine can be switched at runtime in the REPL by entering enginebytecode or enginetree,
+ * 	dumpbytecode toggles printing the compiled code of each top level form */
+namespace Bytecode
+{
+	/**	every instruction is an opcode followed by its operands, all stored as 32 bit words */
+	enum OpCode : int32_t
+	{
+		CONST,			// index: push constants[index]
+		LOCAL_REF,		// depth slot: push the argument from the frame depth levels up
+		GLOBAL_REF,		// index: push the value of the global variable in globals[index]
+		DEFINE,			// index: bind the top of the stack to the global variable in globals[index], leaving it on the stack
+		CLOSURE,		// index: push a closure of lambdas[index] over the current frame
+		CALL,			// argc: call the function below the argc arguments on the stack
+		TAIL_CALL,		// argc: call reusing the current frame
+		RETURN,			// return the top of the stack to the caller
+		JUMP,			// target
+		JUMP_IF_FALSE,	// target: pop, and jump if it is #f
+		POP,
+		EVAL,			// index: evaluate constants[index] with the tree walking evaluator (forms the compiler doesn't know)
+		ADD,			// the open coded arithmetic primitives pop two numbers and push the result
+		SUB,
+		MUL,
+		DIV,
+		LESS,
+		GREATER,
+		EQUAL,
+		GUARD,			// global constant target: jump to target if globals[global] is not bound to constants[constant] (see InlinedCall)
+		GLOBAL_CALLEE,	// global constant target: push the value of globals[global] if it is a function, otherwise push constants[constant] and jump to target
+		CALLEE,			// constant target: if the top of the stack is not a function, replace it with constants[constant] and jump to target
+		OPCODE_COUNT
+	};
+	
+	const char* opcodeName(int32_t op);
+	
+	/**	number of operand words following the opcode */
+	int operandCount(int32_t op);
+};
+
+
+/**	compiled code of a lambda body, or of a top level form (that is a lambda without arguments) */
+class CodeObject
+{
+public:
+	std::vector<int32_t> code;
+	std::vector<std::shared_ptr<Sexp>> constants;
+	/**	the cells of the global variables the code refers to, resolved when it is compiled, so running it doesn't look names up */
+	std::vector<std::shared_ptr<GlobalCell>> globals;
+	/**	code of the lambda expressions in this one, CLOSURE refers to them by index */
+	std::vector<std::shared_ptr<const CodeObject>> lambdas;
+	
+	std::shared_ptr<List> arglist;
+	std::shared_ptr<const std::vector<int>> args;
+	/**	the source expression (the whole lambda expression for lambdas) and its body as written, compiled lambdas print them */
+	std::shared_ptr<Sexp> source;
+	std::shared_ptr<Sexp> body;
+	
+	void emit(int32_t op);
+	void emit(int32_t op, int32_t operand);
+	void emit(int32_t op, int32_t operand1, int32_t operand2);
+	void emit(int32_t op, int32_t operand1, int32_t operand2, int32_t operand3);
+	int32_t addConstant(std::shared_ptr<Sexp> constant);
+	/**	the index of cell in globals, it is added if it is not there yet */
+	int32_t addGlobal(std::shared_ptr<GlobalCell> cell);
+	
+	/**	prints the code in readable form, together with the code of nested lambdas */
+	void dump(std::ostream& os, int indent = 0) const;
+};
+
+/**	compiles expressions into CodeObjects
+ * 	define, lambda and if are compiled to bytecode, and so are calls of + - * / < > = when their names refer to the global primitives.
+ * 	A list whose head is not a function evaluates to itself, like in the tree walking evaluator: the head of a call is checked
+ * 	before the arguments are evaluated (GLOBAL_CALLEE, CALLEE), and lists with a constant head are compiled to the list itself
+ * 	The arithmetic primitives are open coded (like in most scheme compilers) so redefining them only affects code compiled later
+ * 	calls inlined by the Optimizer are compiled to a GUARD, the expansion, and the original call */
+class BytecodeCompiler
+{
+	Environment* global;
+	/**	argument names of the enclosing lambdas, innermost first - the index is the frame depth */
+	std::vector<const std::vector<int>*> scopes;
+	
+	bool isLocal(int id) const;
+	/**	the global binding of the head of a form, if it is not shadowed by a local variable */
+	std::shared_ptr<Sexp> globalForm(std::shared_ptr<Sexp> head) const;
+	
+	/**	tail is true if the value of exp is returned from the function being compiled */
+	void compile(std::shared_ptr<Sexp> exp, CodeObject& code, bool tail);
+	void compileList(std::shared_ptr<List> list, CodeObject& code, bool tail);
+	std::shared_ptr<CodeObject> compileLambda(std::shared_ptr<List> arglist, std::shared_ptr<Sexp> body, std::shared_ptr<Sexp> source);
+public:
+	BytecodeCompiler(std::shared_ptr<Environment> global);
+	
+	/**	the code returns the value of exp when run in the global environment */
+	std::shared_ptr<CodeObject> compileTopLevel(std::shared_ptr<Sexp> exp);
+};
+
+/**	closure of a compiled lambda, calling it runs its code on the VM */
+class CompiledLambda : public Lambda
+{
+	std::shared_ptr<const CodeObject> code;
+public:
+	CompiledLambda(std::shared_ptr<Environment> env, std::shared_ptr<const CodeObject> code);
+	
+	/**	the VM runs the body in the frame, so there is nothing left for the tree walker's tail call loop */
+	virtual std::shared_ptr<Sexp> evalFrame(std::shared_ptr<Environment> frame, TailCall& tail) const;
+	
+	std::shared_ptr<const CodeObject> getCode() const;
+};
+
+/**	stack based virtual machine running compiled code */
+class VirtualMachine
+{
+public:
+	/**	runs code in the frame env (the global environment for top level forms)
+	 * 	function is the closure code belongs to, for the Profiler, nullptr for top level forms
+	 * 	returns nullptr if there was an error */
+	static std::shared_ptr<Sexp> run(std::shared_ptr<const CodeObject> code, std::shared_ptr<Environment> env, const Lambda* function = nullptr);
+};
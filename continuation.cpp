@@ -0,0 +1,121 @@
+#include "continuation.h"
+#include "future.h"
+
+
+namespace
+{
+	/**	the escape on its way on the thread: the continuation called, and the value it was called with */
+	struct Escape
+	{
+		const Continuation* target;
+		std::shared_ptr<Sexp> value;
+	};
+
+	thread_local Escape escape{nullptr, nullptr};
+}
+
+
+//Continuation
+
+Continuation::Continuation(std::shared_ptr<Environment> env, bool callcc) : Lambda{env}, active{true}, callcc{callcc}, thread{std::this_thread::get_id()}, futureDepth{Future::depth()} {}
+
+std::shared_ptr<Sexp> Continuation::eval(std::shared_ptr<Environment>, std::shared_ptr<List> params) const
+{
+	int argc = params->size();
+	if(argc != 1)
+	{
+		loge << "wrong number of arguments for " << *this << ". (Expected: 1, got: " << argc << ")\n";
+		return nullptr;
+	}
+	if(Future::depth() != futureDepth || thread != std::this_thread::get_id())
+	{
+		loge << *this << " can't be called from a future\n";
+		return nullptr;
+	}
+	if(!active)
+	{
+		if(callcc)
+			loge << *this << " was used already, or its call/cc returned: continuations are one-shot escapes\n";
+		else
+			loge << *this << " was used already, or its call/ec returned\n";
+		return nullptr;
+	}
+	active = false;
+	escape.target = this;
+	escape.value = params->Car();
+	return nullptr;
+}
+
+void Continuation::print(std::ostream &os) const
+{
+	os << "#<continuation>";
+}
+
+void Continuation::close() const
+{
+	active = false;
+}
+
+bool Continuation::escaping()
+{
+	return escape.target != nullptr;
+}
+
+bool Continuation::take(const Continuation* k, std::shared_ptr<Sexp>& value)
+{
+	if(escape.target != k)
+		return false;
+	value = std::move(escape.value);
+	escape.target = nullptr;
+	return true;
+}
+
+void Continuation::clear()
+{
+	escape.target = nullptr;
+	escape.value = nullptr;
+}
+
+
+//ContinuationFunction
+// (call/ec f), (call/cc f)
+
+ContinuationFunction::ContinuationFunction(std::shared_ptr<Environment> env, bool callcc) : Lambda{env}, callcc{callcc} {}
+
+std::shared_ptr<Sexp> ContinuationFunction::eval(std::shared_ptr<Environment>, std::shared_ptr<List> params) const
+{
+	int argc = params->size();
+	if(argc != 1)
+	{
+		loge << "wrong number of arguments for " << *this << ". (Expected: 1, got: " << argc << ")\n";
+		return nullptr;
+	}
+	std::shared_ptr<Sexp> function = params->Car();
+	if(!function->isLambda() || function->getKind() == Kind::SPECIAL_FORM)
+	{
+		loge << *this << " expects a function, got: " << *function << "\n";
+		return nullptr;
+	}
+
+	std::shared_ptr<Continuation> k = Heap::make<Continuation>(env, callcc);
+	std::shared_ptr<Sexp> result = static_cast<Lambda*>(function.get())->eval(nullptr, Heap::make<List>(k));
+	k->close();
+	if(result == nullptr)
+		Continuation::take(k.get(), result);
+	return result;
+}
+
+void ContinuationFunction::print(std::ostream &os) const
+{
+	os << (callcc ? "call/cc" : "call/ec");
+}
+
+void ContinuationFunction::defineAll(std::shared_ptr<Environment> global)
+{
+	std::shared_ptr<ContinuationFunction> callec = Heap::make<ContinuationFunction>(global, false);
+	std::shared_ptr<ContinuationFunction> callcc = Heap::make<ContinuationFunction>(global, true);
+	global->bindArg("call/ec", callec);
+	global->bindArg("call-with-escape-continuation", callec);
+	global->bindArg("call/cc", callcc);
+	global->bindArg("call-with-current-continuation", callcc);
+}
@@ -0,0 +1,61 @@
+#include <memory>
+#include <thread>
+
+#include "scheme.h"
+
+
+
+
+#pragma once
+
+
+/**	Escape continuations: (call/ec f) calls f with a continuation k, and (k v) makes the call/ec return v right away
+ * 	an escape travels the way errors do, without C++ exceptions: k records itself and v as the pending escape of the thread and returns nullptr,
+ * 	the evaluators return nullptr up to the call/ec that made k, which takes v
+ * 	the VM keeps its calls in vectors, and the tree walking evaluator runs tail calls in the TailCall loop, so leaving a tail recursive loop,
+ * 	or code compiled to bytecode, takes a few C++ returns however deep the Scheme recursion is - only non tail calls of the tree walker add one each
+ * 	k can only be called while the call/ec is running (escape only), outside of the futures started since, and it is used up by the call (one-shot)
+ * 	call/cc makes the same continuations: there are no reentrant continuations, a call/cc continuation can only escape, once */
+class Continuation : public Lambda
+{
+	/**	the call/ec is running, and k was not called yet */
+	mutable bool active;
+	/**	made by call/cc, for the messages */
+	bool callcc;
+	/**	where the call/ec runs: the futures started since run inline (deeper) or on other threads, k can't escape from them */
+	std::thread::id thread;
+	int futureDepth;
+
+public:
+	Continuation(std::shared_ptr<Environment> env, bool callcc);
+
+	/**	(k v) escapes with v, returns nullptr */
+	virtual std::shared_ptr<Sexp> eval(std::shared_ptr<Environment> context, std::shared_ptr<List> params) const;
+	void print(std::ostream &os) const;
+
+	/**	the continuation can't be called anymore, its call/ec returned */
+	void close() const;
+
+	/**	if an escape is on its way on the calling thread: a nullptr result is not an error then */
+	static bool escaping();
+	/**	if the escape on its way is to k: value is set to its value, and the escape is over */
+	static bool take(const Continuation* k, std::shared_ptr<Sexp>& value);
+	/**	drops the escape on its way, if any (its call/ec is not on the stack anymore) */
+	static void clear();
+};
+
+
+/**	(call/ec f), (call-with-escape-continuation f), (call/cc f), (call-with-current-continuation f)
+ * 	calls f with a Continuation, returns the value f returns, or the value the continuation was called with */
+class ContinuationFunction : public Lambda
+{
+	bool callcc;
+public:
+	ContinuationFunction(std::shared_ptr<Environment> env, bool callcc);
+
+	virtual std::shared_ptr<Sexp> eval(std::shared_ptr<Environment> context, std::shared_ptr<List> params) const;
+	void print(std::ostream &os) const;
+
+	/**	binds call/ec, call/cc and their long names in global */
+	static void defineAll(std::shared_ptr<Environment> global);
+};
@@ -0,0 +1,413 @@
+#include <chrono>
+#include <functional>
+#include <random>
+
+#include "future.h"
+#include "typedvector.h"
+
+
+namespace
+{
+	/**	number of futures the calling thread is evaluating (touch runs them inside others) */
+	thread_local int runningFutures = 0;
+
+	/**	set by FutureGroup::Scope */
+	thread_local FutureGroup* activeGroup = nullptr;
+
+	/**	the index of the worker thread of the pool, or -1 on the other threads */
+	thread_local int workerIndex = -1;
+
+	/**	picks the deques to steal from */
+	std::minstd_rand& stealRandom()
+	{
+		thread_local std::minstd_rand random{static_cast<std::minstd_rand::result_type>(std::hash<std::thread::id>()(std::this_thread::get_id()))};
+		return random;
+	}
+}
+
+
+//Future
+
+Future::Future(FutureGroup* group, std::shared_ptr<Sexp> exp, std::shared_ptr<Environment> context)
+	: Atom{Kind::FUTURE}, exp{exp}, context{context}, state{PENDING}, group{group}, logSettings{&LogSettings::current()} {}
+
+Future::Future(FutureGroup* group, std::shared_ptr<Lambda> function, std::shared_ptr<List> args)
+	: Atom{Kind::FUTURE}, function{function}, args{args}, state{PENDING}, group{group}, logSettings{&LogSettings::current()} {}
+
+bool Future::run()
+{
+	int expected = PENDING;
+	if(!state.compare_exchange_strong(expected, RUNNING))
+		return false;
+	{
+		//the objects of the future can be freed on any thread, so no heap tracks them
+		Heap::Untracked untracked;
+		LogSettings::Scope logScope{*logSettings};
+		FutureGroup::Scope groupScope{group};
+		runningFutures++;
+		std::shared_ptr<Sexp> result = function != nullptr ? function->eval(context, args) : TailCall::run(exp, context);
+		runningFutures--;
+		exp = nullptr;
+		context = nullptr;
+		function = nullptr;
+		args = nullptr;
+		value = std::move(result);
+	}
+	{
+		std::lock_guard<std::mutex> lock{mutex};
+		state = DONE;
+	}
+	done.notify_all();
+	return true;
+}
+
+std::shared_ptr<Sexp> Future::touch()
+{
+	run();
+	while(state != DONE)
+	{
+		//helping the pool instead of blocking its thread, the future may be waiting for the others
+		if(!FuturePool::instance().runOne())
+		{
+			std::unique_lock<std::mutex> lock{mutex};
+			done.wait_for(lock, std::chrono::milliseconds(1), [this] {return state == DONE;});
+		}
+	}
+	return value;
+}
+
+bool Future::isDone() const
+{
+	return state == DONE;
+}
+
+FutureGroup* Future::getGroup() const
+{
+	return group;
+}
+
+bool Future::running()
+{
+	return runningFutures > 0;
+}
+
+int Future::depth()
+{
+	return runningFutures;
+}
+
+std::shared_ptr<Sexp> Future::eval(std::shared_ptr<Environment> context) const
+{
+	return std::const_pointer_cast<Sexp>(shared_from_this());
+}
+
+void Future::print(std::ostream &os) const
+{
+	if(state == DONE && value != nullptr)
+		os << "#<future " << *value << ">";
+	else
+		os << "#<future>";
+}
+
+std::shared_ptr<void> Future::sharedFromThis()
+{
+	return shared_from_this();
+}
+
+//collections don't run while futures of the heap are queued or running, so the references don't change during them
+void Future::traverse(References& references) const
+{
+	addReference(references, exp);
+	if(context != nullptr)
+		references.push_back(context.get());
+	addReference(references, function);
+	if(args != nullptr)
+		references.push_back(args.get());
+	addReference(references, value);
+}
+
+void Future::clearReferences()
+{
+	exp = nullptr;
+	context = nullptr;
+	function = nullptr;
+	args = nullptr;
+	value = nullptr;
+}
+
+size_t Future::gcSize() const
+{
+	return sizeof(*this);
+}
+
+
+//FutureGroup
+
+FutureGroup::FutureGroup(Heap& heap) : heap{heap}, running{0} {}
+
+void FutureGroup::started()
+{
+	std::lock_guard<std::mutex> lock{mutex};
+	running++;
+	heap.pause();
+}
+
+void FutureGroup::finished()
+{
+	std::lock_guard<std::mutex> lock{mutex};
+	heap.resume();
+	if(--running == 0)
+		idle.notify_all();
+}
+
+void FutureGroup::wait()
+{
+	std::unique_lock<std::mutex> lock{mutex};
+	while(running > 0)
+	{
+		//the futures of the group may be behind others in the deques, so the pool is helped like in touch
+		lock.unlock();
+		bool ran = FuturePool::instance().runOne();
+		lock.lock();
+		if(!ran)
+			idle.wait_for(lock, std::chrono::milliseconds(1), [this] {return running == 0;});
+	}
+}
+
+FutureGroup* FutureGroup::current()
+{
+	return activeGroup;
+}
+
+FutureGroup::Scope::Scope(FutureGroup* group) : previous{activeGroup}
+{
+	activeGroup = group;
+}
+
+FutureGroup::Scope::~Scope()
+{
+	activeGroup = previous;
+}
+
+
+//FuturePool
+
+FuturePool::FuturePool(size_t size) : queued{0}, next{0}, stopping{false}
+{
+	for(size_t i = 0; i < size; i++)
+		workers.emplace_back(new Worker());
+	for(size_t i = 0; i < size; i++)
+		threads.emplace_back(&FuturePool::work, this, i);
+}
+
+FuturePool& FuturePool::instance()
+{
+	static FuturePool pool{std::max(1u, std::thread::hardware_concurrency())};
+	return pool;
+}
+
+std::shared_ptr<Future> FuturePool::take(size_t index)
+{
+	if(queued == 0)
+		return nullptr;
+	std::shared_ptr<Future> future;
+	if(index < workers.size())
+	{
+		Worker& own = *workers[index];
+		std::lock_guard<std::mutex> lock{own.mutex};
+		if(!own.futures.empty())
+		{
+			future = std::move(own.futures.back());
+			own.futures.pop_back();
+		}
+	}
+	size_t start = stealRandom()() % workers.size();
+	for(size_t i = 0; i < workers.size() && future == nullptr; i++)
+	{
+		Worker& victim = *workers[(start + i) % workers.size()];
+		std::lock_guard<std::mutex> lock{victim.mutex};
+		if(!victim.futures.empty())
+		{
+			future = std::move(victim.futures.front());
+			victim.futures.pop_front();
+		}
+	}
+	if(future != nullptr)
+		queued--;
+	return future;
+}
+
+void FuturePool::work(size_t index)
+{
+	workerIndex = index;
+	while(true)
+	{
+		if(runOne())
+			continue;
+		std::unique_lock<std::mutex> lock{mutex};
+		available.wait(lock, [this] {return stopping || queued > 0;});
+		if(stopping)
+			return;
+	}
+}
+
+void FuturePool::submit(std::shared_ptr<Future> future)
+{
+	//the heap of the future's interpreter is paused from now until the worker that takes it lets go of it
+	future->getGroup()->started();
+	size_t index = workerIndex >= 0 ? workerIndex : next++ % workers.size();
+	{
+		std::lock_guard<std::mutex> lock{workers[index]->mutex};
+		workers[index]->futures.push_back(std::move(future));
+	}
+	queued++;
+	std::lock_guard<std::mutex> lock{mutex};
+	available.notify_one();
+}
+
+bool FuturePool::runOne()
+{
+	std::shared_ptr<Future> future = take(workerIndex >= 0 ? workerIndex : workers.size());
+	if(future == nullptr)
+		return false;
+	//it was run by a touch already if it's not pending
+	FutureGroup* group = future->getGroup();
+	future->run();
+	future = nullptr;
+	group->finished();
+	return true;
+}
+
+size_t FuturePool::size() const
+{
+	return workers.size();
+}
+
+FuturePool::~FuturePool()
+{
+	{
+		std::lock_guard<std::mutex> lock{mutex};
+		stopping = true;
+	}
+	available.notify_all();
+	for(std::thread& thread : threads)
+		thread.join();
+}
+
+
+//FutureFunction
+
+FutureFunction::FutureFunction(std::shared_ptr<Environment> env, Operation operation) : Lambda{env}, operation{operation} {}
+
+std::shared_ptr<Sexp> FutureFunction::eval(std::shared_ptr<Environment> context, std::shared_ptr<List> params) const
+{
+	int argc = params->size();
+	int expected = operation == Operation::PARALLEL_MAP ? 2 : operation == Operation::TOUCH ? 1 : 0;
+	if(argc != expected)
+	{
+		loge << "wrong number of arguments for " << *this << ". (Expected: " << expected << ", got: " << argc << ")\n";
+		return nullptr;
+	}
+
+	switch(operation)
+	{
+	case Operation::TOUCH:
+		if(params->Car()->getKind() != Kind::FUTURE)
+			return params->Car();
+		return static_cast<Future*>(params->Car().get())->touch();
+	case Operation::PARALLEL_MAP:
+		{
+			std::shared_ptr<Sexp> function = params->Car();
+			Sexp* sequence = params->Cdr()->Car().get();
+			if(!function->isLambda() || function->getKind() == Kind::SPECIAL_FORM)
+			{
+				loge << *function << " is not a function\n";
+				return nullptr;
+			}
+			std::vector<std::shared_ptr<Sexp>> elements;
+			if(sequence->getKind() == Kind::LIST)
+			{
+				for(const List* l = static_cast<List*>(sequence); l != nullptr && l->Car() != nullptr; l = l->Cdr().get())
+					elements.push_back(l->Car());
+			}
+			else if(sequence->getKind() == Kind::TYPED_VECTOR)
+			{
+				const TypedVector* vector = static_cast<TypedVector*>(sequence);
+				for(size_t i = 0; i < vector->size(); i++)
+					elements.push_back(Number::make(vector->get(i)));
+			}
+			else
+			{
+				loge << *sequence << " is not a list or a vector\n";
+				return nullptr;
+			}
+			std::vector<std::shared_ptr<Future>> futures;
+			for(const auto& element : elements)
+			{
+				futures.push_back(Heap::make<Future>(FutureGroup::current(), std::static_pointer_cast<Lambda>(function), Heap::make<List>(element)));
+				FuturePool::instance().submit(futures.back());
+			}
+			//every future is waited for, so none of them is still running (and logging) when the map fails
+			std::vector<std::shared_ptr<Sexp>> results;
+			bool failed = false;
+			for(const auto& future : futures)
+			{
+				results.push_back(future->touch());
+				failed = failed || results.back() == nullptr;
+			}
+			if(failed)
+				return nullptr;
+			return Heap::make<List>(results);
+		}
+	case Operation::WORKERS:
+		return Number::make(static_cast<int64_t>(FuturePool::instance().size()));
+	}
+	return nullptr;
+}
+
+void FutureFunction::print(std::ostream &os) const
+{
+	switch(operation)
+	{
+	case Operation::TOUCH:
+		os << "touch";
+		break;
+	case Operation::PARALLEL_MAP:
+		os << "parallel-map";
+		break;
+	case Operation::WORKERS:
+		os << "future-workers";
+		break;
+	}
+}
+
+void FutureFunction::defineAll(std::shared_ptr<Environment> global)
+{
+	global->bindArg("future", Heap::make<FutureSyntax>(global));
+	global->bindArg("touch", Heap::make<FutureFunction>(global, Operation::TOUCH));
+	global->bindArg("parallel-map", Heap::make<FutureFunction>(global, Operation::PARALLEL_MAP));
+	global->bindArg("future-workers", Heap::make<FutureFunction>(global, Operation::WORKERS));
+}
+
+
+//FutureSyntax
+// (future exp)
+
+FutureSyntax::FutureSyntax(std::shared_ptr<Environment> env) : SyntaxLambda{env} {}
+
+std::shared_ptr<Sexp> FutureSyntax::eval(std::shared_ptr<Environment> context, std::shared_ptr<List> params) const
+{
+	if(params->size() != 1)
+	{
+		loge << "wrong number of arguments for future. (Expected: 1, got: " << params->size() << ")\n";
+		return nullptr;
+	}
+	std::shared_ptr<Future> future = Heap::make<Future>(FutureGroup::current(), params->Car(), context);
+	FuturePool::instance().submit(future);
+	return future;
+}
+
+void FutureSyntax::print(std::ostream &os) const
+{
+	os << "future";
+}
@@ -0,0 +1,191 @@
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "scheme.h"
+
+
+
+
+#pragma once
+
+
+/**	Futures: (future exp) evaluates exp on a worker thread of the FuturePool while the interpreter goes on, (touch f) waits for its value
+ * 	(parallel-map f list) calls f on the elements of list, or of a typed vector like (s64vector 1 2 3), in futures
+ * 	the futures should be pure: they share the global environment and the closures with the interpreter, so
+ * 	- define and load are refused in them
+ * 	- a global variable must not be redefined while futures using it are running, the interpreter doesn't wait for them
+ * 	- their objects are not tracked by a heap (see heap.h), cycles made in a future are not collected */
+
+class FutureGroup;
+
+/**	the value of (future exp), or of an element of parallel-map */
+class Future : public Atom, public Collectable
+{
+public:
+	enum State : int {PENDING, RUNNING, DONE};
+
+private:
+	/**	exp is evaluated in context, or function is called with args */
+	std::shared_ptr<Sexp> exp;
+	std::shared_ptr<Environment> context;
+	std::shared_ptr<Lambda> function;
+	std::shared_ptr<List> args;
+	/**	nullptr if the evaluation failed */
+	std::shared_ptr<Sexp> value;
+
+	std::atomic<int> state;
+	FutureGroup* group;
+	/**	the log settings of the interpreter that made the future */
+	const LogSettings* logSettings;
+
+	std::mutex mutex;
+	std::condition_variable done;
+
+public:
+	Future(FutureGroup* group, std::shared_ptr<Sexp> exp, std::shared_ptr<Environment> context);
+	Future(FutureGroup* group, std::shared_ptr<Lambda> function, std::shared_ptr<List> args);
+
+	/**	evaluates the future on the calling thread, false if it was started already */
+	bool run();
+
+	/**	the value of the future (nullptr if its evaluation failed), it is run on the calling thread if it hasn't started yet,
+	 * 	the other futures in the pool are run while it is waited for */
+	std::shared_ptr<Sexp> touch();
+
+	bool isDone() const;
+	FutureGroup* getGroup() const;
+
+	/**	if the calling thread is evaluating a future */
+	static bool running();
+	/**	the number of futures the calling thread is evaluating, a touch can run one inside another */
+	static int depth();
+
+	/**	futures evaluate to themselves */
+	std::shared_ptr<Sexp> eval(std::shared_ptr<Environment> context) const;
+	/**	#<future> or #<future value> */
+	void print(std::ostream &os) const;
+
+	std::shared_ptr<void> sharedFromThis();
+	void traverse(References& references) const;
+	void clearReferences();
+	size_t gcSize() const;
+};
+
+
+/**	the futures of an interpreter that are not done yet
+ * 	the heap of the interpreter is paused while there are any, and the interpreter waits for them before it is destroyed */
+class FutureGroup
+{
+	Heap& heap;
+	std::mutex mutex;
+	std::condition_variable idle;
+	size_t running;
+
+public:
+	FutureGroup(Heap& heap);
+
+	void started();
+	void finished();
+	/**	waits until every future of the group is done, running the futures of the pool meanwhile */
+	void wait();
+
+	/**	the group of the interpreter, or of the future, running on the calling thread */
+	static FutureGroup* current();
+
+	/**	makes group the current one of the calling thread while the Scope exists */
+	class Scope
+	{
+		FutureGroup* previous;
+	public:
+		Scope(FutureGroup* group);
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+		~Scope();
+	};
+};
+
+
+/**	the worker threads of the process, one per core, shared by the interpreters
+ * 	every worker has a deque of futures: it takes the newest future of its own deque, and steals the oldest one of a random other deque when it is empty
+ * 	a future made on a worker goes to its deque, the others are spread over the deques */
+class FuturePool
+{
+	struct Worker
+	{
+		std::mutex mutex;
+		std::deque<std::shared_ptr<Future>> futures;
+	};
+
+	std::vector<std::unique_ptr<Worker>> workers;
+	std::vector<std::thread> threads;
+	/**	futures in the deques, including the ones already run by a touch */
+	std::atomic<size_t> queued;
+	/**	the deque the next future made outside of the workers goes to */
+	std::atomic<size_t> next;
+
+	/**	the idle workers wait on available */
+	std::mutex mutex;
+	std::condition_variable available;
+	bool stopping;
+
+	FuturePool(size_t size);
+	void work(size_t index);
+	/**	a future from the deque of the worker index (the newest one), or stolen from the others (their oldest one), nullptr if there are none */
+	std::shared_ptr<Future> take(size_t index);
+
+public:
+	/**	the pool, its threads are started when it is first used */
+	static FuturePool& instance();
+
+	void submit(std::shared_ptr<Future> future);
+
+	/**	runs a waiting future on the calling thread, false if there was none */
+	bool runOne();
+
+	size_t size() const;
+
+	~FuturePool();
+};
+
+
+/**	the future primitives, one class for them like MemoFunction */
+class FutureFunction : public Lambda
+{
+public:
+	enum class Operation : unsigned char
+	{
+		/**	(touch f) the value of the future f, values that are not futures are returned as they are */
+		TOUCH,
+		/**	(parallel-map f list) the list of the results of f on the elements of list (or of a typed vector), computed in futures */
+		PARALLEL_MAP,
+		/**	(future-workers) the number of worker threads */
+		WORKERS
+	};
+
+private:
+	Operation operation;
+
+public:
+	FutureFunction(std::shared_ptr<Environment> env, Operation operation);
+
+	virtual std::shared_ptr<Sexp> eval(std::shared_ptr<Environment> context, std::shared_ptr<List> params) const;
+	void print(std::ostream &os) const;
+
+	/**	binds future, touch, parallel-map and future-workers in global */
+	static void defineAll(std::shared_ptr<Environment> global);
+};
+
+
+/**	(future exp) - exp is evaluated in a future */
+class FutureSyntax : public SyntaxLambda
+{
+public:
+	FutureSyntax(std::shared_ptr<Environment> env);
+
+	virtual std::shared_ptr<Sexp> eval(std::shared_ptr<Environment> context, std::shared_ptr<List> params) const;
+	void print(std::ostream &os) const;
+};
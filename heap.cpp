@@ -0,0 +1,454 @@
+#include <chrono>
+#include <mutex>
+#include <new>
+
+#include "heap.h"
+
+
+//Collectable
+
+Collectable::Collectable() : gcHeap{Heap::tracking()}, gcRefs{0}, gcGeneration{0}, gcReachable{false}, gcCollecting{false}, gcOwned{false}, gcRoot{false}
+{
+	if(gcHeap == nullptr)
+		return;
+	gcHeap->link(this, Heap::NURSERY);
+	gcHeap->allocatedSinceCollection++;
+}
+
+Collectable::Collectable(const Collectable&) : Collectable{} {}
+
+Collectable::~Collectable()
+{
+	if(gcHeap != nullptr)
+		gcHeap->unlink(this);
+}
+
+
+//SizeClassPool
+
+SizeClassPool::SizeClassPool(size_t blockSize) : blockSize{blockSize}, freeList{nullptr} {}
+
+void SizeClassPool::grow()
+{
+	char* chunk = static_cast<char*>(::operator new(Heap::CHUNK_SIZE));
+	chunks.push_back(chunk);
+	for(size_t offset = 0; offset + blockSize <= Heap::CHUNK_SIZE; offset += blockSize)
+		deallocate(chunk + offset);
+}
+
+void* SizeClassPool::allocate()
+{
+	if(freeList == nullptr)
+		grow();
+	void* p = freeList;
+	freeList = *static_cast<void**>(p);
+	return p;
+}
+
+void SizeClassPool::deallocate(void* p)
+{
+	*static_cast<void**>(p) = freeList;
+	freeList = p;
+}
+
+
+//Heap
+
+namespace
+{
+	/**	the heap set by the innermost Heap::Scope of the thread */
+	thread_local Heap* active = nullptr;
+	/**	set by Heap::Untracked */
+	thread_local bool untracked = false;
+
+	using Pools = std::vector<SizeClassPool>;
+
+	/**	pools by size class of the thread, never destroyed, as objects can be freed during static destruction, or after the thread exits */
+	thread_local Pools* pools = nullptr;
+
+	/**	the pools of the exited threads, the next new threads take them over, so threads coming and going don't leak their pools */
+	struct OrphanPools
+	{
+		std::mutex mutex;
+		std::vector<Pools*> pools;
+	};
+
+	OrphanPools& orphanPools()
+	{
+		static OrphanPools* orphans = new OrphanPools();
+		return *orphans;
+	}
+
+	/**	hands the pools of the thread over to orphanPools when it exits */
+	struct PoolsRelease
+	{
+		~PoolsRelease()
+		{
+			OrphanPools& orphans = orphanPools();
+			std::lock_guard<std::mutex> lock{orphans.mutex};
+			orphans.pools.push_back(pools);
+			pools = nullptr;
+		}
+	};
+
+	Pools* threadPools()
+	{
+		thread_local PoolsRelease release;
+		(void)release;
+		OrphanPools& orphans = orphanPools();
+		std::lock_guard<std::mutex> lock{orphans.mutex};
+		if(!orphans.pools.empty())
+		{
+			Pools* p = orphans.pools.back();
+			orphans.pools.pop_back();
+			return p;
+		}
+		Pools* p = new Pools();
+		for(size_t s = Heap::SIZE_CLASS_STEP; s <= Heap::MAX_POOLED_SIZE; s += Heap::SIZE_CLASS_STEP)
+			p->emplace_back(s);
+		return p;
+	}
+
+	SizeClassPool& pool(size_t size)
+	{
+		if(pools == nullptr)
+			pools = threadPools();
+		return (*pools)[(size - 1) / Heap::SIZE_CLASS_STEP];
+	}
+}
+
+//the lists are circular, and empty at the start
+Heap::Heap() : generationCounts{0, 0, 0}, allocatedSinceCollection{0}, stats{}, historyNext{0}, pauses{0}
+{
+	for(GcNode& list : generations)
+		list = {&list, &list};
+}
+
+Heap::~Heap()
+{
+	for(GcNode& list : generations)
+	{
+		for(GcNode* node = list.gcNext; node != &list; node = node->gcNext)
+			static_cast<Collectable*>(node)->gcHeap = nullptr;
+	}
+	if(active == this)
+		active = nullptr;
+}
+
+Heap::Scope::Scope(Heap& heap) : previous{active}
+{
+	active = &heap;
+}
+
+Heap::Scope::~Scope()
+{
+	active = previous;
+}
+
+Heap::Untracked::Untracked() : previous{untracked}
+{
+	untracked = true;
+}
+
+Heap::Untracked::~Untracked()
+{
+	untracked = previous;
+}
+
+Heap* Heap::tracking()
+{
+	return untracked ? nullptr : &current();
+}
+
+Heap& Heap::current()
+{
+	if(active == nullptr)
+	{
+		//objects made outside of interpreters, it lives as long as the thread
+		thread_local Heap threadHeap;
+		active = &threadHeap;
+	}
+	return *active;
+}
+
+void* Heap::allocate(size_t size, AllocationKind kind)
+{
+	HeapStats& stats = current().stats;
+	stats.allocations++;
+	stats.allocatedBytes += size;
+	stats.liveObjects[static_cast<size_t>(kind)]++;
+	stats.liveBytes[static_cast<size_t>(kind)] += size;
+	stats.totalLiveBytes += size;
+	if(stats.totalLiveBytes > stats.peakLiveBytes)
+		stats.peakLiveBytes = stats.totalLiveBytes;
+	if(size == 0 || size > MAX_POOLED_SIZE)
+		return ::operator new(size);
+	return pool(size).allocate();
+}
+
+void Heap::deallocate(void* p, size_t size, AllocationKind kind)
+{
+	//not current(), objects can be freed while the thread's own heap is destroyed
+	if(active != nullptr)
+	{
+		HeapStats& stats = active->stats;
+		stats.liveObjects[static_cast<size_t>(kind)]--;
+		stats.liveBytes[static_cast<size_t>(kind)] -= size;
+		stats.totalLiveBytes -= size;
+	}
+	if(size == 0 || size > MAX_POOLED_SIZE)
+	{
+		::operator delete(p);
+		return;
+	}
+	pool(size).deallocate(p);
+}
+
+void Heap::link(Collectable* c, unsigned char generation)
+{
+	std::unique_lock<std::mutex> lock{mutex, std::defer_lock};
+	if(pauses > 0)
+		lock.lock();
+	GcNode& list = generations[generation];
+	c->gcNext = &list;
+	c->gcPrev = list.gcPrev;
+	list.gcPrev->gcNext = c;
+	list.gcPrev = c;
+	c->gcGeneration = generation;
+	generationCounts[generation]++;
+}
+
+void Heap::unlink(Collectable* c)
+{
+	std::unique_lock<std::mutex> lock{mutex, std::defer_lock};
+	if(pauses > 0)
+		lock.lock();
+	c->gcPrev->gcNext = c->gcNext;
+	c->gcNext->gcPrev = c->gcPrev;
+	generationCounts[c->gcGeneration]--;
+}
+
+void Heap::relink(Collectable* c, unsigned char generation)
+{
+	unlink(c);
+	link(c, generation);
+}
+
+void Heap::adopt(Collectable* c)
+{
+	c->gcOwned = true;
+}
+
+void Heap::adopt(const void*) {}
+
+void Heap::markRoot(Collectable* c)
+{
+	c->gcRoot = true;
+}
+
+void Heap::collect(bool full, size_t oldObjects)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	CollectionStats collection = {full, 0, 0, 0, 0, 0};
+
+	std::vector<Collectable*> objects;
+	auto add = [&objects](Collectable* c)
+	{
+		c->gcCollecting = true;
+		objects.push_back(c);
+	};
+
+	//objects without an owning shared_ptr yet are under construction, they are left out like the objects of other generations
+	for(GcNode* node = generations[NURSERY].gcNext; node != &generations[NURSERY]; node = node->gcNext)
+		if(static_cast<Collectable*>(node)->gcOwned)
+			add(static_cast<Collectable*>(node));
+	if(full)
+	{
+		for(unsigned char generation : {OLD_PENDING, OLD_VISITED})
+			for(GcNode* node = generations[generation].gcNext; node != &generations[generation]; node = node->gcNext)
+				add(static_cast<Collectable*>(node));
+	}
+	else
+	{
+		//the slice of the old generation, roots are always reachable, and would bring everything into the increment
+		size_t slice = objects.size();
+		GcNode* node = generations[OLD_PENDING].gcNext;
+		while(node != &generations[OLD_PENDING] && objects.size() - slice < oldObjects)
+		{
+			Collectable* c = static_cast<Collectable*>(node);
+			node = node->gcNext;
+			if(c->gcRoot)
+				relink(c, OLD_VISITED);
+			else if(!c->gcCollecting)
+				add(c);
+		}
+
+		//with the old objects reachable from the slice, so the cycles the slice is part of are collected whole
+		//cycles through the nursery are collected once their objects are promoted, the nursery doesn't need the closure
+		References references;
+		for(size_t i = slice; i < objects.size(); i++)
+		{
+			references.clear();
+			objects[i]->traverse(references);
+			for(Collectable* r : references)
+				if(!r->gcCollecting && !r->gcRoot && r->gcOwned && r->gcHeap == this)
+					add(r);
+		}
+	}
+	collection.examinedObjects = objects.size();
+
+	//shared_ptr counts, without the temporary shared_ptr that reads them
+	for(Collectable* c : objects)
+	{
+		c->gcRefs = c->sharedFromThis().use_count() - 1;
+		c->gcReachable = false;
+	}
+
+	//subtract the references coming from collected objects
+	References references;
+	for(Collectable* c : objects)
+	{
+		references.clear();
+		c->traverse(references);
+		for(Collectable* r : references)
+			if(r->gcCollecting)
+				r->gcRefs--;
+	}
+
+	//what is still referenced is referenced from outside the collected objects, and everything it references is reachable too
+	std::vector<Collectable*> reachable;
+	for(Collectable* c : objects)
+	{
+		if(c->gcRefs > 0)
+		{
+			c->gcReachable = true;
+			reachable.push_back(c);
+		}
+	}
+	while(!reachable.empty())
+	{
+		Collectable* c = reachable.back();
+		reachable.pop_back();
+		references.clear();
+		c->traverse(references);
+		for(Collectable* r : references)
+		{
+			if(r->gcCollecting && !r->gcReachable)
+			{
+				r->gcReachable = true;
+				reachable.push_back(r);
+			}
+		}
+	}
+
+	//survivors are promoted, the collected part of the old generation is visited
+	//the garbage is kept alive until all of it is cleared, then reference counting frees it
+	unsigned char survivors = full ? OLD_PENDING : OLD_VISITED;
+	std::vector<std::shared_ptr<void>> garbage;
+	size_t count = 0;
+	for(Collectable* c : objects)
+	{
+		c->gcCollecting = false;
+		if(c->gcReachable)
+		{
+			if(c->gcGeneration == NURSERY)
+				collection.promotedBytes += c->gcSize();
+			relink(c, survivors);
+		}
+		else
+		{
+			collection.reclaimedBytes += c->gcSize();
+			garbage.push_back(c->sharedFromThis());
+			objects[count++] = c;
+		}
+	}
+	objects.resize(count);
+	collection.reclaimedObjects = count;
+	for(Collectable* c : objects)
+		c->clearReferences();
+	objects.clear();
+	garbage.clear();
+
+	//a marking cycle ends when every old object was visited, the next one visits them again
+	if(full || generationCounts[OLD_PENDING] == 0)
+	{
+		GcNode& visited = generations[OLD_VISITED];
+		while(visited.gcNext != &visited)
+			relink(static_cast<Collectable*>(visited.gcNext), OLD_PENDING);
+		stats.markingCycles++;
+	}
+	allocatedSinceCollection = 0;
+
+	collection.pauseMicroseconds = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+	stats.collections++;
+	if(full)
+		stats.fullCollections++;
+	stats.totalPauseMicroseconds += collection.pauseMicroseconds;
+	if(collection.pauseMicroseconds > stats.maxPauseMicroseconds)
+		stats.maxPauseMicroseconds = collection.pauseMicroseconds;
+	stats.promotedBytes += collection.promotedBytes;
+	stats.reclaimedObjects += collection.reclaimedObjects;
+	stats.reclaimedBytes += collection.reclaimedBytes;
+	stats.last = collection;
+	if(history.size() < HISTORY_SIZE)
+		history.push_back(collection);
+	else
+		history[historyNext] = collection;
+	historyNext = (historyNext + 1) % HISTORY_SIZE;
+}
+
+void Heap::pause()
+{
+	pauses++;
+}
+
+void Heap::resume()
+{
+	pauses--;
+}
+
+void Heap::collect()
+{
+	Heap* heap = tracking();
+	if(heap != nullptr && heap->pauses == 0)
+		heap->collect(true, 0);
+}
+
+void Heap::collectIfNeeded()
+{
+	Heap* heap = tracking();
+	if(heap != nullptr && heap->allocatedSinceCollection >= NURSERY_THRESHOLD && heap->pauses == 0)
+		heap->collect(false, OLD_INCREMENT);
+}
+
+size_t Heap::getTrackedCount()
+{
+	const Heap& heap = current();
+	return heap.generationCounts[NURSERY] + heap.generationCounts[OLD_PENDING] + heap.generationCounts[OLD_VISITED];
+}
+
+size_t Heap::getNurseryCount()
+{
+	return current().generationCounts[NURSERY];
+}
+
+size_t Heap::getOldCount()
+{
+	const Heap& heap = current();
+	return heap.generationCounts[OLD_PENDING] + heap.generationCounts[OLD_VISITED];
+}
+
+const HeapStats& Heap::getStats()
+{
+	return current().stats;
+}
+
+std::vector<CollectionStats> Heap::getRecentCollections()
+{
+	const Heap& heap = current();
+	if(heap.history.size() < HISTORY_SIZE)
+		return heap.history;
+	std::vector<CollectionStats> recent(heap.history.begin() + heap.historyNext, heap.history.end());
+	recent.insert(recent.end(), heap.history.begin(), heap.history.begin() + heap.historyNext);
+	return recent;
+}
@@ -0,0 +1,304 @@
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+
+
+#pragma once
+
+
+/**	Memory management:
+ * 	Objects are owned by shared_ptrs, and most of them are freed by reference counting.
+ * 	Reference counting can't free cycles (a closure stored in the environment it captured, the global environment and the functions in it)
+ * 	so the objects that can be part of a cycle (Collectable: List, Lambda, Environment) are tracked, and the Heap's collector finds and frees
+ * 	the unreachable ones with trial deletion: the references between the collected objects are subtracted from their shared_ptr counts,
+ * 	what has references left is referenced from outside (the interpreter's global environment, evaluator stacks, objects not being collected),
+ * 	and so is everything reachable from those. The rest is garbage: its references are cleared, and reference counting frees it.
+ *
+ * 	The collector is generational and incremental: new objects are in the nursery, survivors are promoted to the old generation.
+ * 	Every collection collects the nursery, and an increment of the old generation: the next slice of the old objects not visited
+ * 	in the current marking cycle, together with the old objects reachable from the slice, so cycles are always collected whole.
+ * 	The objects outside the collection are counted as outside references, so old to young references need no write barrier:
+ * 	they are already included in the shared_ptr counts.
+ *
+ * 	Objects are allocated together with their control block from size class pools (Heap::make)
+ *
+ * 	Every interpreter has its own Heap, which it makes the current heap of the thread it runs on (Heap::Scope) - new objects are tracked
+ * 	by the current heap, and collections only look at the objects of the current heap. A heap and its objects are used by one thread at a time,
+ * 	so nothing is locked; the pools are per thread, blocks freed on another thread go to that thread's pools.
+ * 	Futures (see future.h) run on worker threads while the interpreter goes on: the objects they make are not tracked by any heap (Heap::Untracked),
+ * 	and the interpreter's heap is paused while they run, as they read its objects. */
+
+
+/**	links of the lists of tracked objects */
+struct GcNode
+{
+	GcNode* gcPrev;
+	GcNode* gcNext;
+};
+
+class Collectable;
+class Heap;
+
+/**	the references a Collectable holds to other Collectables */
+using References = std::vector<Collectable*>;
+
+/**	base of the objects that can be part of reference cycles, they are tracked by the collector from construction to destruction */
+class Collectable : public GcNode
+{
+	friend class Heap;
+	/**	the heap tracking the object, nullptr once that heap is destroyed */
+	Heap* gcHeap;
+	/**	shared_ptr count minus the references from other collected objects during a collection */
+	long gcRefs;
+	unsigned char gcGeneration;
+	bool gcReachable;
+	bool gcCollecting;
+	/**	set by Heap::make once a shared_ptr owns the object, objects without one are left out of collections */
+	bool gcOwned;
+	/**	referenced from outside the heap (Heap::markRoot) */
+	bool gcRoot;
+protected:
+	Collectable();
+	Collectable(const Collectable&);
+public:
+	virtual ~Collectable();
+
+	/**	a shared_ptr owning the object - the collector counts references with it, and keeps garbage alive with it while clearing it */
+	virtual std::shared_ptr<void> sharedFromThis() = 0;
+
+	/**	adds the Collectables this object holds shared_ptrs to */
+	virtual void traverse(References& references) const = 0;
+
+	/**	drops the references of the object, called on garbage to break its cycles */
+	virtual void clearReferences() = 0;
+
+	/**	approximate number of bytes the object uses, for the collection statistics */
+	virtual size_t gcSize() const = 0;
+};
+
+
+/**	free list allocator of equally sized blocks, carved from large chunks */
+class SizeClassPool
+{
+	size_t blockSize;
+	void* freeList;
+	std::vector<void*> chunks;
+
+	void grow();
+public:
+	SizeClassPool(size_t blockSize);
+	void* allocate();
+	void deallocate(void* p);
+};
+
+
+/**	the kinds of objects the heap counts the live objects and bytes of (HeapStats::liveObjects)
+ * 	a class picks its kind with a static constexpr ALLOCATION_KIND member (inherited by the derived classes), the others are OTHER */
+enum class AllocationKind : unsigned char {NUMBER, LIST, LAMBDA, ENVIRONMENT, OTHER};
+
+enum : size_t {ALLOCATION_KINDS = 5};
+
+/**	the AllocationKind of T */
+template <typename T>
+struct AllocationKindOf
+{
+	template <typename U>
+	static constexpr AllocationKind pick(decltype(U::ALLOCATION_KIND)*) {return U::ALLOCATION_KIND;}
+	template <typename U>
+	static constexpr AllocationKind pick(...) {return AllocationKind::OTHER;}
+
+	static constexpr AllocationKind value = pick<T>(nullptr);
+};
+
+
+/**	telemetry of one collection */
+struct CollectionStats
+{
+	/**	full collections collect the whole old generation, not only an increment */
+	bool full;
+	double pauseMicroseconds;
+	size_t examinedObjects;
+	/**	bytes of the nursery objects that survived, and were moved to the old generation */
+	size_t promotedBytes;
+	size_t reclaimedObjects;
+	size_t reclaimedBytes;
+};
+
+/**	cumulated telemetry of the collector */
+struct HeapStats
+{
+	size_t collections;
+	size_t fullCollections;
+	/**	completed passes of the incremental marking over the whole old generation */
+	size_t markingCycles;
+	double totalPauseMicroseconds;
+	double maxPauseMicroseconds;
+	size_t promotedBytes;
+	size_t reclaimedObjects;
+	size_t reclaimedBytes;
+	/**	blocks allocated for objects (Heap::allocate) while the heap was the current one, and their bytes */
+	size_t allocations;
+	size_t allocatedBytes;
+	/**	objects and bytes by AllocationKind allocated from the heap and not freed yet
+	 * 	blocks are counted as freed by the heap current where they are freed, so the objects of an interpreter freed on the worker threads of futures
+	 * 	are subtracted from the heaps of those threads, and those freed outside of interpreters and Heap::Scopes are not subtracted */
+	int64_t liveObjects[ALLOCATION_KINDS];
+	int64_t liveBytes[ALLOCATION_KINDS];
+	/**	the sum of liveBytes, and its highest value */
+	int64_t totalLiveBytes;
+	int64_t peakLiveBytes;
+	CollectionStats last;
+};
+
+/**	the heap: size class pools and the cycle collector
+ * 	the static functions work on the current heap of the calling thread */
+class Heap
+{
+	friend class Collectable;
+
+	/**	the nursery, and the two halves of the old generation: objects the current marking cycle hasn't visited yet and those it has */
+	enum : unsigned char {NURSERY = 0, OLD_PENDING = 1, OLD_VISITED = 2, GENERATIONS = 3};
+	GcNode generations[GENERATIONS];
+	size_t generationCounts[GENERATIONS];
+	size_t allocatedSinceCollection;
+
+	HeapStats stats;
+	std::vector<CollectionStats> history;
+	size_t historyNext;
+
+	/**	collections are skipped while it is not 0, and the lists are locked, as other threads can free objects of the heap meanwhile */
+	std::atomic<size_t> pauses;
+	std::mutex mutex;
+
+	void link(Collectable* c, unsigned char generation);
+	void unlink(Collectable* c);
+	void relink(Collectable* c, unsigned char generation);
+	static void adopt(Collectable* c);
+	static void adopt(const void*);
+
+	/**	the heap new objects are tracked by, nullptr in an Untracked scope */
+	static Heap* tracking();
+
+	/**	collects the nursery and oldObjects objects of the pending old generation (all of the old generation if full) */
+	void collect(bool full, size_t oldObjects);
+public:
+	/**	granularity and limit of the size classes, larger objects are allocated with operator new */
+	enum : size_t {SIZE_CLASS_STEP = 16, MAX_POOLED_SIZE = 512, CHUNK_SIZE = 64 * 1024};
+
+	/**	allocations after which a collection is run, and the size of the old generation increments */
+	enum : size_t {NURSERY_THRESHOLD = 10000, OLD_INCREMENT = 20000, HISTORY_SIZE = 64};
+
+	Heap();
+	Heap(const Heap&) = delete;
+	Heap& operator=(const Heap&) = delete;
+	/**	the objects still alive are no longer tracked, reference counting still frees them, but their cycles are not collected */
+	~Heap();
+
+	/**	makes a heap the current heap of the calling thread while the Scope exists, the previous one is restored after it */
+	class Scope
+	{
+		Heap* previous;
+	public:
+		Scope(Heap& heap);
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+		~Scope();
+	};
+
+	/**	objects made on the calling thread while the Untracked exists are not tracked: reference counting frees them, but not their cycles */
+	class Untracked
+	{
+		bool previous;
+	public:
+		Untracked();
+		Untracked(const Untracked&) = delete;
+		Untracked& operator=(const Untracked&) = delete;
+		~Untracked();
+	};
+
+	/**	the heap of the interpreter running on the calling thread, or the thread's own heap outside of interpreters */
+	static Heap& current();
+
+	/**	stops collections of the heap until the matching resume, other threads can call them, while objects of the heap are in use there */
+	void pause();
+	void resume();
+
+	static void* allocate(size_t size, AllocationKind kind = AllocationKind::OTHER);
+	static void deallocate(void* p, size_t size, AllocationKind kind = AllocationKind::OTHER);
+
+	/**	like make_shared, but the object and the control block come from the pools */
+	template <typename T, typename... Args>
+	static std::shared_ptr<T> make(Args&&... args);
+
+	/**	marks an object referenced from outside the heap for as long as it's in use (an interpreter's global environment)
+	 * 	incremental collections don't look for cycles through it, full collections still do */
+	static void markRoot(Collectable* c);
+
+	/**	frees all unreachable cycles */
+	static void collect();
+
+	/**	runs a collection of the nursery and an old generation increment if enough objects were allocated since the last one
+	 * 	call it only where all tracked objects in use are held by shared_ptrs (not at places where the only reference is a raw pointer) */
+	static void collectIfNeeded();
+
+	static size_t getTrackedCount();
+	static size_t getNurseryCount();
+	static size_t getOldCount();
+
+	static const HeapStats& getStats();
+	/**	the last HISTORY_SIZE collections, oldest first */
+	static std::vector<CollectionStats> getRecentCollections();
+};
+
+
+/**	allocator for allocate_shared, serving requests from the size class pools of the Heap
+ * 	the blocks are counted as Kind objects, the kind is kept when allocate_shared rebinds it to its control block */
+template <typename T, AllocationKind Kind = AllocationKind::OTHER>
+struct PoolAllocator
+{
+	using value_type = T;
+
+	template <typename U>
+	struct rebind
+	{
+		using other = PoolAllocator<U, Kind>;
+	};
+
+	PoolAllocator() {}
+	template <typename U>
+	PoolAllocator(const PoolAllocator<U, Kind>&) {}
+
+	T* allocate(size_t n)
+	{
+		return static_cast<T*>(Heap::allocate(n * sizeof(T), Kind));
+	}
+	void deallocate(T* p, size_t n)
+	{
+		Heap::deallocate(p, n * sizeof(T), Kind);
+	}
+};
+
+template <typename T, typename U, AllocationKind Kind>
+bool operator==(const PoolAllocator<T, Kind>&, const PoolAllocator<U, Kind>&)
+{
+	return true;
+}
+
+template <typename T, typename U, AllocationKind Kind>
+bool operator!=(const PoolAllocator<T, Kind>&, const PoolAllocator<U, Kind>&)
+{
+	return false;
+}
+
+
+template <typename T, typename... Args>
+std::shared_ptr<T> Heap::make(Args&&... args)
+{
+	std::shared_ptr<T> p = std::allocate_shared<T>(PoolAllocator<T, AllocationKindOf<T>::value>{}, std::forward<Args>(args)...);
+	adopt(p.get());
+	return p;
+}
@@ -0,0 +1,905 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <unordered_set>
+
+#include "image.h"
+#include "bytecode.h"
+#include "typedvector.h"
+#include "memo.h"
+#include "optimizer.h"
+
+
+//the file is a header, the names of the symbols, the objects and the global bindings
+//objects only refer to objects written before them, so they are created in one pass when loading
+//integers are stored in the byte order of the machine, images are not meant to be moved between architectures
+
+namespace
+{
+	const char MAGIC[8] = {'S', 'C', 'M', 'I', 'M', 'A', 'G', 'E'};
+	const uint32_t VERSION = 4;
+
+	enum class Tag : uint8_t {FIXNUM, BIGNUM, SYMBOL, STRING, TYPED_VECTOR, LOCAL_VARIABLE, LIST, LAMBDA_EXPRESSION, CLOSURE, COMPILED_CLOSURE, BUILTIN, FRAME, CODE, MEMOIZED, GLOBAL_VARIABLE, OPTIMIZED_BODY};
+
+	/**	references to objects: nullptr, the global environment, or the index of an object plus FIRST_OBJECT */
+	enum : uint32_t {NULL_REFERENCE = 0, GLOBAL_REFERENCE = 1, FIRST_OBJECT = 2};
+
+	//Writer
+
+	class ImageWriter
+	{
+		const Environment& global;
+		std::unordered_map<const Sexp*, int> builtinNames;
+
+		std::unordered_map<int, uint32_t> symbolIndex;
+		std::vector<int> symbols;
+
+		/**	the object records */
+		std::string objects;
+		uint32_t objectCount;
+		std::unordered_map<const void*, uint32_t> written;
+		/**	objects whose record is being written, meeting one of them again means a cycle */
+		std::unordered_set<const void*> inProgress;
+
+		bool failed;
+
+		void put8(std::string& out, uint8_t value)
+		{
+			out.push_back((char)value);
+		}
+
+		void put32(std::string& out, uint32_t value)
+		{
+			out.append((const char*)&value, sizeof(value));
+		}
+
+		void put64(std::string& out, uint64_t value)
+		{
+			out.append((const char*)&value, sizeof(value));
+		}
+
+		void putString(std::string& out, const std::string& value)
+		{
+			put32(out, value.size());
+			out.append(value);
+		}
+
+		uint32_t symbol(int id)
+		{
+			auto it = symbolIndex.find(id);
+			if(it != symbolIndex.end())
+				return it->second;
+			symbols.push_back(id);
+			return symbolIndex[id] = symbols.size() - 1;
+		}
+
+		/**	starts the record of object, the caller writes its fields to objects, and calls finish */
+		void begin(Tag tag)
+		{
+			put8(objects, (uint8_t)tag);
+		}
+
+		uint32_t finish(const void* object)
+		{
+			inProgress.erase(object);
+			uint32_t reference = FIRST_OBJECT + objectCount++;
+			written[object] = reference;
+			return reference;
+		}
+
+		/**	true if object was written already (reference is set then), false if its record has to be written
+		 * 	fails on cycles */
+		bool visit(const void* object, uint32_t& reference)
+		{
+			auto it = written.find(object);
+			if(it != written.end())
+			{
+				reference = it->second;
+				return true;
+			}
+			if(!inProgress.insert(object).second)
+			{
+				if(!failed)
+					loge << "the image can't hold a cycle that doesn't go through the global environment\n";
+				failed = true;
+				reference = NULL_REFERENCE;
+				return true;
+			}
+			return false;
+		}
+
+		uint32_t writeList(const List* list)
+		{
+			//the spine is walked in a loop, only nesting recurses
+			std::vector<const List*> spine;
+			uint32_t reference = NULL_REFERENCE;
+			for(const List* l = list; l != nullptr && !visit(l, reference); l = l->Cdr().get())
+				spine.push_back(l);
+			//reference is the written tail of the list (or nullptr)
+			for(size_t i = spine.size(); i-- > 0; )
+			{
+				uint32_t car = write(spine[i]->Car().get());
+				begin(Tag::LIST);
+				put32(objects, car);
+				put32(objects, reference);
+				reference = finish(spine[i]);
+			}
+			return reference;
+		}
+
+		uint32_t writeEnvironment(const Environment* env)
+		{
+			if(env == nullptr)
+				return NULL_REFERENCE;
+			if(env == &global)
+				return GLOBAL_REFERENCE;
+			uint32_t reference;
+			if(visit(env, reference))
+				return reference;
+			uint32_t parent = writeEnvironment(env->getParent());
+			std::vector<uint32_t> slots;
+			for(size_t i = 0; i < env->getSlotCount(); i++)
+				slots.push_back(write(env->getSlot(0, i).get()));
+			begin(Tag::FRAME);
+			put32(objects, parent);
+			put32(objects, slots.size());
+			for(size_t i = 0; i < slots.size(); i++)
+			{
+				put32(objects, symbol((*env->getNames())[i]));
+				put32(objects, slots[i]);
+			}
+			return finish(env);
+		}
+
+		uint32_t writeCode(const CodeObject* code)
+		{
+			uint32_t reference;
+			if(visit(code, reference))
+				return reference;
+			std::vector<uint32_t> constants, lambdas;
+			for(const auto& constant : code->constants)
+				constants.push_back(write(constant.get()));
+			for(const auto& lambda : code->lambdas)
+				lambdas.push_back(writeCode(lambda.get()));
+			uint32_t arglist = write(code->arglist.get());
+			uint32_t source = write(code->source.get());
+			uint32_t body = write(code->body.get());
+
+			begin(Tag::CODE);
+			put32(objects, arglist);
+			put32(objects, source);
+			put32(objects, body);
+			put32(objects, constants.size());
+			for(uint32_t constant : constants)
+				put32(objects, constant);
+			put32(objects, lambdas.size());
+			for(uint32_t lambda : lambdas)
+				put32(objects, lambda);
+			//the cells are shared with the global environment, they are stored as the symbols of the variables
+			put32(objects, code->globals.size());
+			for(const auto& cell : code->globals)
+				put32(objects, symbol(cell->id));
+			put32(objects, code->code.size());
+			for(size_t ip = 0; ip < code->code.size(); )
+			{
+				int32_t op = code->code[ip];
+				int operands = Bytecode::operandCount(op);
+				put32(objects, op);
+				for(int i = 1; i <= operands; i++)
+					put32(objects, code->code[ip + i]);
+				ip += 1 + operands;
+			}
+			return finish(code);
+		}
+
+	public:
+		ImageWriter(const Environment& global, const HeapImage::Builtins& builtins) : global{global}, objectCount{0}, failed{false}
+		{
+			for(const auto& binding : builtins)
+			{
+				if(binding.second->isLambda())
+					builtinNames[binding.second.get()] = binding.first;
+			}
+		}
+
+		uint32_t write(const Sexp* s)
+		{
+			if(s == nullptr)
+				return NULL_REFERENCE;
+			if(s->getKind() == Kind::LIST)
+				return writeList(static_cast<const List*>(s));
+			uint32_t reference;
+			if(visit(s, reference))
+				return reference;
+			switch(s->getKind())
+			{
+			case Kind::NUMBER:
+				{
+					const Number* number = static_cast<const Number*>(s);
+					if(number->isFixnum())
+					{
+						begin(Tag::FIXNUM);
+						put64(objects, number->getFixnum());
+					}
+					else
+					{
+						begin(Tag::BIGNUM);
+						putString(objects, number->toBigInt().toString());
+					}
+				}
+				break;
+			case Kind::SYMBOL:
+				begin(Tag::SYMBOL);
+				put32(objects, symbol(static_cast<const Symbol*>(s)->getId()));
+				break;
+			case Kind::STRING:
+				begin(Tag::STRING);
+				putString(objects, static_cast<const String*>(s)->getValue());
+				break;
+			case Kind::TYPED_VECTOR:
+				{
+					const TypedVector* v = static_cast<const TypedVector*>(s);
+					begin(Tag::TYPED_VECTOR);
+					put8(objects, (uint8_t)v->getType());
+					put64(objects, v->size());
+					if(v->getType() == TypedVector::Type::S32)
+						objects.append((const char*)v->getS32().data(), v->size() * sizeof(int32_t));
+					else
+						objects.append((const char*)v->getS64().data(), v->size() * sizeof(int64_t));
+				}
+				break;
+			case Kind::LOCAL_VARIABLE:
+				{
+					const LocalVariable* variable = static_cast<const LocalVariable*>(s);
+					begin(Tag::LOCAL_VARIABLE);
+					put32(objects, symbol(variable->getId()));
+					put32(objects, variable->getDepth());
+					put32(objects, variable->getSlot());
+				}
+				break;
+			case Kind::GLOBAL_VARIABLE:
+				begin(Tag::GLOBAL_VARIABLE);
+				put32(objects, symbol(static_cast<const GlobalVariable*>(s)->getId()));
+				break;
+			case Kind::LAMBDA_EXPRESSION:
+				{
+					const LambdaExpression* expression = static_cast<const LambdaExpression*>(s);
+					uint32_t arglist = write(expression->getArglist().get());
+					uint32_t body = write(expression->getBody().get());
+					uint32_t source = write(expression->getSource().get());
+					begin(Tag::LAMBDA_EXPRESSION);
+					put32(objects, arglist);
+					put32(objects, body);
+					put32(objects, source);
+				}
+				break;
+			case Kind::CLOSURE:
+				{
+					const Lambda* lambda = static_cast<const Lambda*>(s);
+					uint32_t env = writeEnvironment(lambda->getEnv().get());
+					uint32_t arglist = write(lambda->getArglist().get());
+					uint32_t body = write(lambda->getBody().get());
+					uint32_t source = write(lambda->getSource().get());
+					begin(Tag::CLOSURE);
+					put32(objects, env);
+					put32(objects, arglist);
+					put32(objects, body);
+					put32(objects, source);
+				}
+				break;
+			case Kind::OPTIMIZED_BODY:
+				{
+					const OptimizedBody* body = static_cast<const OptimizedBody*>(s);
+					uint32_t optimized = write(body->getOptimized().get());
+					uint32_t source = write(body->getSource().get());
+					begin(Tag::OPTIMIZED_BODY);
+					put32(objects, optimized);
+					put32(objects, source);
+				}
+				break;
+			case Kind::COMPILED_CLOSURE:
+				{
+					const CompiledLambda* lambda = static_cast<const CompiledLambda*>(s);
+					uint32_t env = writeEnvironment(lambda->getEnv().get());
+					uint32_t code = writeCode(lambda->getCode().get());
+					begin(Tag::COMPILED_CLOSURE);
+					put32(objects, env);
+					put32(objects, code);
+				}
+				break;
+			default:
+				if(const MemoizedFunction* memoized = dynamic_cast<const MemoizedFunction*>(s))
+				{
+					//the results are not saved, only the function
+					uint32_t function = write(memoized->getFunction().get());
+					begin(Tag::MEMOIZED);
+					put32(objects, function);
+					put64(objects, memoized->getCapacity());
+				}
+				else
+				{
+					//primitives and special forms
+					auto it = builtinNames.find(s);
+					if(it == builtinNames.end())
+					{
+						loge << *s << " can't be saved to an image\n";
+						failed = true;
+						inProgress.erase(s);
+						return NULL_REFERENCE;
+					}
+					begin(Tag::BUILTIN);
+					put32(objects, symbol(it->second));
+				}
+				break;
+			}
+			return finish(s);
+		}
+
+		/**	the whole image, with the bindings of global */
+		bool image(std::string& out)
+		{
+			std::vector<std::pair<uint32_t, uint32_t>> bindings;
+			for(const auto& binding : global.getVariables())
+				bindings.emplace_back(symbol(binding.first), write(binding.second.get()));
+			if(failed)
+				return false;
+
+			out.append(MAGIC, sizeof(MAGIC));
+			put32(out, VERSION);
+			put32(out, symbols.size());
+			for(int id : symbols)
+				putString(out, SymbolTable::name(id));
+			put32(out, objectCount);
+			out.append(objects);
+			put32(out, bindings.size());
+			for(const auto& binding : bindings)
+			{
+				put32(out, binding.first);
+				put32(out, binding.second);
+			}
+			return true;
+		}
+	};
+
+
+	//Reader
+
+	class ImageReader
+	{
+		const std::string& data;
+		size_t pos;
+		std::shared_ptr<Environment> global;
+		const HeapImage::Builtins& builtins;
+
+		std::vector<int> symbols;
+
+		/**	an object of the image is an expression, a frame or compiled code */
+		struct Object
+		{
+			std::shared_ptr<Sexp> sexp;
+			std::shared_ptr<Environment> env;
+			std::shared_ptr<const CodeObject> code;
+		};
+		std::vector<Object> objects;
+		/**	the number of objects in the image, local variables can't be nested deeper */
+		uint32_t objectCount;
+
+		/**	the local variables an expression or code refers to: the number of slots it needs in the frame at each depth
+		 * 	(relative to the frames it is evaluated in, or for code, to the frame of its calls)
+		 * 	only objects that refer to some are in the map, closures check theirs against their environment */
+		typedef std::vector<uint32_t> Locals;
+		std::unordered_map<const void*, Locals> locals;
+
+		bool failed;
+
+		bool fail()
+		{
+			failed = true;
+			return false;
+		}
+
+		bool get(void* out, size_t size)
+		{
+			if(failed || data.size() - pos < size)
+				return fail();
+			std::memcpy(out, data.data() + pos, size);
+			pos += size;
+			return true;
+		}
+
+		uint8_t get8()
+		{
+			uint8_t value = 0;
+			get(&value, sizeof(value));
+			return value;
+		}
+
+		uint32_t get32()
+		{
+			uint32_t value = 0;
+			get(&value, sizeof(value));
+			return value;
+		}
+
+		uint64_t get64()
+		{
+			uint64_t value = 0;
+			get(&value, sizeof(value));
+			return value;
+		}
+
+		std::string getString()
+		{
+			uint32_t size = get32();
+			if(failed || data.size() - pos < size)
+			{
+				fail();
+				return "";
+			}
+			std::string value = data.substr(pos, size);
+			pos += size;
+			return value;
+		}
+
+		int getSymbol()
+		{
+			uint32_t index = get32();
+			if(index >= symbols.size())
+			{
+				fail();
+				return 0;
+			}
+			return symbols[index];
+		}
+
+		/**	the object a reference read from the image refers to, it has to be an expression (or nullptr if nullable) */
+		std::shared_ptr<Sexp> getSexp(bool nullable = true)
+		{
+			uint32_t reference = get32();
+			if(reference == NULL_REFERENCE && nullable)
+				return nullptr;
+			if(reference < FIRST_OBJECT || reference - FIRST_OBJECT >= objects.size() || objects[reference - FIRST_OBJECT].sexp == nullptr)
+			{
+				fail();
+				return nullptr;
+			}
+			return objects[reference - FIRST_OBJECT].sexp;
+		}
+
+		/**	an argument list: a list of symbols */
+		std::shared_ptr<List> getArglist()
+		{
+			std::shared_ptr<Sexp> s = getSexp(false);
+			if(s == nullptr || s->getKind() != Kind::LIST)
+			{
+				fail();
+				return nullptr;
+			}
+			std::shared_ptr<List> arglist = std::static_pointer_cast<List>(s);
+			for(auto arg : *arglist)
+			{
+				if(arg->getKind() != Kind::SYMBOL)
+					fail();
+			}
+			return arglist;
+		}
+
+		std::shared_ptr<Environment> getEnvironment()
+		{
+			uint32_t reference = get32();
+			if(reference == GLOBAL_REFERENCE)
+				return global;
+			if(reference == NULL_REFERENCE)
+				return nullptr;
+			if(reference - FIRST_OBJECT >= objects.size() || objects[reference - FIRST_OBJECT].env == nullptr)
+			{
+				fail();
+				return nullptr;
+			}
+			return objects[reference - FIRST_OBJECT].env;
+		}
+
+		std::shared_ptr<const CodeObject> getCode()
+		{
+			uint32_t reference = get32();
+			if(reference < FIRST_OBJECT || reference - FIRST_OBJECT >= objects.size() || objects[reference - FIRST_OBJECT].code == nullptr)
+			{
+				fail();
+				return nullptr;
+			}
+			return objects[reference - FIRST_OBJECT].code;
+		}
+
+		const Locals& localsOf(const void* object)
+		{
+			static const Locals none;
+			auto it = locals.find(object);
+			return it == locals.end() ? none : it->second;
+		}
+
+		/**	adds the needs of an object to the needs of the one that contains it, from depth skip of the object */
+		void merge(Locals& into, const Locals& from, size_t skip = 0)
+		{
+			if(from.size() > skip && into.size() < from.size() - skip)
+				into.resize(from.size() - skip);
+			for(size_t depth = skip; depth < from.size(); depth++)
+				into[depth - skip] = std::max(into[depth - skip], from[depth]);
+		}
+
+		/**	adds a reference to slot at depth */
+		bool addLocal(Locals& into, int depth, int slot)
+		{
+			if(depth < 0 || slot < 0 || (uint32_t)depth >= objectCount)
+				return fail();
+			if(into.size() <= (size_t)depth)
+				into.resize(depth + 1);
+			into[depth] = std::max(into[depth], (uint32_t)slot + 1);
+			return true;
+		}
+
+		/**	the needs of a body, without its own frame of slotCount slots, false if it refers past them */
+		bool bind(Locals& body, size_t slotCount)
+		{
+			if(body.empty())
+				return true;
+			if(body[0] > slotCount)
+				return fail();
+			body.erase(body.begin());
+			return true;
+		}
+
+		/**	false if env (the frames around a closure) doesn't have the slots needed */
+		bool fits(const Locals& needs, const Environment* env)
+		{
+			for(uint32_t slots : needs)
+			{
+				//local variables never refer to the global environment
+				if(env == nullptr || env == global.get() || slots > env->getSlotCount())
+					return fail();
+				env = env->getParent();
+			}
+			return true;
+		}
+
+		/**	the operands that index the constants, the lambdas or the code have to be in range */
+		bool checkOperands(const CodeObject& code)
+		{
+			for(size_t ip = 0; ip < code.code.size(); ip += 1 + Bytecode::operandCount(code.code[ip]))
+			{
+				if(ip + Bytecode::operandCount(code.code[ip]) >= code.code.size())
+					return false;
+				uint32_t operand = Bytecode::operandCount(code.code[ip]) > 0 ? code.code[ip + 1] : 0;
+				switch(code.code[ip])
+				{
+				case Bytecode::CONST:
+				case Bytecode::EVAL:
+					if(operand >= code.constants.size() || code.constants[operand] == nullptr)
+						return false;
+					break;
+				case Bytecode::CLOSURE:
+					if(operand >= code.lambdas.size())
+						return false;
+					break;
+				case Bytecode::JUMP:
+				case Bytecode::JUMP_IF_FALSE:
+					if(operand >= code.code.size())
+						return false;
+					break;
+				case Bytecode::GLOBAL_REF:
+				case Bytecode::DEFINE:
+					if(operand >= code.globals.size())
+						return false;
+					break;
+				case Bytecode::GUARD:
+				case Bytecode::GLOBAL_CALLEE:
+					if(operand >= code.globals.size() || (uint32_t)code.code[ip + 2] >= code.constants.size() || (uint32_t)code.code[ip + 3] >= code.code.size())
+						return false;
+					break;
+				case Bytecode::CALLEE:
+					if(operand >= code.constants.size() || (uint32_t)code.code[ip + 2] >= code.code.size())
+						return false;
+					break;
+				default:
+					break;
+				}
+			}
+			return true;
+		}
+
+		std::shared_ptr<CodeObject> readCode()
+		{
+			std::shared_ptr<CodeObject> code = std::make_shared<CodeObject>();
+			code->arglist = getArglist();
+			code->source = getSexp();
+			code->body = getSexp();
+			uint32_t count = get32();
+			for(uint32_t i = 0; i < count && !failed; i++)
+				code->constants.push_back(getSexp());
+			count = get32();
+			for(uint32_t i = 0; i < count && !failed; i++)
+				code->lambdas.push_back(getCode());
+			count = get32();
+			for(uint32_t i = 0; i < count && !failed; i++)
+				code->globals.push_back(global->getCell(getSymbol()));
+			count = get32();
+			for(uint32_t ip = 0; ip < count && !failed; )
+			{
+				int32_t op = get32();
+				if(op < 0 || op >= Bytecode::OPCODE_COUNT)
+				{
+					fail();
+					break;
+				}
+				int operands = Bytecode::operandCount(op);
+				code->code.push_back(op);
+				for(int i = 1; i <= operands; i++)
+					code->code.push_back(get32());
+				ip += 1 + operands;
+			}
+			if(failed || code->arglist == nullptr || code->source == nullptr || !checkOperands(*code))
+				return nullptr;
+			code->args = Lambda::argumentIds(code->arglist);
+
+			//the frames the code refers to: its own, and the ones around its closures
+			Locals needs;
+			for(size_t ip = 0; ip < code->code.size(); ip += 1 + Bytecode::operandCount(code->code[ip]))
+			{
+				switch(code->code[ip])
+				{
+				case Bytecode::LOCAL_REF:
+					if(!addLocal(needs, code->code[ip + 1], code->code[ip + 2]))
+						return nullptr;
+					break;
+				case Bytecode::EVAL:
+					merge(needs, localsOf(code->constants[code->code[ip + 1]].get()));
+					break;
+				case Bytecode::CLOSURE:
+					{
+						const CodeObject& lambda = *code->lambdas[code->code[ip + 1]];
+						Locals lambdaNeeds = localsOf(&lambda);
+						if(!bind(lambdaNeeds, lambda.args->size()))
+							return nullptr;
+						merge(needs, lambdaNeeds);
+					}
+					break;
+				default:
+					break;
+				}
+			}
+			if(!needs.empty())
+				locals[code.get()] = std::move(needs);
+			return code;
+		}
+
+		bool readObject()
+		{
+			Object object;
+			uint8_t tag = get8();
+			switch((Tag)tag)
+			{
+			case Tag::FIXNUM:
+				object.sexp = Number::make((int64_t)get64());
+				break;
+			case Tag::BIGNUM:
+				object.sexp = Number::parse(getString());
+				break;
+			case Tag::SYMBOL:
+				object.sexp = SymbolTable::symbol(getSymbol());
+				break;
+			case Tag::STRING:
+				object.sexp = Heap::make<String>(getString());
+				break;
+			case Tag::TYPED_VECTOR:
+				{
+					TypedVector::Type type = (TypedVector::Type)get8();
+					uint64_t size = get64();
+					size_t elementSize = type == TypedVector::Type::S32 ? sizeof(int32_t) : sizeof(int64_t);
+					if(failed || (uint8_t)type > (uint8_t)TypedVector::Type::S64 || (data.size() - pos) / elementSize < size)
+						return fail();
+					std::shared_ptr<TypedVector> v = Heap::make<TypedVector>(type, size);
+					if(type == TypedVector::Type::S32)
+						get(v->getS32().data(), size * elementSize);
+					else
+						get(v->getS64().data(), size * elementSize);
+					object.sexp = v;
+				}
+				break;
+			case Tag::LOCAL_VARIABLE:
+				{
+					int id = getSymbol();
+					int depth = get32();
+					int slot = get32();
+					object.sexp = std::make_shared<LocalVariable>(id, depth, slot);
+					if(!addLocal(locals[object.sexp.get()], depth, slot))
+						return false;
+				}
+				break;
+			case Tag::GLOBAL_VARIABLE:
+				object.sexp = std::make_shared<GlobalVariable>(global->getCell(getSymbol()));
+				break;
+			case Tag::LIST:
+				{
+					std::shared_ptr<Sexp> car = getSexp();
+					std::shared_ptr<Sexp> cdr = getSexp();
+					if(cdr != nullptr && cdr->getKind() != Kind::LIST)
+						return fail();
+					object.sexp = Heap::make<List>(car, std::static_pointer_cast<List>(cdr));
+					Locals needs = localsOf(car.get());
+					merge(needs, localsOf(cdr.get()));
+					if(!needs.empty())
+						locals[object.sexp.get()] = std::move(needs);
+				}
+				break;
+			case Tag::LAMBDA_EXPRESSION:
+				{
+					std::shared_ptr<List> arglist = getArglist();
+					std::shared_ptr<Sexp> body = getSexp(false);
+					std::shared_ptr<Sexp> source = getSexp();
+					if(failed)
+						return false;
+					object.sexp = std::make_shared<LambdaExpression>(arglist, Lambda::argumentIds(arglist), body, source);
+					Locals needs = localsOf(body.get());
+					if(!bind(needs, arglist->size()))
+						return false;
+					if(!needs.empty())
+						locals[object.sexp.get()] = std::move(needs);
+				}
+				break;
+			case Tag::CLOSURE:
+				{
+					std::shared_ptr<Environment> env = getEnvironment();
+					std::shared_ptr<List> arglist = getArglist();
+					std::shared_ptr<Sexp> body = getSexp(false);
+					std::shared_ptr<Sexp> source = getSexp();
+					if(failed)
+						return false;
+					Locals needs = localsOf(body.get());
+					if(!bind(needs, arglist->size()) || !fits(needs, env.get()))
+						return false;
+					object.sexp = Heap::make<Lambda>(env, arglist, Lambda::argumentIds(arglist), body, source);
+				}
+				break;
+			case Tag::OPTIMIZED_BODY:
+				{
+					std::shared_ptr<Sexp> optimized = getSexp(false);
+					std::shared_ptr<Sexp> source = getSexp(false);
+					if(failed)
+						return false;
+					object.sexp = std::make_shared<OptimizedBody>(optimized, source);
+					if(!localsOf(optimized.get()).empty())
+						locals[object.sexp.get()] = localsOf(optimized.get());
+				}
+				break;
+			case Tag::COMPILED_CLOSURE:
+				{
+					std::shared_ptr<Environment> env = getEnvironment();
+					std::shared_ptr<const CodeObject> code = getCode();
+					if(failed)
+						return false;
+					Locals needs = localsOf(code.get());
+					if(!bind(needs, code->args->size()) || !fits(needs, env.get()))
+						return false;
+					object.sexp = Heap::make<CompiledLambda>(env, code);
+				}
+				break;
+			case Tag::BUILTIN:
+				{
+					int id = getSymbol();
+					auto it = builtins.find(id);
+					if(failed || it == builtins.end())
+					{
+						loge << "the image refers to an unknown primitive: " << SymbolTable::name(id) << "\n";
+						return fail();
+					}
+					object.sexp = it->second;
+				}
+				break;
+			case Tag::MEMOIZED:
+				{
+					std::shared_ptr<Sexp> function = getSexp(false);
+					uint64_t capacity = get64();
+					if(failed || !function->isLambda() || function->getKind() == Kind::SPECIAL_FORM || capacity == 0)
+						return fail();
+					object.sexp = Heap::make<MemoizedFunction>(global, std::static_pointer_cast<Lambda>(function), capacity);
+				}
+				break;
+			case Tag::FRAME:
+				{
+					std::shared_ptr<Environment> parent = getEnvironment();
+					uint32_t count = get32();
+					std::shared_ptr<std::vector<int>> names = std::make_shared<std::vector<int>>();
+					std::vector<std::shared_ptr<Sexp>> slots;
+					for(uint32_t i = 0; i < count && !failed; i++)
+					{
+						names->push_back(getSymbol());
+						slots.push_back(getSexp());
+					}
+					if(failed)
+						return false;
+					object.env = Heap::make<Environment>(parent, names);
+					for(uint32_t i = 0; i < count; i++)
+						object.env->setSlot(i, slots[i]);
+				}
+				break;
+			case Tag::CODE:
+				object.code = readCode();
+				if(object.code == nullptr)
+					return fail();
+				break;
+			default:
+				return fail();
+			}
+			if(failed || (object.sexp == nullptr && object.env == nullptr && object.code == nullptr))
+				return fail();
+			objects.push_back(std::move(object));
+			return true;
+		}
+
+	public:
+		ImageReader(const std::string& data, std::shared_ptr<Environment> global, const HeapImage::Builtins& builtins)
+			: data{data}, pos{0}, global{global}, builtins{builtins}, objectCount{0}, failed{false} {}
+
+		bool read()
+		{
+			char magic[sizeof(MAGIC)];
+			if(!get(magic, sizeof(magic)) || std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 || get32() != VERSION)
+				return fail();
+			uint32_t count = get32();
+			for(uint32_t i = 0; i < count && !failed; i++)
+				symbols.push_back(SymbolTable::intern(getString()));
+			count = get32();
+			objectCount = count;
+			//every object takes at least a byte, so a corrupt count can't reserve more than the file
+			objects.reserve(std::min<size_t>(count, data.size() - pos));
+			for(uint32_t i = 0; i < count && !failed; i++)
+				readObject();
+
+			//the bindings are checked before any of them is made
+			std::vector<std::pair<int, std::shared_ptr<Sexp>>> bindings;
+			count = get32();
+			for(uint32_t i = 0; i < count && !failed; i++)
+			{
+				int id = getSymbol();
+				bindings.emplace_back(id, getSexp(false));
+			}
+			if(failed || pos != data.size())
+				return fail();
+			for(auto& binding : bindings)
+				global->bindArg(binding.first, std::move(binding.second));
+			return true;
+		}
+	};
+}
+
+
+//HeapImage
+
+bool HeapImage::save(const std::string& path, const Environment& global, const Builtins& builtins)
+{
+	std::string image;
+	if(!ImageWriter{global, builtins}.image(image))
+		return false;
+	std::ofstream file(path, std::ios::binary);
+	if(!file.write(image.data(), image.size()))
+	{
+		loge << "can't write " << path << "\n";
+		return false;
+	}
+	return true;
+}
+
+bool HeapImage::load(const std::string& path, std::shared_ptr<Environment> global, const Builtins& builtins)
+{
+	std::string image;
+	if(!Lexer::readFile(path, image))
+	{
+		loge << "can't read " << path << "\n";
+		return false;
+	}
+	if(!ImageReader{image, global, builtins}.read())
+	{
+		loge << path << " is not a valid image\n";
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,27 @@
+#include <string>
+#include <unordered_map>
+
+#include "scheme.h"
+
+
+
+
+#pragma once
+
+
+/**	HeapImage saves the global environment, with everything reachable from it (data, closures, their frames and compiled code), to a file,
+ * 	and loads it into a new interpreter, so starting up doesn't need to read and evaluate the source again
+ * 	the image holds no addresses: objects refer to each other by their index in the file, symbols are stored by name (and interned again when loading),
+ * 	and primitives by the name they are bound to at startup, so an image can be loaded by any run of the same interpreter */
+class HeapImage
+{
+public:
+	/**	the bindings of the global environment of a new interpreter, before anything is evaluated: the primitives of the image are looked up here */
+	using Builtins = std::unordered_map<int, std::shared_ptr<Sexp>>;
+
+	/**	false (and logs the error) if the file can't be written, or something can't be saved (a cycle that doesn't go through the global environment) */
+	static bool save(const std::string& path, const Environment& global, const Builtins& builtins);
+
+	/**	binds the variables of the image in global, false (and logs the error) if the file can't be read or is not a valid image */
+	static bool load(const std::string& path, std::shared_ptr<Environment> global, const Builtins& builtins);
+};
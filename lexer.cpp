@@ -0,0 +1,142 @@
+#include <fstream>
+
+#include "lexer.h"
+
+
+namespace
+{
+	bool isDelimiter(char c)
+	{
+		return c == '(' || c == ')' || c == ';' || c == '"' || isspace((unsigned char)c);
+	}
+}
+
+
+Lexer::Lexer(std::istream& is, std::string name)
+	: pos{0}, is{&is}, name{std::move(name)}, line{1}, column{1}, finished{false} {}
+
+Lexer::Lexer(std::string text, std::string name)
+	: buffer{std::move(text)}, pos{0}, is{nullptr}, name{std::move(name)}, line{1}, column{1}, finished{false} {}
+
+bool Lexer::available()
+{
+	if(pos < buffer.size())
+		return true;
+	if(is == nullptr)
+		return false;
+	//the tokens already returned don't point into the buffer, so it can be reused
+	pos = 0;
+	if(!std::getline(*is, buffer))
+	{
+		buffer.clear();
+		return false;
+	}
+	buffer.push_back('\n');
+	return true;
+}
+
+char Lexer::advance()
+{
+	char c = buffer[pos++];
+	if(c == '\n')
+	{
+		line++;
+		column = 1;
+	}
+	else
+		column++;
+	return c;
+}
+
+Lexer::Token Lexer::next()
+{
+	//whitespace and comments
+	while(available())
+	{
+		char c = buffer[pos];
+		if(c == ';')
+		{
+			while(available() && buffer[pos] != '\n')
+				advance();
+		}
+		else if(isspace((unsigned char)c))
+			advance();
+		else
+			break;
+	}
+
+	Token token{TokenType::END, "", line, column};
+	if(!available())
+	{
+		finished = true;
+		return token;
+	}
+	finished = false;
+
+	char c = advance();
+	switch(c)
+	{
+	case '(':
+		token.type = TokenType::OPEN;
+		break;
+	case ')':
+		token.type = TokenType::CLOSE;
+		break;
+	case '"':
+		token.type = TokenType::STRING;
+		while(true)
+		{
+			if(!available())
+			{
+				token.type = TokenType::ERROR;
+				token.text = "string is not closed";
+				break;
+			}
+			c = advance();
+			if(c == '"')
+				break;
+			if(c == '\\' && available())
+			{
+				c = advance();
+				c = c == 'n' ? '\n' : c == 't' ? '\t' : c;
+			}
+			token.text.push_back(c);
+		}
+		break;
+	default:
+		{
+			token.type = TokenType::ATOM;
+			//the atom is scanned in the buffer, and copied at once
+			size_t start = pos - 1;
+			while(pos < buffer.size() && !isDelimiter(buffer[pos]))
+				pos++;
+			column += pos - start - 1;
+			token.text.assign(buffer, start, pos - start);
+		}
+		break;
+	}
+	return token;
+}
+
+bool Lexer::atEnd() const
+{
+	return finished;
+}
+
+std::string Lexer::location(const Token& token) const
+{
+	return name + ":" + std::to_string(token.line) + ":" + std::to_string(token.column);
+}
+
+bool Lexer::readFile(const std::string& path, std::string& text)
+{
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if(!file)
+		return false;
+	std::streamoff size = file.tellg();
+	if(size < 0)
+		return false;
+	text.resize((size_t)size);
+	file.seekg(0);
+	return (bool)file.read(&text[0], size) || size == 0;
+}
@@ -0,0 +1,58 @@
+#include <iostream>
+#include <string>
+
+
+
+
+#pragma once
+
+
+/**	Lexer splits source text into tokens: parentheses, string literals and atoms (numbers and symbols), skipping whitespace and ; comments
+ * 	the text is either one buffer holding all of it (a file is read with a single read), or a stream refilled a line at a time (the REPL)
+ * 	tokens carry the line and column they start at, for error messages */
+class Lexer
+{
+public:
+	enum class TokenType {OPEN, CLOSE, ATOM, STRING, END, ERROR};
+
+	struct Token
+	{
+		TokenType type;
+		/**	the atom, the contents of the string (escapes resolved), or the error message */
+		std::string text;
+		int line;
+		int column;
+	};
+
+private:
+	std::string buffer;
+	size_t pos;
+	/**	refills buffer when it is used up, nullptr if the whole text is in buffer */
+	std::istream* is;
+	std::string name;
+	int line;
+	int column;
+	bool finished;
+
+	/**	makes sure there is a character at pos, false at the end of the text */
+	bool available();
+	/**	consumes the character at pos, keeping track of the line and column */
+	char advance();
+
+public:
+	/**	tokens of a stream, read a line at a time */
+	Lexer(std::istream& is, std::string name = "<stdin>");
+	/**	tokens of text */
+	Lexer(std::string text, std::string name);
+
+	Token next();
+
+	/**	if the last token was TokenType::END */
+	bool atEnd() const;
+
+	/**	name:line:column of token, for error messages */
+	std::string location(const Token& token) const;
+
+	/**	reads the whole file at path into text, false if it can't be read */
+	static bool readFile(const std::string& path, std::string& text);
+};
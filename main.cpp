@@ -1,13 +1,58 @@
-#include "scheme.h"
+#include <cstring>
+#include <string>
+#include <vector>
 
+#include "scheme.h"
+#include "profiler.h"
 
 
 
 
-int main()
+/**	scheme [--image file.img] [--save-image file.img] [--profile file | --profile-sample file] [file.scm...]
+ * 	without files: the interactive REPL
+ * 	with files: batch mode, the files are evaluated in order without prompts or printed results
+ * 	--image starts from a heap image instead of evaluating the prelude, --save-image saves one after the files are evaluated (instead of the REPL)
+ * 	--profile profiles the whole run (see Profiler), prints the report at the end and writes the collapsed stacks to file, --profile-sample samples it */
+int main(int argc, char* argv[])
 {
+	std::string image, saveImage, profile;
+	Profiler::Mode profileMode = Profiler::Mode::EXACT;
+	std::vector<std::string> files;
+	for(int i = 1; i < argc; i++)
+	{
+		if((std::strcmp(argv[i], "--image") == 0 || std::strcmp(argv[i], "--save-image") == 0) && i + 1 < argc)
+		{
+			(std::strcmp(argv[i], "--image") == 0 ? image : saveImage) = argv[i + 1];
+			i++;
+		}
+		else if((std::strcmp(argv[i], "--profile") == 0 || std::strcmp(argv[i], "--profile-sample") == 0) && i + 1 < argc)
+		{
+			profileMode = std::strcmp(argv[i], "--profile") == 0 ? Profiler::Mode::EXACT : Profiler::Mode::SAMPLING;
+			profile = argv[i + 1];
+			i++;
+		}
+		else
+			files.push_back(argv[i]);
+	}
 	
-	SchemeInterpreter si;
-	si.run();
+	SchemeInterpreter si{image.empty()};
+	if(!image.empty() && !si.loadImage(image))
+		return 1;
+	Profiler profiler{profileMode};
+	bool succeeded = true;
+	{
+		Profiler::Scope scope{profile.empty() ? nullptr : &profiler};
+		if(files.empty() && saveImage.empty())
+			si.run();
+		for(size_t i = 0; i < files.size() && !si.hasExited() && succeeded; i++)
+			succeeded = si.load(files[i]);
+	}
+	if(!profile.empty())
+	{
+		profiler.report(std::cout);
+		profiler.writeCollapsed(profile);
+	}
+	if(!succeeded || (!saveImage.empty() && !si.saveImage(saveImage)))
+		return 1;
+	return 0;
 }
-
@@ -0,0 +1,325 @@
+#include <functional>
+
+#include "memo.h"
+#include "future.h"
+
+
+namespace
+{
+	size_t combine(size_t seed, size_t hash)
+	{
+		return seed ^ (hash + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2));
+	}
+
+	size_t hashValue(const Sexp* s)
+	{
+		if(s == nullptr)
+			return 0;
+		switch(s->getKind())
+		{
+		case Kind::NUMBER:
+			{
+				const Number* number = static_cast<const Number*>(s);
+				if(number->isFixnum())
+					return std::hash<int64_t>()(number->getFixnum());
+				return std::hash<std::string>()(number->toBigInt().toString());
+			}
+		case Kind::STRING:
+			return std::hash<std::string>()(static_cast<const String*>(s)->getValue());
+		case Kind::LIST:
+			{
+				size_t hash = 1;
+				for(const List* l = static_cast<const List*>(s); l != nullptr && l->Car() != nullptr; l = l->Cdr().get())
+					hash = combine(hash, hashValue(l->Car().get()));
+				return hash;
+			}
+		default:
+			//symbols are interned, the rest is compared by identity
+			return std::hash<const Sexp*>()(s);
+		}
+	}
+
+	bool equalValues(const Sexp* left, const Sexp* right)
+	{
+		if(left == right)
+			return true;
+		if(left == nullptr || right == nullptr || left->getKind() != right->getKind())
+			return false;
+		switch(left->getKind())
+		{
+		case Kind::NUMBER:
+			return CommonInteger::compare(*static_cast<const Number*>(left), *static_cast<const Number*>(right)) == 0;
+		case Kind::STRING:
+			return static_cast<const String*>(left)->getValue() == static_cast<const String*>(right)->getValue();
+		case Kind::LIST:
+			{
+				const List* l = static_cast<const List*>(left);
+				const List* r = static_cast<const List*>(right);
+				for(; l != nullptr && r != nullptr; l = l->Cdr().get(), r = r->Cdr().get())
+				{
+					if(!equalValues(l->Car().get(), r->Car().get()))
+						return false;
+				}
+				return l == nullptr && r == nullptr;
+			}
+		default:
+			return false;
+		}
+	}
+
+	/**	the memoized function argument of the memoization primitives, nullptr (and logs the error) if s is not one */
+	MemoizedFunction* convertAndCheck(Sexp* s)
+	{
+		MemoizedFunction* memoized = dynamic_cast<MemoizedFunction*>(s);
+		if(memoized == nullptr)
+			loge << *s << " is not a memoized function\n";
+		return memoized;
+	}
+
+	/**	the capacity argument of memoize and define-memoized, false (and logs the error) if s is not a positive fixnum */
+	bool convertCapacity(Sexp* s, size_t& capacity)
+	{
+		Number* number = CommonInteger::ConvertAndCheck(s);
+		if(number == nullptr)
+			return false;
+		if(!number->isFixnum() || number->getFixnum() < 1)
+		{
+			loge << "the capacity of a memoized function has to be positive, got " << *number << "\n";
+			return false;
+		}
+		capacity = (size_t)number->getFixnum();
+		return true;
+	}
+
+	/**	the function to memoize, nullptr (and logs the error) if s is not a function with evaluated arguments */
+	std::shared_ptr<Lambda> convertFunction(const std::shared_ptr<Sexp>& s)
+	{
+		if(s == nullptr || !s->isLambda() || s->getKind() == Kind::SPECIAL_FORM)
+		{
+			if(s != nullptr)
+				loge << *s << " can't be memoized\n";
+			return nullptr;
+		}
+		return std::static_pointer_cast<Lambda>(s);
+	}
+}
+
+
+//MemoizedFunction
+
+size_t MemoizedFunction::KeyHash::operator()(const Key* key) const
+{
+	size_t hash = key->size();
+	for(const auto& arg : *key)
+		hash = combine(hash, hashValue(arg.get()));
+	return hash;
+}
+
+bool MemoizedFunction::KeyEqual::operator()(const Key* left, const Key* right) const
+{
+	if(left->size() != right->size())
+		return false;
+	for(size_t i = 0; i < left->size(); i++)
+	{
+		if(!equalValues((*left)[i].get(), (*right)[i].get()))
+			return false;
+	}
+	return true;
+}
+
+MemoizedFunction::MemoizedFunction(std::shared_ptr<Environment> env, std::shared_ptr<Lambda> function, size_t capacity)
+	: Lambda{env}, function{function}, capacity{capacity}, stats{0, 0, 0} {}
+
+std::shared_ptr<Lambda> MemoizedFunction::getFunction() const
+{
+	return function;
+}
+
+size_t MemoizedFunction::getCapacity() const
+{
+	return capacity;
+}
+
+size_t MemoizedFunction::size() const
+{
+	std::lock_guard<std::mutex> lock{mutex};
+	return entries.size();
+}
+
+MemoizedFunction::Stats MemoizedFunction::getStats() const
+{
+	std::lock_guard<std::mutex> lock{mutex};
+	return stats;
+}
+
+std::shared_ptr<Sexp> MemoizedFunction::eval(std::shared_ptr<Environment> context, std::shared_ptr<List> params) const
+{
+	Key key;
+	for(const List* l = params.get(); l != nullptr && l->Car() != nullptr; l = l->Cdr().get())
+		key.push_back(l->Car());
+
+	{
+		std::lock_guard<std::mutex> lock{mutex};
+		auto it = index.find(&key);
+		if(it != index.end())
+		{
+			stats.hits++;
+			entries.splice(entries.begin(), entries, it->second);
+			return it->second->second;
+		}
+		stats.misses++;
+	}
+
+	std::shared_ptr<Sexp> result = function->eval(context, params);
+	if(result == nullptr)
+		return nullptr;
+	std::lock_guard<std::mutex> lock{mutex};
+	//a recursive call, or a future, may have stored the same arguments meanwhile
+	if(index.find(&key) != index.end())
+		return result;
+
+	entries.emplace_front(std::move(key), result);
+	index[&entries.front().first] = entries.begin();
+	if(entries.size() > capacity)
+	{
+		index.erase(&entries.back().first);
+		entries.pop_back();
+		stats.evictions++;
+	}
+	return result;
+}
+
+void MemoizedFunction::print(std::ostream &os) const
+{
+	os << "(memoized " << *function << ")";
+}
+
+void MemoizedFunction::traverse(References& references) const
+{
+	Lambda::traverse(references);
+	addReference(references, function);
+	for(const Entry& entry : entries)
+	{
+		for(const auto& arg : entry.first)
+			addReference(references, arg);
+		addReference(references, entry.second);
+	}
+}
+
+void MemoizedFunction::clearReferences()
+{
+	Lambda::clearReferences();
+	function = nullptr;
+	index.clear();
+	entries.clear();
+}
+
+size_t MemoizedFunction::gcSize() const
+{
+	return sizeof(*this) + entries.size() * (sizeof(Entry) + 4 * sizeof(void*));
+}
+
+
+//MemoFunction
+
+MemoFunction::MemoFunction(std::shared_ptr<Environment> env, Operation operation) : Lambda{env}, operation{operation} {}
+
+std::shared_ptr<Sexp> MemoFunction::eval(std::shared_ptr<Environment> context, std::shared_ptr<List> params) const
+{
+	int argc = params->size();
+	int expected = operation == Operation::MEMOIZE ? 2 : 1;
+	if(argc < 1 || argc > expected)
+	{
+		loge << "wrong number of arguments for " << *this << ". (Expected: " << expected << ", got: " << argc << ")\n";
+		return nullptr;
+	}
+
+	switch(operation)
+	{
+	case Operation::MEMOIZE:
+		{
+			std::shared_ptr<Lambda> function = convertFunction(params->Car());
+			size_t capacity = MemoizedFunction::DEFAULT_CAPACITY;
+			if(function == nullptr || (argc == 2 && !convertCapacity(params->Cdr()->Car().get(), capacity)))
+				return nullptr;
+			return Heap::make<MemoizedFunction>(env, function, capacity);
+		}
+	case Operation::STATS:
+		{
+			MemoizedFunction* memoized = convertAndCheck(params->Car().get());
+			if(memoized == nullptr)
+				return nullptr;
+			MemoizedFunction::Stats stats = memoized->getStats();
+			std::vector<std::shared_ptr<Sexp>> entries;
+			auto entry = [&entries](const char* name, size_t value)
+			{
+				entries.push_back(Heap::make<List>(std::vector<std::shared_ptr<Sexp>>{Symbol::intern(name), Number::make(static_cast<int64_t>(value))}));
+			};
+			entry("hits", stats.hits);
+			entry("misses", stats.misses);
+			entry("evictions", stats.evictions);
+			entry("size", memoized->size());
+			entry("capacity", memoized->getCapacity());
+			return Heap::make<List>(entries);
+		}
+	}
+	return nullptr;
+}
+
+void MemoFunction::print(std::ostream &os) const
+{
+	os << (operation == Operation::MEMOIZE ? "memoize" : "memo-stats");
+}
+
+void MemoFunction::defineAll(std::shared_ptr<Environment> global)
+{
+	global->bindArg("memoize", Heap::make<MemoFunction>(global, Operation::MEMOIZE));
+	global->bindArg("memo-stats", Heap::make<MemoFunction>(global, Operation::STATS));
+	global->bindArg("define-memoized", Heap::make<DefineMemoized>(global));
+}
+
+
+//DefineMemoized
+// (define-memoized (fun vars...) body [capacity])
+
+DefineMemoized::DefineMemoized(std::shared_ptr<Environment> env) : SyntaxLambda{env} {}
+
+std::shared_ptr<Sexp> DefineMemoized::eval(std::shared_ptr<Environment> context, std::shared_ptr<List> params) const
+{
+	if(params->size() < 2)
+	{
+		loge << "not enough arguments for define-memoized. (Expected: at least 2, got: " << params->size() << ")\n";
+		return nullptr;
+	}
+	size_t capacity = MemoizedFunction::DEFAULT_CAPACITY;
+	std::shared_ptr<List> rest = params->Cdr()->Cdr();
+	if(rest != nullptr)
+	{
+		std::shared_ptr<Sexp> value = rest->Car()->eval(context);
+		if(value == nullptr || !convertCapacity(value.get(), capacity))
+			return nullptr;
+	}
+
+	std::shared_ptr<Symbol> variable;
+	std::shared_ptr<Sexp> value;
+	if(Future::running())
+	{
+		loge << "define-memoized can't be used in a future\n";
+		return nullptr;
+	}
+	if(!DefineFunction::definition(context, params, variable, value) || value == nullptr)
+		return nullptr;
+	std::shared_ptr<Lambda> function = convertFunction(value);
+	if(function == nullptr)
+		return nullptr;
+
+	std::shared_ptr<Sexp> memoized = Heap::make<MemoizedFunction>(env, function, capacity);
+	//env is the global environment here
+	env->bindArg(variable->getId(), memoized);
+	return memoized;
+}
+
+void DefineMemoized::print(std::ostream &os) const
+{
+	os << "define-memoized";
+}
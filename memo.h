@@ -0,0 +1,109 @@
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "scheme.h"
+
+
+
+
+#pragma once
+
+
+/**	a function that remembers its results: a call with the arguments of an earlier call returns its result without calling the function again
+ * 	the results are kept in a hash table keyed by the arguments - numbers, symbols, strings and lists are compared by value, everything else by identity -
+ * 	holding up to capacity results, the least recently used one is evicted to make room for a new one
+ * 	only pure functions should be memoized: the function is not called again for the arguments it has a result for */
+class MemoizedFunction : public Lambda
+{
+public:
+	/**	the size of the tables of define-memoized, and of memoize without a capacity */
+	enum : size_t {DEFAULT_CAPACITY = 4096};
+
+	struct Stats
+	{
+		size_t hits;
+		size_t misses;
+		size_t evictions;
+	};
+
+private:
+	using Key = std::vector<std::shared_ptr<Sexp>>;
+	using Entry = std::pair<Key, std::shared_ptr<Sexp>>;
+
+	/**	structural hash and equality of the arguments */
+	struct KeyHash
+	{
+		size_t operator()(const Key* key) const;
+	};
+	struct KeyEqual
+	{
+		bool operator()(const Key* left, const Key* right) const;
+	};
+
+	std::shared_ptr<Lambda> function;
+	size_t capacity;
+	/**	the results, the most recently used first */
+	mutable std::list<Entry> entries;
+	/**	the keys point into entries */
+	mutable std::unordered_map<const Key*, std::list<Entry>::iterator, KeyHash, KeyEqual> index;
+	mutable Stats stats;
+	/**	futures may call the function concurrently, the lock is not held while it is called */
+	mutable std::mutex mutex;
+
+public:
+	MemoizedFunction(std::shared_ptr<Environment> env, std::shared_ptr<Lambda> function, size_t capacity = DEFAULT_CAPACITY);
+
+	std::shared_ptr<Lambda> getFunction() const;
+	size_t getCapacity() const;
+	size_t size() const;
+	Stats getStats() const;
+
+	virtual std::shared_ptr<Sexp> eval(std::shared_ptr<Environment> context, std::shared_ptr<List> params) const;
+	/**	(memoized function) */
+	void print(std::ostream &os) const;
+
+	void traverse(References& references) const;
+	void clearReferences();
+	size_t gcSize() const;
+};
+
+
+/**	the memoization primitives, one class for all of them like TypedVectorFunction */
+class MemoFunction : public Lambda
+{
+public:
+	enum class Operation : unsigned char
+	{
+		/**	(memoize f [capacity]) a MemoizedFunction calling f */
+		MEMOIZE,
+		/**	(memo-stats f) the counters of a memoized function as a list of (name value) lists, like gc-stats */
+		STATS
+	};
+
+private:
+	Operation operation;
+
+public:
+	MemoFunction(std::shared_ptr<Environment> env, Operation operation);
+
+	virtual std::shared_ptr<Sexp> eval(std::shared_ptr<Environment> context, std::shared_ptr<List> params) const;
+	void print(std::ostream &os) const;
+
+	/**	binds memoize, memo-stats and define-memoized in global */
+	static void defineAll(std::shared_ptr<Environment> global);
+};
+
+
+/**	(define-memoized (fun vars...) body [capacity])
+ * 	(define-memoized fun exp [capacity])
+ * 	like define, but binds the memoized function, so the recursive calls of fun are memoized too */
+class DefineMemoized : public SyntaxLambda
+{
+public:
+	DefineMemoized(std::shared_ptr<Environment> env);
+
+	virtual std::shared_ptr<Sexp> eval(std::shared_ptr<Environment> context, std::shared_ptr<List> params) const;
+	void print(std::ostream &os) const;
+};
@@ -0,0 +1,180 @@
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <type_traits>
+
+#include "scheme.h"
+
+
+
+
+#pragma once
+
+
+/**	Native functions: C++ functions bound in the global environment of an interpreter with SchemeInterpreter::defineNative
+ * 		int64_t add3(int64_t a, int64_t b, int64_t c) {return a + b + c;}
+ * 		interpreter.defineNative("add3", &add3);
+ * 	the argument and result conversions are generated from the signature of the function at compile time (see NativeValue),
+ * 	a call checks the arity and converts the arguments in one pass over its argument list
+ * 	supported types: the integer types (the arguments are range checked), bool (the truth value of any argument, #t or #f as a result),
+ * 	std::string (string literals, const std::string& too) and std::shared_ptr<Sexp> (any value, a nullptr result is an error)
+ * 	a function returning void returns #t */
+
+/**	conversion between the values of the interpreter and the C++ type T
+ * 	check logs an error and returns false if s can't be converted, from converts s after a successful check, to makes the value of a result */
+template <typename T, typename Enable = void>
+struct NativeValue;
+
+template <typename T>
+struct NativeValue<T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value>::type>
+{
+	static bool check(Sexp* s)
+	{
+		Number* number = CommonInteger::ConvertAndCheck(s);
+		if(number == nullptr)
+			return false;
+		int64_t value = number->getFixnum();
+		bool fits = number->isFixnum() && (std::is_signed<T>::value
+			? value >= static_cast<int64_t>(std::numeric_limits<T>::min()) && value <= static_cast<int64_t>(std::numeric_limits<T>::max())
+			: value >= 0 && static_cast<uint64_t>(value) <= static_cast<uint64_t>(std::numeric_limits<T>::max()));
+		if(!fits)
+			loge << *s << " is out of range\n";
+		return fits;
+	}
+	static T from(Sexp* s) {return static_cast<T>(static_cast<Number*>(s)->getFixnum());}
+	static std::shared_ptr<Sexp> to(T value)
+	{
+		if(std::is_signed<T>::value || static_cast<uint64_t>(value) <= static_cast<uint64_t>(std::numeric_limits<int64_t>::max()))
+			return Number::make(static_cast<int64_t>(value));
+		BigInt big;
+		BigInt::parse(std::to_string(value), big);
+		return Number::make(big);
+	}
+};
+
+template <>
+struct NativeValue<bool>
+{
+	static bool check(Sexp*) {return true;}
+	static bool from(Sexp* s) {return static_cast<bool>(*s);}
+	static std::shared_ptr<Sexp> to(bool value) {return Symbol::boolean(value);}
+};
+
+template <>
+struct NativeValue<std::string>
+{
+	static bool check(Sexp* s)
+	{
+		if(s->getKind() == Kind::STRING)
+			return true;
+		loge << *s << " is not a string\n";
+		return false;
+	}
+	static const std::string& from(Sexp* s) {return static_cast<String*>(s)->getValue();}
+	static std::shared_ptr<Sexp> to(const std::string& value) {return Heap::make<String>(value);}
+};
+
+template <>
+struct NativeValue<std::shared_ptr<Sexp>>
+{
+	static bool check(Sexp*) {return true;}
+	static std::shared_ptr<Sexp> from(Sexp* s) {return s->shared_from_this();}
+	static std::shared_ptr<Sexp> to(std::shared_ptr<Sexp> value) {return value;}
+};
+
+
+/**	the indices of the arguments, like std::index_sequence of C++14 */
+template <size_t... I>
+struct NativeIndices {};
+
+template <size_t N, size_t... I>
+struct MakeNativeIndices : MakeNativeIndices<N - 1, N - 1, I...> {};
+
+template <size_t... I>
+struct MakeNativeIndices<0, I...>
+{
+	using type = NativeIndices<I...>;
+};
+
+/**	checks the arguments in order, stopping at the first one that can't be converted */
+template <typename... Args>
+struct NativeArguments
+{
+	static bool check(Sexp* const*) {return true;}
+};
+
+template <typename T, typename... Rest>
+struct NativeArguments<T, Rest...>
+{
+	static bool check(Sexp* const* args) {return NativeValue<typename std::decay<T>::type>::check(*args) && NativeArguments<Rest...>::check(args + 1);}
+};
+
+/**	calls the function and converts its result */
+template <typename R>
+struct NativeResult
+{
+	template <typename F, typename... Args>
+	static std::shared_ptr<Sexp> call(F function, Args&&... args) {return NativeValue<typename std::decay<R>::type>::to(function(std::forward<Args>(args)...));}
+};
+
+template <>
+struct NativeResult<void>
+{
+	template <typename F, typename... Args>
+	static std::shared_ptr<Sexp> call(F function, Args&&... args)
+	{
+		function(std::forward<Args>(args)...);
+		return Symbol::boolean(true);
+	}
+};
+
+
+/**	a primitive calling the C++ function R function(Args...) */
+template <typename R, typename... Args>
+class NativeFunction : public Lambda
+{
+	std::string name;
+	R (*function)(Args...);
+
+	template <size_t... I>
+	std::shared_ptr<Sexp> call(const std::array<Sexp*, sizeof...(Args)>& args, NativeIndices<I...>) const
+	{
+		if(!NativeArguments<Args...>::check(args.data()))
+			return nullptr;
+		return NativeResult<R>::call(function, NativeValue<typename std::decay<Args>::type>::from(args[I])...);
+	}
+
+public:
+	NativeFunction(std::shared_ptr<Environment> env, std::string name, R (*function)(Args...)) : Lambda{env}, name{std::move(name)}, function{function} {}
+
+	virtual std::shared_ptr<Sexp> eval(std::shared_ptr<Environment>, std::shared_ptr<List> params) const
+	{
+		std::array<Sexp*, sizeof...(Args)> args;
+		size_t count = 0;
+		const List* l = params.get();
+		for(; l != nullptr && l->Car() != nullptr && count < args.size(); l = l->Cdr().get())
+			args[count++] = l->Car().get();
+		if(count != args.size() || (l != nullptr && l->Car() != nullptr))
+		{
+			loge << "wrong number of arguments for " << name << ". (Expected: " << args.size() << ", got: " << params->size() << ")\n";
+			return nullptr;
+		}
+		return call(args, typename MakeNativeIndices<sizeof...(Args)>::type());
+	}
+
+	void print(std::ostream &os) const
+	{
+		os << name;
+	}
+};
+
+
+template <typename R, typename... Args>
+void SchemeInterpreter::defineNative(const std::string& name, R (*function)(Args...))
+{
+	bindNative(name, [&name, function](std::shared_ptr<Environment> global) -> std::shared_ptr<Lambda>
+	{
+		return Heap::make<NativeFunction<R, Args...>>(global, name, function);
+	});
+}
@@ -0,0 +1,497 @@
+#include "optimizer.h"
+
+
+namespace
+{
+	/**	number of atoms and lists in exp, counting stops above limit */
+	int expressionSize(const Sexp& exp, int limit)
+	{
+		if(exp.getKind() != Kind::LIST)
+			return 1;
+		int size = 1;
+		for(const List* l = static_cast<const List*>(&exp); l != nullptr && l->Car() != nullptr && size <= limit; l = l->Cdr().get())
+			size += expressionSize(*l->Car(), limit - size);
+		return size;
+	}
+
+	/**	arguments that can be substituted any number of times: evaluating them has no effect, and costs nothing */
+	bool isTrivial(const Sexp& exp)
+	{
+		switch(exp.getKind())
+		{
+		case Kind::NUMBER:
+		case Kind::SYMBOL:
+		case Kind::LOCAL_VARIABLE:
+		case Kind::GLOBAL_VARIABLE:
+		case Kind::STRING:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	/**	the id of a reference to a global variable: a symbol (not resolved yet) or a GlobalVariable, -1 for anything else */
+	int globalId(const Sexp& exp)
+	{
+		switch(exp.getKind())
+		{
+		case Kind::SYMBOL:
+			return static_cast<const Symbol&>(exp).getId();
+		case Kind::GLOBAL_VARIABLE:
+			return static_cast<const GlobalVariable&>(exp).getId();
+		default:
+			return -1;
+		}
+	}
+
+	bool isFoldable(const Sexp* form)
+	{
+		return dynamic_cast<const AddFunction*>(form) != nullptr
+			|| dynamic_cast<const MinusFunction*>(form) != nullptr
+			|| dynamic_cast<const MultiplyFunction*>(form) != nullptr
+			|| dynamic_cast<const DivisionFunction*>(form) != nullptr
+			|| dynamic_cast<const LessFunction*>(form) != nullptr
+			|| dynamic_cast<const GreaterFunction*>(form) != nullptr
+			|| dynamic_cast<const EqualFunction*>(form) != nullptr;
+	}
+}
+
+
+//InlinedCall
+// (inlined name function expansion call)
+
+InlinedCall::InlinedCall(std::shared_ptr<Environment> env) : SyntaxLambda{env} {}
+
+std::shared_ptr<Sexp> InlinedCall::eval(std::shared_ptr<Environment> context, std::shared_ptr<List> params) const
+{
+	TailCall tail{nullptr, nullptr};
+	std::shared_ptr<Sexp> result = evalTail(context, params, tail);
+	if(tail.exp != nullptr)
+		result = TailCall::run(tail.exp, tail.context, tail.callee);
+	return result;
+}
+
+std::shared_ptr<Sexp> InlinedCall::evalTail(std::shared_ptr<Environment> context, std::shared_ptr<List> params, TailCall& tail) const
+{
+	if(params == nullptr || params->size() != 4 || globalId(*params->Car()) == -1)
+	{
+		loge << "inlined expects a name, a function, its expansion and the call\n";
+		return nullptr;
+	}
+	const List* rest = params->Cdr().get();
+	bool bound;
+	if(params->Car()->getKind() == Kind::GLOBAL_VARIABLE)
+		bound = static_cast<const GlobalVariable*>(params->Car().get())->getCell()->value == rest->Car();
+	else
+	{
+		//env is the global environment here
+		bound = env->getValue(static_cast<const Symbol*>(params->Car().get())->getId()) == rest->Car();
+	}
+	rest = rest->Cdr().get();
+	tail.exp = bound ? rest->Car() : rest->Cdr()->Car();
+	tail.context = context;
+	return nullptr;
+}
+
+void InlinedCall::print(std::ostream &os) const
+{
+	os << "inlined";
+}
+
+
+//OptimizedBody
+
+OptimizedBody::OptimizedBody(std::shared_ptr<Sexp> optimized, std::shared_ptr<Sexp> source) : Sexp{Kind::OPTIMIZED_BODY}, optimized{optimized}, source{source} {}
+
+std::shared_ptr<Sexp> OptimizedBody::getOptimized() const
+{
+	return optimized;
+}
+
+std::shared_ptr<Sexp> OptimizedBody::getSource() const
+{
+	return source;
+}
+
+std::shared_ptr<Sexp> OptimizedBody::unwrap(std::shared_ptr<Sexp>& body)
+{
+	if(body == nullptr || body->getKind() != Kind::OPTIMIZED_BODY)
+		return nullptr;
+	const OptimizedBody* wrapper = static_cast<const OptimizedBody*>(body.get());
+	std::shared_ptr<Sexp> source = wrapper->source;
+	body = wrapper->optimized;
+	return source;
+}
+
+std::shared_ptr<Sexp> OptimizedBody::eval(std::shared_ptr<Environment> context) const
+{
+	return optimized->eval(context);
+}
+
+std::shared_ptr<Sexp> OptimizedBody::evalTail(std::shared_ptr<Environment> context, TailCall& tail) const
+{
+	return optimized->evalTail(context, tail);
+}
+
+void OptimizedBody::print(std::ostream &os) const
+{
+	os << *optimized;
+}
+
+
+//Optimizer
+
+Optimizer::Optimizer(std::shared_ptr<Environment> global, std::shared_ptr<Sexp> guard) : global{global.get()}, guard{guard}, inlineDepth{0} {}
+
+bool Optimizer::isLocal(int id) const
+{
+	for(const std::vector<int>* scope : scopes)
+	{
+		for(int name : *scope)
+		{
+			if(name == id)
+				return true;
+		}
+	}
+	return false;
+}
+
+std::shared_ptr<Sexp> Optimizer::globalForm(std::shared_ptr<Sexp> head) const
+{
+	//references resolved already can't be shadowed
+	if(head->getKind() == Kind::GLOBAL_VARIABLE)
+		return static_cast<const GlobalVariable*>(head.get())->getCell()->value;
+	if(head->getKind() != Kind::SYMBOL)
+		return nullptr;
+	int id = static_cast<const Symbol*>(head.get())->getId();
+	if(isLocal(id))
+		return nullptr;
+	return global->getValue(id);
+}
+
+bool Optimizer::isCall(const std::shared_ptr<Sexp>& head, const Sexp* form) const
+{
+	//the values of local variables and of calls are only known when the form runs
+	if(head->getKind() == Kind::LOCAL_VARIABLE || head->getKind() == Kind::LIST)
+		return true;
+	if(head->getKind() == Kind::SYMBOL && isLocal(static_cast<const Symbol*>(head.get())->getId()))
+		return true;
+	return form != nullptr && form->isLambda();
+}
+
+std::shared_ptr<Sexp> Optimizer::optimize(std::shared_ptr<Sexp> exp)
+{
+	if(exp == nullptr || exp->getKind() != Kind::LIST)
+		return exp;
+	return optimizeList(std::static_pointer_cast<List>(exp));
+}
+
+std::shared_ptr<Sexp> Optimizer::optimizeBody(std::shared_ptr<Sexp> body)
+{
+	return std::make_shared<OptimizedBody>(optimize(body), body);
+}
+
+std::shared_ptr<Sexp> Optimizer::optimizeList(std::shared_ptr<List> list)
+{
+	if(list->Car() == nullptr)
+		return list;
+
+	int size = list->size();
+	std::shared_ptr<Sexp> form = globalForm(list->Car());
+
+	// (lambda (args...) body) - the body is optimized with the new frame on top
+	if(dynamic_cast<CreateLambda*>(form.get()) != nullptr)
+	{
+		if(size < 3 || !Lambda::isArglist(list->Cdr()->Car()))
+			return list;
+		std::shared_ptr<List> arglist = std::static_pointer_cast<List>(list->Cdr()->Car());
+		std::shared_ptr<const std::vector<int>> args = Lambda::argumentIds(arglist);
+		std::vector<std::shared_ptr<Sexp>> elements{list->Car(), arglist};
+		scopes.insert(scopes.begin(), args.get());
+		for(auto s : *list->Cdr()->Cdr())
+			elements.push_back(optimizeBody(s));
+		scopes.erase(scopes.begin());
+		return Heap::make<List>(elements);
+	}
+
+	// (define name exp), (define (fun vars...) body)
+	if(dynamic_cast<DefineFunction*>(form.get()) != nullptr)
+	{
+		if(size < 3)
+			return list;
+		std::shared_ptr<Sexp> target = list->Cdr()->Car();
+		std::shared_ptr<List> header = std::dynamic_pointer_cast<List>(target);
+		Symbol* name = dynamic_cast<Symbol*>(header == nullptr ? target.get() : header->Car().get());
+		if(name == nullptr || (header != nullptr && header->Cdr() != nullptr && !Lambda::isArglist(header->Cdr())))
+			return list;
+		std::shared_ptr<const std::vector<int>> args;
+		if(header != nullptr)
+		{
+			args = Lambda::argumentIds(header->Cdr() == nullptr ? Heap::make<List>() : header->Cdr());
+			scopes.insert(scopes.begin(), args.get());
+		}
+		defining.push_back(name->getId());
+		std::vector<std::shared_ptr<Sexp>> elements{list->Car(), target};
+		for(auto s : *list->Cdr()->Cdr())
+			elements.push_back(header != nullptr ? optimizeBody(s) : optimize(s));
+		defining.pop_back();
+		if(header != nullptr)
+			scopes.erase(scopes.begin());
+		return Heap::make<List>(elements);
+	}
+
+	// (if test trueExp falseExp) - a constant test chooses the branch
+	if(dynamic_cast<IfLambda*>(form.get()) != nullptr && (size == 3 || size == 4))
+	{
+		std::shared_ptr<Sexp> test = optimize(list->Cdr()->Car());
+		bool value;
+		if(constantTest(test, value))
+		{
+			if(value)
+				return optimize(list->Cdr()->Cdr()->Car());
+			return size == 4 ? optimize(list->Cdr()->Cdr()->Cdr()->Car()) : Symbol::boolean(false);
+		}
+		std::vector<std::shared_ptr<Sexp>> elements{list->Car(), test};
+		for(auto s : *list->Cdr()->Cdr())
+			elements.push_back(optimize(s));
+		return Heap::make<List>(elements);
+	}
+
+	// (inlined name function expansion call) from the body of an inlined function: the arguments substituted in the expansion
+	// may fold it further, the call is only evaluated if the function is redefined
+	if(list->Car() == guard && size == 5)
+	{
+		std::vector<std::shared_ptr<Sexp>> elements;
+		for(auto s : *list)
+			elements.push_back(s);
+		inlineDepth++;
+		elements[3] = optimize(elements[3]);
+		inlineDepth--;
+		return Heap::make<List>(elements);
+	}
+
+	//the forms of other syntax are left alone
+	if(list->Car()->getKind() == Kind::SPECIAL_FORM || dynamic_cast<SyntaxLambda*>(form.get()) != nullptr)
+		return list;
+
+	//a list whose head is not a function evaluates to itself, its elements are data
+	if(!isCall(list->Car(), form.get()))
+		return list;
+
+	std::vector<std::shared_ptr<Sexp>> args;
+	if(list->Cdr() != nullptr)
+	{
+		for(auto s : *list->Cdr())
+			args.push_back(optimize(s));
+	}
+
+	std::shared_ptr<Sexp> result = fold(form, args);
+	if(result == nullptr && form != nullptr && (form->getKind() == Kind::CLOSURE || form->getKind() == Kind::COMPILED_CLOSURE))
+		result = inlineCall(list->Car(), form, args);
+	if(result != nullptr)
+		return result;
+
+	args.insert(args.begin(), optimize(list->Car()));
+	return Heap::make<List>(args);
+}
+
+std::shared_ptr<Sexp> Optimizer::fold(const std::shared_ptr<Sexp>& form, const std::vector<std::shared_ptr<Sexp>>& args) const
+{
+	if(!isFoldable(form.get()) || args.size() < 2)
+		return nullptr;
+	for(size_t i = 0; i < args.size(); i++)
+	{
+		if(args[i]->getKind() != Kind::NUMBER)
+			return nullptr;
+		//division by zero is left to fail when the form is evaluated
+		const Number* number = static_cast<const Number*>(args[i].get());
+		if(i > 0 && dynamic_cast<const DivisionFunction*>(form.get()) != nullptr && number->isFixnum() && number->getFixnum() == 0)
+			return nullptr;
+	}
+	return static_cast<const Lambda*>(form.get())->eval(nullptr, Heap::make<List>(args));
+}
+
+bool Optimizer::constantTest(const std::shared_ptr<Sexp>& exp, bool& value) const
+{
+	switch(exp->getKind())
+	{
+	case Kind::NUMBER:
+	case Kind::STRING:
+		value = true;
+		return true;
+	case Kind::SYMBOL:
+	case Kind::GLOBAL_VARIABLE:
+		{
+			int id = globalId(*exp);
+			if((id != SymbolTable::True && id != SymbolTable::False) || (exp->getKind() == Kind::SYMBOL && isLocal(id)))
+				return false;
+			value = id == SymbolTable::True;
+			return true;
+		}
+	default:
+		return false;
+	}
+}
+
+std::shared_ptr<Sexp> Optimizer::inlineCall(std::shared_ptr<Sexp> name, std::shared_ptr<Sexp> function, const std::vector<std::shared_ptr<Sexp>>& args)
+{
+	const Lambda* lambda = static_cast<const Lambda*>(function.get());
+	if(inlineDepth >= INLINE_DEPTH || lambda->getEnv().get() != global)
+		return nullptr;
+	for(int id : defining)
+	{
+		if(id == globalId(*name))
+			return nullptr;
+	}
+
+	std::shared_ptr<const std::vector<int>> params = Lambda::argumentIds(lambda->getArglist());
+	if(params->size() != args.size() || expressionSize(*lambda->getBody(), INLINE_SIZE) > INLINE_SIZE)
+		return nullptr;
+
+	Inlining inlining;
+	inlining.name = globalId(*name);
+	inlining.args = args;
+	inlining.params = params.get();
+	inlining.compiled = function->getKind() == Kind::COMPILED_CLOSURE;
+	inlining.uses.assign(args.size(), 0);
+	inlining.strictUses.assign(args.size(), 0);
+	inlining.firstUses.assign(args.size(), 0);
+	inlining.called = false;
+	std::shared_ptr<Sexp> expansion = substitute(lambda->getBody(), inlining, true);
+	if(expansion == nullptr)
+		return nullptr;
+
+	//the arguments that are not trivial are evaluated once, and before anything else has an effect:
+	// only one of them, used once, where it is always evaluated, before the body makes any call
+	// the globals passed before it are read after it in the expansion, it could redefine them
+	int evaluated = 0;
+	bool globalBefore = false;
+	for(size_t i = 0; i < args.size(); i++)
+	{
+		if(isTrivial(*args[i]))
+		{
+			globalBefore = globalBefore || (globalId(*args[i]) != -1 && !(args[i]->getKind() == Kind::SYMBOL && isLocal(globalId(*args[i]))));
+			continue;
+		}
+		if(inlining.uses[i] != 1 || inlining.strictUses[i] != 1 || inlining.firstUses[i] != 1 || globalBefore || ++evaluated > 1)
+			return nullptr;
+	}
+
+	inlineDepth++;
+	expansion = optimize(expansion);
+	inlineDepth--;
+
+	std::vector<std::shared_ptr<Sexp>> call{name};
+	call.insert(call.end(), args.begin(), args.end());
+	std::vector<std::shared_ptr<Sexp>> elements{guard, name, function, expansion, Heap::make<List>(call)};
+	return Heap::make<List>(elements);
+}
+
+std::shared_ptr<Sexp> Optimizer::substitute(const std::shared_ptr<Sexp>& exp, Inlining& inlining, bool strict) const
+{
+	switch(exp->getKind())
+	{
+	case Kind::LOCAL_VARIABLE:
+		{
+			//the function is global, without lambdas in its body: every local variable is its argument
+			const LocalVariable* variable = static_cast<const LocalVariable*>(exp.get());
+			if(inlining.compiled || variable->getDepth() != 0 || variable->getSlot() >= (int)inlining.args.size())
+				return nullptr;
+			inlining.uses[variable->getSlot()]++;
+			inlining.strictUses[variable->getSlot()] += strict;
+			inlining.firstUses[variable->getSlot()] += strict && !inlining.called;
+			return inlining.args[variable->getSlot()];
+		}
+	case Kind::SYMBOL:
+		{
+			int id = static_cast<const Symbol*>(exp.get())->getId();
+			if(inlining.compiled)
+			{
+				for(size_t slot = 0; slot < inlining.params->size(); slot++)
+				{
+					if((*inlining.params)[slot] != id)
+						continue;
+					inlining.uses[slot]++;
+					inlining.strictUses[slot] += strict;
+					inlining.firstUses[slot] += strict && !inlining.called;
+					return inlining.args[slot];
+				}
+			}
+			//a recursive function would be expanded again and again
+			if(id == inlining.name)
+				return nullptr;
+			//a global of the function, it must mean the same where the call is
+			if(isLocal(id))
+				return nullptr;
+			for(int name : defining)
+			{
+				if(name == id)
+					return nullptr;
+			}
+			return exp;
+		}
+	case Kind::GLOBAL_VARIABLE:
+		{
+			//resolved in the function already, it means the same where the call is
+			int id = globalId(*exp);
+			if(id == inlining.name)
+				return nullptr;
+			for(int name : defining)
+			{
+				if(name == id)
+					return nullptr;
+			}
+			return exp;
+		}
+	case Kind::LAMBDA_EXPRESSION:
+	case Kind::OPTIMIZED_BODY:
+		return nullptr;
+	case Kind::LIST:
+		break;
+	default:
+		return exp;
+	}
+
+	std::shared_ptr<List> list = std::static_pointer_cast<List>(exp);
+	if(list->Car() == nullptr)
+		return list;
+
+	//the head as the function sees it
+	std::shared_ptr<Sexp> form;
+	bool argument = list->Car()->getKind() == Kind::LOCAL_VARIABLE;
+	if(list->Car()->getKind() == Kind::GLOBAL_VARIABLE)
+		form = static_cast<const GlobalVariable*>(list->Car().get())->getCell()->value;
+	else if(list->Car()->getKind() == Kind::SYMBOL)
+	{
+		int id = static_cast<const Symbol*>(list->Car().get())->getId();
+		for(int param : *inlining.params)
+			argument = argument || (inlining.compiled && param == id);
+		if(!argument)
+			form = global->getValue(id);
+	}
+	//a list whose head is not a function evaluates to itself, with the arguments as written
+	// if the head is an argument, that is only known when the function is called
+	if(argument)
+		return nullptr;
+	if(list->Car() != guard && list->Car()->getKind() != Kind::LIST && (form == nullptr || !form->isLambda()))
+		return list;
+	//the variables they bind would need renaming
+	if(dynamic_cast<CreateLambda*>(form.get()) != nullptr || dynamic_cast<DefineFunction*>(form.get()) != nullptr)
+		return nullptr;
+
+	//the branches of if, and the alternatives of an inlined call are not always evaluated
+	int conditional = dynamic_cast<IfLambda*>(form.get()) != nullptr ? 2 : list->Car() == guard ? 3 : -1;
+	std::vector<std::shared_ptr<Sexp>> elements;
+	int index = 0;
+	for(auto s : *list)
+	{
+		std::shared_ptr<Sexp> element = substitute(s, inlining, strict && (conditional == -1 || index < conditional));
+		if(element == nullptr)
+			return nullptr;
+		elements.push_back(element);
+		index++;
+	}
+	//the arguments of a call are evaluated before it is made, what comes after them is evaluated after the call
+	inlining.called = true;
+	return Heap::make<List>(elements);
+}
@@ -0,0 +1,111 @@
+#include <memory>
+#include <vector>
+
+#include "scheme.h"
+
+
+
+
+#pragma once
+
+
+/**	(inlined name function expansion call) - a call of a global function the optimizer inlined
+ * 	evaluates expansion (the body of function with the arguments substituted) if name is still bound to function,
+ * 	and the original call otherwise, so redefining an inlined function takes effect right away */
+class InlinedCall : public SyntaxLambda
+{
+public:
+	InlinedCall(std::shared_ptr<Environment> env);
+
+	virtual std::shared_ptr<Sexp> eval(std::shared_ptr<Environment> context, std::shared_ptr<List> params) const;
+
+	/**	checks the binding, and leaves the expansion or the call in tail */
+	virtual std::shared_ptr<Sexp> evalTail(std::shared_ptr<Environment> context, std::shared_ptr<List> params, TailCall& tail) const;
+
+	void print(std::ostream &os) const;
+};
+
+/**	the body of a lambda expression (or of a function define) after the optimizer, together with the body as written
+ * 	it evaluates and prints as the optimized body, the closures made from the expression run that, and keep the other one to print */
+class OptimizedBody : public Sexp
+{
+	std::shared_ptr<Sexp> optimized;
+	std::shared_ptr<Sexp> source;
+public:
+	OptimizedBody(std::shared_ptr<Sexp> optimized, std::shared_ptr<Sexp> source);
+
+	std::shared_ptr<Sexp> getOptimized() const;
+	std::shared_ptr<Sexp> getSource() const;
+
+	/**	if body is an OptimizedBody: it is replaced by the optimized body, and the body as written is returned, nullptr otherwise */
+	static std::shared_ptr<Sexp> unwrap(std::shared_ptr<Sexp>& body);
+
+	std::shared_ptr<Sexp> eval(std::shared_ptr<Environment> context) const;
+	std::shared_ptr<Sexp> evalTail(std::shared_ptr<Environment> context, TailCall& tail) const;
+	void print(std::ostream &os) const;
+};
+
+/**	optimization pass over top level forms, before they are evaluated or compiled
+ * 	- calls of the arithmetic and compare primitives with constant arguments are folded: (* 60 60 24) is 86400
+ * 	- an if with a constant test is replaced by the branch it chooses
+ * 	- calls of small, non-recursive global functions (like not) are replaced by their body, guarded by an InlinedCall
+ * 	the optimized bodies of lambdas are wrapped in OptimizedBodies, so closures still print the way they were written
+ * 	like the open coded primitives of the bytecode compiler, folding uses the primitives bound when the form is optimized,
+ * 	redefining + only affects forms optimized later. Inlined functions are checked at every call (see InlinedCall) */
+class Optimizer
+{
+	Environment* global;
+	/**	the InlinedCall the expansions are guarded with */
+	std::shared_ptr<Sexp> guard;
+	/**	argument names of the enclosing lambdas, innermost first */
+	std::vector<const std::vector<int>*> scopes;
+	/**	the globals being defined by the enclosing defines, calls of them are not inlined */
+	std::vector<int> defining;
+	/**	number of inlined calls the form being optimized is in, expansions are optimized too, so this bounds mutual recursion */
+	int inlineDepth;
+
+	/**	functions with bodies of up to this many expressions are inlined */
+	enum : int {INLINE_SIZE = 24, INLINE_DEPTH = 4};
+
+	/**	the arguments of an inlined call, and how the body of the function uses them */
+	struct Inlining
+	{
+		/**	the global the function is bound to */
+		int name;
+		std::vector<std::shared_ptr<Sexp>> args;
+		/**	argument names of the function, compiled functions refer to them by symbols, the others by LocalVariables */
+		const std::vector<int>* params;
+		bool compiled;
+		std::vector<int> uses;
+		/**	uses that are evaluated every time the body is (not in a branch of an if) */
+		std::vector<int> strictUses;
+		/**	uses evaluated before any call of the body is made: only what the body evaluates before them is skipped when they are substituted */
+		std::vector<int> firstUses;
+		/**	a call of the body was made before the expression substitute is at, in the order of evaluation */
+		bool called;
+	};
+
+	bool isLocal(int id) const;
+	/**	the global binding of the head of a form, if it is not shadowed by a local variable */
+	std::shared_ptr<Sexp> globalForm(std::shared_ptr<Sexp> head) const;
+	/**	false if a form with head evaluates to itself: head is not a local variable, a call, or a global bound to a function (form) */
+	bool isCall(const std::shared_ptr<Sexp>& head, const Sexp* form) const;
+
+	std::shared_ptr<Sexp> optimizeList(std::shared_ptr<List> list);
+	/**	the optimized body of a lambda, in an OptimizedBody */
+	std::shared_ptr<Sexp> optimizeBody(std::shared_ptr<Sexp> body);
+	/**	the folded value of (form args...), nullptr if form is not an arithmetic or compare primitive, or an argument is not a number */
+	std::shared_ptr<Sexp> fold(const std::shared_ptr<Sexp>& form, const std::vector<std::shared_ptr<Sexp>>& args) const;
+	/**	false if exp is not a constant, value is its truth value otherwise */
+	bool constantTest(const std::shared_ptr<Sexp>& exp, bool& value) const;
+	/**	the guarded expansion of the call of function (the value of the global variable name) with args, nullptr if it can't be inlined */
+	std::shared_ptr<Sexp> inlineCall(std::shared_ptr<Sexp> name, std::shared_ptr<Sexp> function, const std::vector<std::shared_ptr<Sexp>>& args);
+	/**	the body of an inlined function with the arguments substituted, nullptr if it has something that can't be inlined */
+	std::shared_ptr<Sexp> substitute(const std::shared_ptr<Sexp>& exp, Inlining& inlining, bool strict) const;
+public:
+	/**	guard is the InlinedCall of the interpreter */
+	Optimizer(std::shared_ptr<Environment> global, std::shared_ptr<Sexp> guard);
+
+	/**	exp, or the optimized version of it */
+	std::shared_ptr<Sexp> optimize(std::shared_ptr<Sexp> exp);
+};
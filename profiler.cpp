@@ -0,0 +1,342 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <sys/time.h>
+
+#include "profiler.h"
+
+
+namespace
+{
+	thread_local Profiler* activeProfiler = nullptr;
+
+	/**	SIGPROF ticks not given to a function yet, the handler only increments it */
+	std::atomic<int> pendingSamples{0};
+	/**	the timer is process wide, so there is one sampling profiler at a time */
+	std::atomic<bool> samplingTimer{false};
+	struct sigaction previousHandler;
+
+	void onSample(int)
+	{
+		pendingSamples.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	bool startTimer()
+	{
+		bool expected = false;
+		if(!samplingTimer.compare_exchange_strong(expected, true))
+			return false;
+		pendingSamples = 0;
+		struct sigaction action{};
+		action.sa_handler = onSample;
+		//the REPL reads the standard input meanwhile
+		action.sa_flags = SA_RESTART;
+		sigemptyset(&action.sa_mask);
+		sigaction(SIGPROF, &action, &previousHandler);
+		itimerval timer{{0, Profiler::SAMPLE_MICROSECONDS}, {0, Profiler::SAMPLE_MICROSECONDS}};
+		setitimer(ITIMER_PROF, &timer, nullptr);
+		return true;
+	}
+
+	void stopTimer()
+	{
+		itimerval timer{{0, 0}, {0, 0}};
+		setitimer(ITIMER_PROF, &timer, nullptr);
+		sigaction(SIGPROF, &previousHandler, nullptr);
+		samplingTimer = false;
+	}
+
+	int64_t now()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	const char* const TOP_LEVEL = "(top level)";
+}
+
+
+//Profiler
+
+Profiler::Profiler(Mode mode) : mode{mode}, root{nullptr, nullptr, {}, 0, 0}, start{0}, elapsed{0} {}
+
+Profiler* Profiler::active()
+{
+	return activeProfiler;
+}
+
+Profiler::Function* Profiler::function(const Lambda* lambda)
+{
+	std::unique_ptr<Function>& function = functions[lambda->getBody().get()];
+	if(function == nullptr)
+		function.reset(new Function{name(lambda), 0, 0, 0, 0, 0, 0, 0});
+	return function.get();
+}
+
+std::string Profiler::name(const Lambda* lambda) const
+{
+	Environment* global = lambda->getEnv().get();
+	while(global != nullptr && global->getParent() != nullptr)
+		global = global->getParent();
+	if(global != nullptr)
+	{
+		for(const auto& binding : global->getVariables())
+		{
+			if(binding.second->isLambda() && static_cast<const Lambda*>(binding.second.get())->getBody() == lambda->getBody())
+				return SymbolTable::name(binding.first);
+		}
+	}
+	std::ostringstream os;
+	os << "(lambda ";
+	if(lambda->getArglist() != nullptr)
+		os << *lambda->getArglist();
+	else
+		os << "()";
+	os << ")";
+	if(!stack.empty())
+		os << " in " << stack.back().node->function->name;
+	return os.str();
+}
+
+void Profiler::takeSamples()
+{
+	if(mode != Mode::SAMPLING || pendingSamples.load(std::memory_order_relaxed) == 0)
+		return;
+	int samples = pendingSamples.exchange(0);
+	Node& node = stack.empty() ? root : *stack.back().node;
+	node.samples += samples;
+	if(node.function != nullptr)
+		node.function->samples += samples;
+}
+
+void Profiler::enter(const Lambda* lambda)
+{
+	takeSamples();
+	Node& parent = stack.empty() ? root : *stack.back().node;
+	Function* called = function(lambda);
+	std::unique_ptr<Node>& node = parent.children[called];
+	if(node == nullptr)
+		node.reset(new Node{called, &parent, {}, 0, 0});
+	called->calls++;
+	called->active++;
+	Frame frame{node.get(), 0, 0, 0, 0};
+	if(mode == Mode::EXACT)
+	{
+		frame.bytes = Heap::getStats().allocatedBytes;
+		frame.start = now();
+	}
+	stack.push_back(frame);
+}
+
+void Profiler::exit()
+{
+	takeSamples();
+	Frame frame = stack.back();
+	stack.pop_back();
+	Function& returning = *frame.node->function;
+	returning.active--;
+	if(mode != Mode::EXACT)
+		return;
+	int64_t inclusive = now() - frame.start;
+	size_t bytes = Heap::getStats().allocatedBytes - frame.bytes;
+	int64_t exclusive = inclusive - frame.childNanoseconds;
+	returning.exclusiveNanoseconds += exclusive;
+	returning.exclusiveBytes += bytes - frame.childBytes;
+	frame.node->exclusiveNanoseconds += exclusive;
+	if(returning.active == 0)
+	{
+		returning.inclusiveNanoseconds += inclusive;
+		returning.inclusiveBytes += bytes;
+	}
+	if(!stack.empty())
+	{
+		stack.back().childNanoseconds += inclusive;
+		stack.back().childBytes += bytes;
+	}
+	else
+		root.exclusiveNanoseconds -= inclusive;
+}
+
+size_t Profiler::depth() const
+{
+	return stack.size();
+}
+
+void Profiler::unwind(size_t depth)
+{
+	while(stack.size() > depth)
+		exit();
+}
+
+void Profiler::report(std::ostream& os) const
+{
+	//the closures with the same name (redefined ones) are reported together
+	std::map<std::string, Function> byName;
+	for(const auto& entry : functions)
+	{
+		const Function& f = *entry.second;
+		Function& total = byName.emplace(f.name, Function{f.name, 0, 0, 0, 0, 0, 0, 0}).first->second;
+		total.calls += f.calls;
+		total.inclusiveNanoseconds += f.inclusiveNanoseconds;
+		total.exclusiveNanoseconds += f.exclusiveNanoseconds;
+		total.inclusiveBytes += f.inclusiveBytes;
+		total.exclusiveBytes += f.exclusiveBytes;
+		total.samples += f.samples;
+	}
+	std::vector<Function> sorted;
+	sorted.push_back(Function{TOP_LEVEL, 0, 0, elapsed, elapsed + root.exclusiveNanoseconds, 0, 0, root.samples});
+	for(const auto& entry : byName)
+		sorted.push_back(entry.second);
+	std::sort(sorted.begin(), sorted.end(), [this](const Function& left, const Function& right)
+	{
+		return mode == Mode::EXACT ? left.exclusiveNanoseconds > right.exclusiveNanoseconds : left.samples > right.samples;
+	});
+
+	size_t width = 12;
+	for(const Function& f : sorted)
+		width = std::max(width, std::min<size_t>(f.name.size() + 2, 48));
+	size_t totalSamples = 0;
+	for(const Function& f : sorted)
+		totalSamples += f.samples;
+
+	std::ios::fmtflags flags = os.flags();
+	os << std::fixed << std::setprecision(3) << std::left << std::setw(width) << "function" << std::right << std::setw(12) << "calls";
+	if(mode == Mode::EXACT)
+		os << std::setw(12) << "incl ms" << std::setw(12) << "excl ms" << std::setw(8) << "excl %" << std::setw(12) << "incl KB" << std::setw(12) << "excl KB" << "\n";
+	else
+		os << std::setw(12) << "samples" << std::setw(8) << "%" << std::setw(12) << "~ms" << "\n";
+	for(const Function& f : sorted)
+	{
+		os << std::left << std::setw(width) << f.name.substr(0, width - 2) << std::right << std::setw(12) << f.calls;
+		if(mode == Mode::EXACT)
+		{
+			os << std::setw(12) << f.inclusiveNanoseconds / 1e6 << std::setw(12) << f.exclusiveNanoseconds / 1e6
+				<< std::setw(8) << std::setprecision(1) << (elapsed > 0 ? 100.0 * f.exclusiveNanoseconds / elapsed : 0) << std::setprecision(3)
+				<< std::setw(12) << f.inclusiveBytes / 1024 << std::setw(12) << f.exclusiveBytes / 1024 << "\n";
+		}
+		else
+		{
+			os << std::setw(12) << f.samples << std::setw(8) << std::setprecision(1) << (totalSamples > 0 ? 100.0 * f.samples / totalSamples : 0)
+				<< std::setprecision(3) << std::setw(12) << (totalSamples > 0 ? elapsed / 1e6 * f.samples / totalSamples : 0) << "\n";
+		}
+	}
+	os << "total " << elapsed / 1e6 << " ms";
+	if(mode == Mode::SAMPLING)
+		os << ", " << totalSamples << " samples";
+	os << "\n";
+	os.flags(flags);
+}
+
+void Profiler::writeCollapsed(std::ostream& os, const Node& node, std::string& path) const
+{
+	size_t length = path.size();
+	path += node.function == nullptr ? TOP_LEVEL : ";" + node.function->name;
+	int64_t weight = mode == Mode::EXACT ? node.exclusiveNanoseconds / 1000 : node.samples;
+	if(node.function == nullptr && mode == Mode::EXACT)
+		weight = (elapsed + node.exclusiveNanoseconds) / 1000;
+	if(weight > 0)
+		os << path << " " << weight << "\n";
+	for(const auto& child : node.children)
+		writeCollapsed(os, *child.second, path);
+	path.resize(length);
+}
+
+void Profiler::writeCollapsed(std::ostream& os) const
+{
+	std::string path;
+	writeCollapsed(os, root, path);
+}
+
+bool Profiler::writeCollapsed(const std::string& path) const
+{
+	std::ofstream out{path};
+	writeCollapsed(out);
+	if(!out)
+	{
+		loge << "can't write the profile to " << path << "\n";
+		return false;
+	}
+	return true;
+}
+
+
+//Profiler::Scope
+
+Profiler::Scope::Scope(Profiler* profiler) : previous{activeProfiler}, sampling{false}
+{
+	activeProfiler = profiler;
+	if(profiler == nullptr)
+		return;
+	if(profiler->mode == Mode::SAMPLING)
+	{
+		sampling = startTimer();
+		if(!sampling)
+			loge << "a sampling profiler is running already, samples are not taken\n";
+	}
+	profiler->start = now();
+}
+
+Profiler::Scope::~Scope()
+{
+	Profiler* profiler = activeProfiler;
+	activeProfiler = previous;
+	if(profiler == nullptr)
+		return;
+	profiler->takeSamples();
+	if(sampling)
+		stopTimer();
+	profiler->elapsed += now() - profiler->start;
+}
+
+
+//ProfileSyntax
+// (profile exp [file]), (profile-sample exp [file])
+
+ProfileSyntax::ProfileSyntax(std::shared_ptr<Environment> env, Profiler::Mode mode) : SyntaxLambda{env}, mode{mode} {}
+
+std::shared_ptr<Sexp> ProfileSyntax::eval(std::shared_ptr<Environment> context, std::shared_ptr<List> params) const
+{
+	size_t argc = params->size();
+	if(argc != 1 && argc != 2)
+	{
+		loge << "wrong number of arguments for " << *this << ". (Expected: 1 or 2, got: " << argc << ")\n";
+		return nullptr;
+	}
+	std::string path;
+	if(argc == 2)
+	{
+		std::shared_ptr<Sexp> file = params->Cdr()->Car()->eval(context);
+		if(file == nullptr || file->getKind() != Kind::STRING)
+		{
+			loge << *this << " expects a file name string\n";
+			return nullptr;
+		}
+		path = static_cast<String*>(file.get())->getValue();
+	}
+
+	Profiler profiler{mode};
+	std::shared_ptr<Sexp> result;
+	{
+		Profiler::Scope scope{&profiler};
+		result = TailCall::run(params->Car(), context);
+	}
+	profiler.report(std::cout);
+	if(!path.empty())
+		profiler.writeCollapsed(path);
+	return result;
+}
+
+void ProfileSyntax::print(std::ostream &os) const
+{
+	os << (mode == Profiler::Mode::EXACT ? "profile" : "profile-sample");
+}
+
+void ProfileSyntax::defineAll(std::shared_ptr<Environment> global)
+{
+	global->bindArg("profile", Heap::make<ProfileSyntax>(global, Profiler::Mode::EXACT));
+	global->bindArg("profile-sample", Heap::make<ProfileSyntax>(global, Profiler::Mode::SAMPLING));
+}
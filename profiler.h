@@ -0,0 +1,133 @@
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "scheme.h"
+
+
+
+
+#pragma once
+
+
+/**	Profiler: call counts, time and allocations of the closures called on the thread while it is the active one
+ * 	(profile exp) and the --profile flag of main use it
+ * 	the closures made from the same lambda expression are counted together, named after the global variable bound to one of them,
+ * 	or (lambda (args)) in the function that first called one
+ * 	the evaluators tell it when a closure is entered and left: the tree walking evaluator in the TailCall loop that runs its body,
+ * 	the VM at its calls and returns - a tail call leaves the caller, so the callee is counted as called by the caller's caller
+ * 	calls the optimizer inlined are counted in the function they were inlined into, and the futures are not profiled
+ * 	- EXACT measures the inclusive and exclusive wall time and allocated bytes (see HeapStats) at every call and return
+ * 	- SAMPLING only counts the calls, a SIGPROF timer counts samples every SAMPLE_MICROSECONDS of CPU time (or the tick of the kernel if it is longer),
+ * 	  which are given to the function running at the next call or return, so it costs less, but loops without calls are seen at their end
+ * 	  the time of a function is estimated from its share of the samples */
+class Profiler
+{
+public:
+	enum class Mode : unsigned char {EXACT, SAMPLING};
+
+	enum : int {SAMPLE_MICROSECONDS = 1000};
+
+private:
+	struct Function
+	{
+		std::string name;
+		size_t calls;
+		/**	its frames on the stack: inclusive time and bytes are only added when the outermost one returns, so recursion doesn't count them twice */
+		size_t active;
+		int64_t inclusiveNanoseconds;
+		int64_t exclusiveNanoseconds;
+		size_t inclusiveBytes;
+		size_t exclusiveBytes;
+		size_t samples;
+	};
+
+	/**	node of the calling context tree: a function called along a path of calls from the top level (the root) */
+	struct Node
+	{
+		Function* function;
+		Node* parent;
+		std::unordered_map<const Function*, std::unique_ptr<Node>> children;
+		int64_t exclusiveNanoseconds;
+		size_t samples;
+	};
+
+	struct Frame
+	{
+		Node* node;
+		int64_t start;
+		size_t bytes;
+		int64_t childNanoseconds;
+		size_t childBytes;
+	};
+
+	Mode mode;
+	/**	keyed by the body of the closures */
+	std::unordered_map<const Sexp*, std::unique_ptr<Function>> functions;
+	Node root;
+	std::vector<Frame> stack;
+	int64_t start;
+	int64_t elapsed;
+
+	Function* function(const Lambda* lambda);
+	std::string name(const Lambda* lambda) const;
+	/**	gives the samples taken since the last call or return to the function running meanwhile */
+	void takeSamples();
+	void writeCollapsed(std::ostream& os, const Node& node, std::string& path) const;
+
+public:
+	Profiler(Mode mode);
+	Profiler(const Profiler&) = delete;
+	Profiler& operator=(const Profiler&) = delete;
+
+	/**	the profiler of the calling thread, nullptr if it is not profiled */
+	static Profiler* active();
+
+	/**	makes profiler the active one of the calling thread while the Scope exists, and runs the sampling timer meanwhile
+	 * 	only one sampling profiler can be active in the process, a second one is not started (the error is logged) */
+	class Scope
+	{
+		Profiler* previous;
+		bool sampling;
+	public:
+		Scope(Profiler* profiler);
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+		~Scope();
+	};
+
+	/**	a closure is called */
+	void enter(const Lambda* lambda);
+	/**	the closure called last returns */
+	void exit();
+	/**	number of closures on the stack */
+	size_t depth() const;
+	/**	returns from the closures above depth */
+	void unwind(size_t depth);
+
+	/**	the table of the functions, the most expensive first */
+	void report(std::ostream& os) const;
+	/**	the stacks in the collapsed format of flame graph tools ("top level;f;g 120"), weighted by microseconds (EXACT) or samples */
+	void writeCollapsed(std::ostream& os) const;
+	/**	writeCollapsed to a file, false if it can't be written (the error is logged) */
+	bool writeCollapsed(const std::string& path) const;
+};
+
+
+/**	(profile exp [file]) and (profile-sample exp [file]) - evaluates exp with a Profiler, prints its report and returns the value of exp
+ * 	the collapsed stacks are written to file if it is given */
+class ProfileSyntax : public SyntaxLambda
+{
+	Profiler::Mode mode;
+public:
+	ProfileSyntax(std::shared_ptr<Environment> env, Profiler::Mode mode);
+
+	virtual std::shared_ptr<Sexp> eval(std::shared_ptr<Environment> context, std::shared_ptr<List> params) const;
+	void print(std::ostream &os) const;
+
+	/**	binds profile and profile-sample in global */
+	static void defineAll(std::shared_ptr<Environment> global);
+};
@@ -1,68 +1,254 @@
 #include <map>
 #include <cstdlib>
-#include <sstream>
 
 #include "scheme.h"
-
-//setting debug level
-LogSettings Log{LogLevel::ERROR};
-
+#include "bytecode.h"
+#include "typedvector.h"
+#include "image.h"
+#include "optimizer.h"
+#include "memo.h"
+#include "future.h"
+#include "profiler.h"
+#include "trace.h"
+#include "continuation.h"
 
 ErrorLog logerror;
 DebugLog logdebug;
 
 
 ErrorLogProxy loge;
-DebugLogProxy logd;
 
 
 
 //S-expression or "symbolic expression"
+Sexp::Sexp(Kind kind) : kind{kind} {}
+
 Sexp::~Sexp() {}
 
 Sexp::operator bool() const {return true;}
 
+std::shared_ptr<Sexp> Sexp::evalTail(std::shared_ptr<Environment> context, TailCall& tail) const
+{
+	return eval(context);
+}
+
+
+//TailCall
+TailCall::TailCall(std::shared_ptr<Sexp> exp, std::shared_ptr<Environment> context, const Lambda* callee) : exp{std::move(exp)}, context{std::move(context)}, callee{callee} {}
+
+std::shared_ptr<Sexp> TailCall::run(std::shared_ptr<Sexp> exp, std::shared_ptr<Environment> context, const Lambda* callee)
+{
+	TailCall tail{exp, context, callee};
+	std::shared_ptr<Sexp> result;
+	//the closures called in the loop replace each other on the stack of the profiler
+	Profiler* profiler = Profiler::active();
+	size_t depth = profiler != nullptr ? profiler->depth() : 0;
+	do
+	{
+		//moved out, so the previous frame can be freed when the next one replaces it
+		exp = std::move(tail.exp);
+		context = std::move(tail.context);
+		tail.exp = nullptr;
+		if(profiler != nullptr && tail.callee != nullptr)
+		{
+			profiler->unwind(depth);
+			profiler->enter(tail.callee);
+		}
+		tail.callee = nullptr;
+		//everything in use is held by shared_ptrs here, so it's a safe point for the collector
+		Heap::collectIfNeeded();
+		result = exp->evalTail(context, tail);
+	}
+	while(tail.exp != nullptr);
+	if(profiler != nullptr)
+		profiler->unwind(depth);
+	return result;
+}
+
+
+//SymbolTable
+SymbolTable::SymbolTable()
+{
+	//the order has to match the enum in the header
+	ids["#f"] = False;
+	names.push_back("#f");
+	ids["#t"] = True;
+	names.push_back("#t");
+}
+
+SymbolTable& SymbolTable::instance()
+{
+	static SymbolTable table;
+	return table;
+}
+
+int SymbolTable::intern(const std::string& name)
+{
+	SymbolTable& table = instance();
+	std::lock_guard<std::recursive_mutex> lock{table.mutex};
+	auto it = table.ids.find(name);
+	if(it != table.ids.end())
+		return it->second;
+	int id = table.names.size();
+	table.names.push_back(name);
+	table.ids[name] = id;
+	return id;
+}
+
+const std::string& SymbolTable::name(int id)
+{
+	SymbolTable& table = instance();
+	std::lock_guard<std::recursive_mutex> lock{table.mutex};
+	return table.names[id];
+}
+
+std::shared_ptr<Symbol> SymbolTable::symbol(int id)
+{
+	SymbolTable& table = instance();
+	std::lock_guard<std::recursive_mutex> lock{table.mutex};
+	if(table.symbols.size() <= (size_t)id)
+		table.symbols.resize(table.names.size());
+	if(table.symbols[id] == nullptr)
+		table.symbols[id] = std::make_shared<Symbol>(id);
+	return immortal(table.symbols[id]);
+}
+
+size_t SymbolTable::count()
+{
+	SymbolTable& table = instance();
+	std::lock_guard<std::recursive_mutex> lock{table.mutex};
+	return table.names.size();
+}
 
-Environment::Environment(std::shared_ptr<Environment> parent, std::vector<std::string> names, std::shared_ptr<List> values) : parent{parent}
+size_t SymbolTable::bytes()
 {
-	if(values == nullptr) return;
+	SymbolTable& table = instance();
+	std::lock_guard<std::recursive_mutex> lock{table.mutex};
+	size_t bytes = 0;
+	for(const std::string& name : table.names)
+		bytes += sizeof(std::string) + name.capacity();
+	for(const std::shared_ptr<Symbol>& symbol : table.symbols)
+		if(symbol != nullptr)
+			bytes += sizeof(Symbol);
+	return bytes;
+}
 
-	if(names.size() > values->size())
+
+Environment::Environment(std::shared_ptr<Environment> parent, std::shared_ptr<const std::vector<int>> names)
+	: parent{parent}, names{names}, slots{inlineSlots}, slotCount{0}
+{
+	if(parent == nullptr)
+		variablesMutex.reset(new std::mutex());
+	if(names == nullptr) return;
+	slotCount = names->size();
+	if(slotCount > INLINE_SLOTS)
 	{
-		loge << "more names than values for environment bindings";
-		return;
+		extraSlots.reset(new std::shared_ptr<Sexp>[slotCount]);
+		slots = extraSlots.get();
 	}
-	//create bindings
-	int i = 0;
-	for(auto s : *values)
+}
+
+void Environment::bindArg(int id, std::shared_ptr<Sexp> val)
+{
+	if(names != nullptr)
 	{
-		if(i >= names.size())
-			break;
-		
-		std::shared_ptr<Sexp> valEval = s->eval(parent);
-		bindArg(names[i], valEval);
-		logd << " environment binding " << names[i] << " to " << *valEval << "\n";
-		i++;
+		for(size_t i = 0; i < names->size(); i++)
+		{
+			if((*names)[i] == id)
+			{
+				slots[i] = val;
+				return;
+			}
+		}
 	}
+	getCell(id)->value = std::move(val);
 }
 
-void Environment::bindArg(std::string name, std::shared_ptr<Sexp> val)
+void Environment::bindArg(const std::string& name, std::shared_ptr<Sexp> val)
 {
-	variables[name] = val;
+	bindArg(SymbolTable::intern(name), val);
 }
 
-std::shared_ptr<Sexp> Environment::getValue(std::string name)
+std::shared_ptr<Sexp> Environment::getValue(int id)
 {
 	Environment* env = this;
 	while(env != nullptr)
 	{
-		if(env->variables.count(name) == 1)
-			return env->variables[name];
+		if(env->names != nullptr)
+		{
+			const std::vector<int>& frameNames = *env->names;
+			for(size_t i = 0; i < frameNames.size(); i++)
+			{
+				if(frameNames[i] == id)
+					return env->slots[i];
+			}
+		}
+		if(env->variablesMutex != nullptr)
+		{
+			std::lock_guard<std::mutex> lock{*env->variablesMutex};
+			auto it = env->variables.find(id);
+			if(it != env->variables.end())
+				return it->second->value;
+		}
 		env = env->parent.get();
 	}
 	return nullptr;
 }
 
+std::shared_ptr<Sexp> Environment::getValue(const std::string& name)
+{
+	return getValue(SymbolTable::intern(name));
+}
+
+const std::shared_ptr<Sexp>& Environment::getSlot(int depth, int slot) const
+{
+	const Environment* env = this;
+	for(int i = 0; i < depth; i++)
+		env = env->parent.get();
+	return env->slots[slot];
+}
+
+void Environment::setSlot(int slot, std::shared_ptr<Sexp> val)
+{
+	slots[slot] = std::move(val);
+}
+
+size_t Environment::getSlotCount() const
+{
+	return slotCount;
+}
+
+Environment* Environment::getParent() const
+{
+	return parent.get();
+}
+
+const std::vector<int>* Environment::getNames() const
+{
+	return names.get();
+}
+
+const std::shared_ptr<GlobalCell>& Environment::getCell(int id)
+{
+	std::lock_guard<std::mutex> lock{*variablesMutex};
+	std::shared_ptr<GlobalCell>& cell = variables[id];
+	if(cell == nullptr)
+		cell = std::make_shared<GlobalCell>(GlobalCell{id, nullptr});
+	return cell;
+}
+
+std::unordered_map<int, std::shared_ptr<Sexp>> Environment::getVariables() const
+{
+	std::unordered_map<int, std::shared_ptr<Sexp>> bindings;
+	std::lock_guard<std::mutex> lock{*variablesMutex};
+	for(const auto& kv : variables)
+	{
+		if(kv.second->value != nullptr)
+			bindings[kv.first] = kv.second->value;
+	}
+	return bindings;
+}
+
 void Environment::print(std::ostream& os) const
 {
 	const Environment* env = this;
@@ -78,23 +264,66 @@ void Environment::print(std::ostream& os) const
 	{
 		for (auto& kv : (*it)->variables)
 		{
-			os << " " << kv.first << " : " << *kv.second << std::endl;
+			if(kv.second->value != nullptr)
+				os << " " << SymbolTable::name(kv.first) << " : " << *kv.second->value << std::endl;
+		}
+		if((*it)->names == nullptr)
+			continue;
+		for (size_t i = 0; i < (*it)->slotCount; i++)
+		{
+			os << " " << SymbolTable::name((*(*it)->names)[i]) << " : ";
+			if((*it)->slots[i] != nullptr)
+				os << *(*it)->slots[i];
+			os << std::endl;
 		}
 	}
 }
 
-void Environment::clearFunctionReferences()
+void addReference(References& references, const std::shared_ptr<Sexp>& s)
 {
-	for (auto& kv : variables)
-	{
-		std::shared_ptr<Sexp> s = kv.second;
-		std::shared_ptr<Lambda> l = std::dynamic_pointer_cast<Lambda>(s);
-		if(l != nullptr)
-			l->clearEnv();
-	}
+	if(s == nullptr)
+		return;
+	if(s->getKind() == Kind::LIST)
+		references.push_back(static_cast<List*>(s.get()));
+	else if(s->isLambda())
+		references.push_back(static_cast<Lambda*>(s.get()));
+	else if(s->getKind() == Kind::FUTURE)
+		references.push_back(static_cast<Future*>(s.get()));
+}
+
+std::shared_ptr<void> Environment::sharedFromThis()
+{
+	return shared_from_this();
+}
+
+void Environment::traverse(References& references) const
+{
+	if(parent != nullptr)
+		references.push_back(parent.get());
+	for(const auto& kv : variables)
+		addReference(references, kv.second->value);
+	for(size_t i = 0; i < slotCount; i++)
+		addReference(references, slots[i]);
+}
+
+void Environment::clearReferences()
+{
+	parent = nullptr;
+	//the cells may outlive the environment in the references resolved to them
+	for(const auto& kv : variables)
+		kv.second->value = nullptr;
+	variables.clear();
+	for(size_t i = 0; i < slotCount; i++)
+		slots[i] = nullptr;
+}
+
+size_t Environment::gcSize() const
+{
+	//the map nodes hold a key, a value and a link
+	return sizeof(*this) + (extraSlots != nullptr ? slotCount * sizeof(std::shared_ptr<Sexp>) : 0)
+		+ variables.size() * (sizeof(int) + sizeof(std::shared_ptr<GlobalCell>) + sizeof(GlobalCell) + sizeof(void*));
 }
 
-Environment* Environment::Global = nullptr;
 
 
 std::ostream& operator<<(std::ostream& os, const Environment& e)
@@ -112,24 +341,74 @@ std::ostream& operator<<(std::ostream& os, const Sexp& e)
 
 
 //Atom
+Atom::Atom(Kind kind) : Sexp{kind} {}
+
 Atom::~Atom(){}
 
 
 //Number
-Number::Number(int val) : value{val} {}
-std::shared_ptr<Sexp> Number::eval(std::shared_ptr<Environment> context) const
+Number::Number(int64_t val) : Atom{Kind::NUMBER}, value{val} {}
+
+Number::Number(BigInt val) : Atom{Kind::NUMBER}, value{0}, big{new BigInt(std::move(val))} {}
+
+std::shared_ptr<Number> Number::make(int64_t val)
 {
-	return std::make_shared<Number>(value);
+	static const std::vector<std::shared_ptr<Number>> owners = []
+	{
+		std::vector<std::shared_ptr<Number>> numbers;
+		numbers.reserve(CACHE_MAX - CACHE_MIN + 1);
+		for(int i = CACHE_MIN; i <= CACHE_MAX; i++)
+			numbers.push_back(std::make_shared<Number>(i));
+		return numbers;
+	}();
+	static const std::vector<std::shared_ptr<Number>> cache = []
+	{
+		std::vector<std::shared_ptr<Number>> handles;
+		handles.reserve(owners.size());
+		for(const std::shared_ptr<Number>& number : owners)
+			handles.push_back(immortal(number));
+		return handles;
+	}();
+	if(val >= CACHE_MIN && val <= CACHE_MAX)
+		return cache[val - CACHE_MIN];
+	return Heap::make<Number>(val);
 }
-void Number::print(std::ostream &os) const
+
+std::shared_ptr<Number> Number::make(BigInt val)
 {
-	std::cout << value;
+	if(val.fitsInt64())
+		return make(val.toInt64());
+	return Heap::make<Number>(std::move(val));
 }
 
-Number::operator int()
+std::shared_ptr<Number> Number::parse(const std::string& text)
 {
-	return value;
+	BigInt val;
+	if(!BigInt::parse(text, val))
+		return nullptr;
+	return make(std::move(val));
 }
+
+BigInt Number::toBigInt() const
+{
+	return big != nullptr ? *big : BigInt{value};
+}
+
+std::shared_ptr<Sexp> Number::eval(std::shared_ptr<Environment> context) const
+{
+	//shared_from_this would count the reference in the owner of a cached number
+	if(big == nullptr && value >= CACHE_MIN && value <= CACHE_MAX)
+		return make(value);
+	return std::const_pointer_cast<Sexp>(shared_from_this());
+}
+void Number::print(std::ostream &os) const
+{
+	if(big != nullptr)
+		os << *big;
+	else
+		os << value;
+}
+
 Number::~Number()
 {
 	
@@ -140,28 +419,44 @@ Number::~Number()
 
 //Symbol
 
-Symbol::Symbol(std::string Name) : Name{Name} {}
+Symbol::Symbol(int id) : Atom{Kind::SYMBOL}, id{id}, Name{&SymbolTable::name(id)} {}
+
+std::shared_ptr<Symbol> Symbol::intern(const std::string& name)
+{
+	return SymbolTable::symbol(SymbolTable::intern(name));
+}
+
+const std::shared_ptr<Symbol>& Symbol::boolean(bool value)
+{
+	static const std::shared_ptr<Symbol> t = SymbolTable::symbol(SymbolTable::True);
+	static const std::shared_ptr<Symbol> f = SymbolTable::symbol(SymbolTable::False);
+	return value ? t : f;
+}
 
-std::string Symbol::getName() const
+int Symbol::getId() const
+{
+	return id;
+}
+const std::string& Symbol::getName() const
 {
-	return Name;
+	return *Name;
 }
 void Symbol::print(std::ostream &os) const
 {
-	os << Name;
+	os << *Name;
 }
 	
 std::shared_ptr<Sexp> Symbol::eval(std::shared_ptr<Environment> context) const
 {
-	std::shared_ptr<Sexp> exp = context->getValue(Name);
+	std::shared_ptr<Sexp> exp = context->getValue(id);
 	if(exp == nullptr)
-		loge << "variable " << Name << " is unbound\n";
+		loge << "variable " << *Name << " is unbound\n";
 	return exp;
 }
 
 Symbol::operator bool() const
 {
-	return Name != "#f";
+	return id != SymbolTable::False;
 }
 
 Symbol::~Symbol()
@@ -170,22 +465,111 @@ Symbol::~Symbol()
 }
 
 
+//String
+
+String::String(std::string value) : Atom{Kind::STRING}, value{std::move(value)} {}
+
+const std::string& String::getValue() const
+{
+	return value;
+}
+
+std::shared_ptr<Sexp> String::eval(std::shared_ptr<Environment> context) const
+{
+	return std::const_pointer_cast<Sexp>(shared_from_this());
+}
+
+void String::print(std::ostream &os) const
+{
+	os << '"';
+	for(char c : value)
+	{
+		if(c == '"' || c == '\\')
+			os << '\\';
+		os << c;
+	}
+	os << '"';
+}
+
+
+//LocalVariable
+
+LocalVariable::LocalVariable(int id, int depth, int slot) : Atom{Kind::LOCAL_VARIABLE}, id{id}, depth{depth}, slot{slot} {}
+
+int LocalVariable::getId() const
+{
+	return id;
+}
+
+int LocalVariable::getDepth() const
+{
+	return depth;
+}
+
+int LocalVariable::getSlot() const
+{
+	return slot;
+}
+
+std::shared_ptr<Sexp> LocalVariable::eval(std::shared_ptr<Environment> context) const
+{
+	const std::shared_ptr<Sexp>& exp = context->getSlot(depth, slot);
+	if(exp == nullptr)
+		loge << "variable " << SymbolTable::name(id) << " is unbound\n";
+	return exp;
+}
+
+void LocalVariable::print(std::ostream &os) const
+{
+	os << SymbolTable::name(id);
+}
+
+
+//GlobalVariable
+
+GlobalVariable::GlobalVariable(std::shared_ptr<GlobalCell> cell) : Atom{Kind::GLOBAL_VARIABLE}, cell{cell} {}
+
+int GlobalVariable::getId() const
+{
+	return cell->id;
+}
+
+const std::shared_ptr<GlobalCell>& GlobalVariable::getCell() const
+{
+	return cell;
+}
+
+std::shared_ptr<Sexp> GlobalVariable::eval(std::shared_ptr<Environment> context) const
+{
+	if(cell->value == nullptr)
+		loge << "variable " << SymbolTable::name(cell->id) << " is unbound\n";
+	return cell->value;
+}
+
+void GlobalVariable::print(std::ostream &os) const
+{
+	os << SymbolTable::name(cell->id);
+}
+
+
 
 //List
 
 List::List(std::shared_ptr<Sexp> car, std::shared_ptr<List> cdr)
-: car{car}, cdr{cdr}
+: Sexp{Kind::LIST}, car{car}, cdr{cdr}
 {
 	
 }
-List::List(std::vector<std::shared_ptr<Sexp>> elements)
+List::List(std::vector<std::shared_ptr<Sexp>> elements) : List{elements.data(), elements.size()} {}
+
+List::List(const std::shared_ptr<Sexp>* elements, size_t count) : Sexp{Kind::LIST}
 {
 	std::shared_ptr<List> last = nullptr;
-	for(int i = elements.size() - 1; i >= 1; i--)
+	for(int i = (int)count - 1; i >= 1; i--)
 	{
-		last = std::make_shared<List>(elements[i], last);
+		last = Heap::make<List>(elements[i], last);
 	}
-	if(elements.size() > 0)
+	if(count > 0)
 	{
 		car = elements[0];
 		cdr = last;
@@ -238,25 +622,47 @@ void List::print(std::ostream &os) const
 
 std::shared_ptr<Sexp> List::eval(std::shared_ptr<Environment> context) const
 {
-	logd << "list eval: " << *this << "\n";
+	TailCall tail;
+	std::shared_ptr<Sexp> result = evalTail(context, tail);
+	if(tail.exp != nullptr)
+		return TailCall::run(tail.exp, tail.context, tail.callee);
+	return result;
+}
+
+std::shared_ptr<Sexp> List::evalTail(std::shared_ptr<Environment> context, TailCall& tail) const
+{
+	SCHEME_TRACE(LIST_EVAL, Kind::LIST, this, car == nullptr ? -1 : car->getKind() == Kind::SYMBOL ? static_cast<const Symbol*>(car.get())->getId()
+		: car->getKind() == Kind::GLOBAL_VARIABLE ? static_cast<const GlobalVariable*>(car.get())->getId() : -1, 0);
 	
+	//the empty list evaluates to itself
 	if(car == nullptr)
 	{
-		return std::make_shared<List>();
+		return std::const_pointer_cast<Sexp>(shared_from_this());
 	}
 	
 	std::shared_ptr<Sexp> exp;
-	if(Symbol* first = dynamic_cast<Symbol*>(car.get()))
+	if(car->getKind() == Kind::GLOBAL_VARIABLE)
+	{
+		exp = static_cast<const GlobalVariable*>(car.get())->getCell()->value;
+	}
+	else if(car->getKind() == Kind::SYMBOL)
 	{
-		exp = context->getValue(first->getName());
+		exp = context->getValue(static_cast<const Symbol*>(car.get())->getId());
 	}
 	else
 	{
 		exp = car->eval(context);
-		logd << "exp not a symbol" << *exp << "\n";
 	}
 	
-	Lambda* lambda = dynamic_cast<Lambda*>(exp.get());
+	if(exp == nullptr && Continuation::escaping())
+	{
+		return nullptr;
+	}
+	if(exp == nullptr || !exp->isLambda())
+	{
+		return Heap::make<List>(car, cdr);
+	}
+	Lambda* lambda = static_cast<Lambda*>(exp.get());
 	
 	
 	//call-by-value with some special cases
@@ -270,42 +676,99 @@ std::shared_ptr<Sexp> List::eval(std::shared_ptr<Environment> context) const
 	//for create lambda, neither parameters of function body are evaluated,
 	// but them and the context are stored
 	
-	if(dynamic_cast<SyntaxLambda*>(lambda) != nullptr)
+	switch(lambda->getKind())
 	{
-		return lambda->eval(context, cdr);
-	}
+	case Kind::SPECIAL_FORM:
+		return lambda->evalTail(context, cdr, tail);
 	
-	//regular lambda expressions (created by users)
-	if (lambda != nullptr)
-	{
-		logd << *lambda << "\n";
-		std::vector<std::shared_ptr<Sexp>> args;
-		
-		if(cdr != nullptr)
+	//regular lambda expressions (created by users): the arguments are evaluated straight into the slots of the new frame
+	case Kind::CLOSURE:
+	case Kind::COMPILED_CLOSURE:
 		{
-			for(auto s : *cdr)
+			std::shared_ptr<Environment> frame = lambda->makeFrame();
+			size_t argc = 0;
+			for(const List* l = cdr.get(); l != nullptr && l->car != nullptr; l = l->cdr.get(), argc++)
 			{
-				std::shared_ptr<Sexp> seval = s->eval(context);
+				if(argc >= frame->getSlotCount())
+					continue;
+				std::shared_ptr<Sexp> seval = l->car->eval(context);
 				if(seval == nullptr)
 				{
 					return nullptr;
 				}
-				args.push_back(seval);
+				frame->setSlot(argc, std::move(seval));
+			}
+			if(argc != frame->getSlotCount())
+			{
+				loge << "wrong number of arguments for " << *lambda << ". (Expected: " << frame->getSlotCount() << ", got: " << argc << ")\n";
+				return nullptr;
 			}
+			return lambda->evalFrame(frame, tail);
+		}
+	
+	//primitives get their arguments in a list
+	default:
+		{
+			std::shared_ptr<Sexp> inlineArgs[ARGUMENT_BUFFER_SIZE];
+			std::vector<std::shared_ptr<Sexp>> moreArgs;
+			size_t argc = 0;
+			if(cdr != nullptr)
+			{
+				for(auto s : *cdr)
+				{
+					std::shared_ptr<Sexp> seval = s->eval(context);
+					if(seval == nullptr)
+					{
+						return nullptr;
+					}
+					if(argc < ARGUMENT_BUFFER_SIZE)
+						inlineArgs[argc] = std::move(seval);
+					else
+					{
+						if(argc == ARGUMENT_BUFFER_SIZE)
+							moreArgs.assign(inlineArgs, inlineArgs + ARGUMENT_BUFFER_SIZE);
+						moreArgs.push_back(std::move(seval));
+					}
+					argc++;
+				}
+			}
+			if(argc == 2)
+				return lambda->evalBinary(inlineArgs[0], inlineArgs[1]);
+			std::shared_ptr<List> lambda_args = Heap::make<List>(argc <= ARGUMENT_BUFFER_SIZE ? inlineArgs : moreArgs.data(), argc);
+
+			//doesnt matter what we pass, labmdas will use their creation time context
+			return lambda->evalTail(nullptr, lambda_args, tail);
 		}
-		
-		std::shared_ptr<List> lambda_args = std::make_shared<List>(args);
-		
-		//doesnt matter what we pass, labmdas will use their creation time context
-		return lambda->eval(nullptr, lambda_args);
 	}
-	return std::make_shared<List>(car, cdr);
 }
 List::~List()
 {
 	
 }
 
+std::shared_ptr<void> List::sharedFromThis()
+{
+	return shared_from_this();
+}
+
+void List::traverse(References& references) const
+{
+	addReference(references, car);
+	if(cdr != nullptr)
+		references.push_back(cdr.get());
+}
+
+void List::clearReferences()
+{
+	car = nullptr;
+	cdr = nullptr;
+}
+
+size_t List::gcSize() const
+{
+	return sizeof(*this);
+}
+
 //iterator...
 ListForwardIterator List::begin()
 {
@@ -373,56 +836,303 @@ bool ConstListForwardIterator::operator !=(const ConstListForwardIterator& other
 //Lambda
 Lambda::Lambda(std::shared_ptr<Environment> env) : Lambda{env, nullptr, nullptr} {}
 
-Lambda::Lambda(std::shared_ptr<Environment> env, std::shared_ptr<List> arglist, std::shared_ptr<Sexp> body) : env{env}, arglist{arglist}, body{body}
+Lambda::Lambda(std::shared_ptr<Environment> env, std::shared_ptr<List> arglist, std::shared_ptr<Sexp> body)
+	: Lambda{env, arglist, arglist == nullptr || body == nullptr ? nullptr : argumentIds(arglist), body} {}
+
+Lambda::Lambda(std::shared_ptr<Environment> env, std::shared_ptr<List> arglist, std::shared_ptr<const std::vector<int>> args, std::shared_ptr<Sexp> body, std::shared_ptr<Sexp> source)
+	: Lambda{body == nullptr ? Kind::PRIMITIVE : Kind::CLOSURE, env, arglist, args, body, source} {}
+
+Lambda::Lambda(Kind kind, std::shared_ptr<Environment> env, std::shared_ptr<List> arglist, std::shared_ptr<const std::vector<int>> args, std::shared_ptr<Sexp> body, std::shared_ptr<Sexp> source)
+	: Sexp{kind}, env{env}, arglist{arglist}, body{body}, source{source}, args{args} {}
+
+bool Lambda::isArglist(const std::shared_ptr<Sexp>& arglist)
 {
-	if(arglist == nullptr || body == nullptr)
-		return;
-	
-	for (auto s : *arglist)
+	if(arglist == nullptr || arglist->getKind() != Kind::LIST)
+		return false;
+	for (auto s : *static_cast<const List*>(arglist.get()))
 	{
-		std::shared_ptr<Symbol> arg = std::dynamic_pointer_cast<Symbol>(s);
-		args.push_back(arg->getName());
+		if(s->getKind() != Kind::SYMBOL)
+			return false;
+	}
+	return true;
+}
+
+std::shared_ptr<const std::vector<int>> Lambda::argumentIds(std::shared_ptr<Sexp> arglist)
+{
+	if(!isArglist(arglist))
+	{
+		if(arglist == nullptr)
+			loge << "lambda expects a list of arguments\n";
+		else
+			loge << "lambda expects a list of symbols as arguments, got: " << *arglist << "\n";
+		return nullptr;
 	}
+	std::shared_ptr<std::vector<int>> ids = std::make_shared<std::vector<int>>();
+	for (auto s : *std::static_pointer_cast<List>(arglist))
+		ids->push_back(static_cast<const Symbol*>(s.get())->getId());
+	return ids;
 }
+
+std::shared_ptr<Environment> Lambda::getEnv() const
+{
+	return env;
+}
+
+std::shared_ptr<List> Lambda::getArglist() const
+{
+	return arglist;
+}
+
+std::shared_ptr<Sexp> Lambda::getBody() const
+{
+	return body;
+}
+
+std::shared_ptr<Sexp> Lambda::getSource() const
+{
+	return source;
+}
+
 std::shared_ptr<Sexp> Lambda::eval(std::shared_ptr<Environment> context) const
 {
-	return std::make_shared<Lambda>(env, arglist, body);
+	return std::const_pointer_cast<Sexp>(shared_from_this());
 }
 void Lambda::print(std::ostream &os) const
 {
 	os << "(lambda (";
 	std::string prefix = "";
-	for (auto arg : args)
+	for (auto arg : *args)
 	{
-		std::cout << prefix << arg;
+		os << prefix << SymbolTable::name(arg);
 		prefix = " ";
 	}
-	os << ") " << *body << ")";
+	os << ") " << *(source != nullptr ? source : body) << ")";
 	
 }
 
 //function call
-std::shared_ptr<Sexp> Lambda::eval(std::shared_ptr<Environment> context, std::shared_ptr<List> params) const
+std::shared_ptr<Environment> Lambda::makeFrame() const
 {
-	logd << "lambda eval: func: " << *this << ", body: " << *body << "\n";
-	
-	std::shared_ptr<Environment> functionEnv = std::make_shared<Environment>(env, args, params);
-	logd << *functionEnv;
-	std::shared_ptr<Sexp> result = body->eval(functionEnv);
-	
+	if(getKind() != Kind::CLOSURE && getKind() != Kind::COMPILED_CLOSURE)
+		return nullptr;
+	return Heap::make<Environment>(env, args);
+}
+
+std::shared_ptr<Environment> Lambda::bindFrame(std::shared_ptr<List> params) const
+{
+	std::shared_ptr<Environment> frame = makeFrame();
+	int argc = params == nullptr ? 0 : params->size();
+	if((size_t)argc != frame->getSlotCount())
+	{
+		loge << "wrong number of arguments for " << *this << ". (Expected: " << frame->getSlotCount() << ", got: " << argc << ")\n";
+		return nullptr;
+	}
+	if(params != nullptr)
+	{
+		int slot = 0;
+		for(auto s : *params)
+			frame->setSlot(slot++, s);
+	}
+	return frame;
+}
+
+std::shared_ptr<Sexp> Lambda::evalFrame(std::shared_ptr<Environment> frame, TailCall& tail) const
+{
+	SCHEME_TRACE(CALL, getKind(), this, -1, static_cast<int32_t>(frame->getSlotCount()));
+	tail.context = std::move(frame);
+	tail.exp = body;
+	tail.callee = this;
+	return nullptr;
+}
+
+std::shared_ptr<Sexp> Lambda::run(std::shared_ptr<Environment> frame) const
+{
+	TailCall tail{nullptr, nullptr};
+	std::shared_ptr<Sexp> result = evalFrame(std::move(frame), tail);
+	if(tail.exp != nullptr)
+		result = TailCall::run(tail.exp, tail.context, tail.callee);
 	if(result != nullptr)
-		logd << " result: " << *result << "\n";
+	{
+		SCHEME_TRACE(RETURN, result->getKind(), this, -1, 0);
+	}
 	return result;
 }
 
-void Lambda::clearEnv()
+std::shared_ptr<Sexp> Lambda::evalBinary(const std::shared_ptr<Sexp>& left, const std::shared_ptr<Sexp>& right) const
+{
+	const std::shared_ptr<Sexp> args[] = {left, right};
+	return eval(nullptr, Heap::make<List>(args, 2));
+}
+
+std::shared_ptr<Sexp> Lambda::eval(std::shared_ptr<Environment> context, std::shared_ptr<List> params) const
+{
+	std::shared_ptr<Environment> frame = bindFrame(params);
+	if(frame == nullptr)
+		return nullptr;
+	return run(frame);
+}
+
+std::shared_ptr<Sexp> Lambda::evalTail(std::shared_ptr<Environment> context, std::shared_ptr<List> params, TailCall& tail) const
+{
+	if(body == nullptr)
+		return eval(context, params);
+	
+	std::shared_ptr<Environment> frame = bindFrame(params);
+	if(frame == nullptr)
+		return nullptr;
+	return evalFrame(frame, tail);
+}
+
+std::shared_ptr<void> Lambda::sharedFromThis()
+{
+	return shared_from_this();
+}
+
+void Lambda::traverse(References& references) const
+{
+	if(env != nullptr)
+		references.push_back(env.get());
+	if(arglist != nullptr)
+		references.push_back(arglist.get());
+	addReference(references, body);
+	addReference(references, source);
+}
+
+void Lambda::clearReferences()
 {
 	env = nullptr;
+	arglist = nullptr;
+	body = nullptr;
+	source = nullptr;
+}
+
+size_t Lambda::gcSize() const
+{
+	return sizeof(*this);
+}
+
+
+//LambdaExpression
+
+LambdaExpression::LambdaExpression(std::shared_ptr<List> arglist, std::shared_ptr<const std::vector<int>> args, std::shared_ptr<Sexp> body, std::shared_ptr<Sexp> source)
+	: Sexp{Kind::LAMBDA_EXPRESSION}, arglist{arglist}, args{args}, body{body}, source{source} {}
+
+std::shared_ptr<List> LambdaExpression::getArglist() const
+{
+	return arglist;
+}
+
+std::shared_ptr<Sexp> LambdaExpression::getBody() const
+{
+	return body;
+}
+
+std::shared_ptr<Sexp> LambdaExpression::getSource() const
+{
+	return source;
+}
+
+std::shared_ptr<Sexp> LambdaExpression::eval(std::shared_ptr<Environment> context) const
+{
+	return Heap::make<Lambda>(context, arglist, args, body, source);
+}
+
+void LambdaExpression::print(std::ostream &os) const
+{
+	os << "(lambda " << *arglist << " " << *(source != nullptr ? source : body) << ")";
+}
+
+
+//LexicalResolver
+
+LexicalResolver::LexicalResolver(std::shared_ptr<Environment> context, const std::vector<int>& args) : global{context.get()}
+{
+	scopes.push_back(&args);
+	while(global->getParent() != nullptr)
+	{
+		scopes.push_back(global->getNames());
+		global = global->getParent();
+	}
+}
+
+std::shared_ptr<Sexp> LexicalResolver::specialForm(std::shared_ptr<Sexp> head) const
+{
+	if(head->getKind() == Kind::GLOBAL_VARIABLE)
+		return static_cast<const GlobalVariable*>(head.get())->getCell()->value;
+	Symbol* symbol = dynamic_cast<Symbol*>(head.get());
+	if(symbol == nullptr)
+		return nullptr;
+	for(const std::vector<int>* scope : scopes)
+	{
+		for(int id : *scope)
+		{
+			if(id == symbol->getId())
+				return nullptr;
+		}
+	}
+	return global->getValue(symbol->getId());
+}
+
+std::shared_ptr<Sexp> LexicalResolver::resolve(std::shared_ptr<Sexp> exp)
+{
+	if(Symbol* symbol = dynamic_cast<Symbol*>(exp.get()))
+	{
+		for(size_t depth = 0; depth < scopes.size(); depth++)
+		{
+			const std::vector<int>& scope = *scopes[depth];
+			for(size_t slot = 0; slot < scope.size(); slot++)
+			{
+				if(scope[slot] == symbol->getId())
+					return std::make_shared<LocalVariable>(symbol->getId(), depth, slot);
+			}
+		}
+		//global variable
+		return std::make_shared<GlobalVariable>(global->getCell(symbol->getId()));
+	}
+	
+	std::shared_ptr<List> list = std::dynamic_pointer_cast<List>(exp);
+	if(list == nullptr || list->Car() == nullptr)
+		return exp;
+	
+	std::shared_ptr<Sexp> form = specialForm(list->Car());
+	if(dynamic_cast<CreateLambda*>(form.get()) != nullptr && list->size() >= 3)
+	{
+		// (lambda (args...) body) - the body is resolved with the new frame on top
+		//a malformed lambda is left to CreateLambda, it reports the error when it runs
+		if(!Lambda::isArglist(list->Cdr()->Car()))
+			return exp;
+		std::shared_ptr<List> funargs = std::static_pointer_cast<List>(list->Cdr()->Car());
+		std::shared_ptr<const std::vector<int>> args = Lambda::argumentIds(funargs);
+		std::shared_ptr<Sexp> body = list->Cdr()->Cdr()->Car();
+		std::shared_ptr<Sexp> source = OptimizedBody::unwrap(body);
+		scopes.insert(scopes.begin(), args.get());
+		body = resolve(body);
+		scopes.erase(scopes.begin());
+		return std::make_shared<LambdaExpression>(funargs, args, body, source);
+	}
+	
+	std::vector<std::shared_ptr<Sexp>> elements;
+	if(dynamic_cast<DefineFunction*>(form.get()) != nullptr)
+	{
+		// (define (fun vars...) (body)) is left alone, CreateLambda resolves it when the define runs
+		// (define name exp) - only the expression is resolved
+		if(list->size() < 3 || dynamic_cast<Symbol*>(list->Cdr()->Car().get()) == nullptr)
+			return exp;
+		elements.push_back(list->Car());
+		elements.push_back(list->Cdr()->Car());
+		for(auto s : *list->Cdr()->Cdr())
+			elements.push_back(resolve(s));
+		return Heap::make<List>(elements);
+	}
+	
+	for(auto s : *list)
+		elements.push_back(resolve(s));
+	return Heap::make<List>(elements);
 }
 
 
 //Syntax lambda
-SyntaxLambda::SyntaxLambda(std::shared_ptr<Environment> env) : Lambda{env} {}
+SyntaxLambda::SyntaxLambda(std::shared_ptr<Environment> env) : Lambda{Kind::SPECIAL_FORM, env, nullptr, nullptr, nullptr} {}
 
 
 //CreateLambda
@@ -440,9 +1150,13 @@ std::shared_ptr<Sexp> CreateLambda::eval(std::shared_ptr<Environment> context, s
 	}
 	std::shared_ptr<List> funargs = std::dynamic_pointer_cast<List>(params->Car());
 	std::shared_ptr<Sexp> body = params->Cdr()->Car();
-	logd << "args: " <<*funargs << ", body: " << *body << "\n";
-	logd << *context << "\n";
-	return std::make_shared<Lambda>(context, funargs, body);
+	std::shared_ptr<Sexp> source = OptimizedBody::unwrap(body);
+	std::shared_ptr<const std::vector<int>> args = Lambda::argumentIds(params->Car());
+	if(args == nullptr)
+		return nullptr;
+	SCHEME_TRACE(CREATE_LAMBDA, Kind::CLOSURE, context.get(), -1, static_cast<int32_t>(args->size()));
+	body = LexicalResolver{context, *args}.resolve(body);
+	return Heap::make<Lambda>(context, funargs, args, body, source);
 }
 
 void CreateLambda::print(std::ostream &os) const
@@ -458,37 +1172,51 @@ void CreateLambda::print(std::ostream &os) const
 // (define fun (lambda ..))
 DefineFunction::DefineFunction(std::shared_ptr<Environment> env) : SyntaxLambda{env} {}
 
-std::shared_ptr<Sexp> DefineFunction::eval(std::shared_ptr<Environment> context, std::shared_ptr<List> params) const
+bool DefineFunction::definition(std::shared_ptr<Environment> context, std::shared_ptr<List> params, std::shared_ptr<Symbol>& variable, std::shared_ptr<Sexp>& value)
 {
-	std::shared_ptr<Symbol> variable = std::dynamic_pointer_cast<Symbol>(params->Car());
+	variable = std::dynamic_pointer_cast<Symbol>(params->Car());
 	std::shared_ptr<Sexp> exp;
 	if(variable == nullptr)
 	{
 		std::shared_ptr<List> first = std::dynamic_pointer_cast<List>(params->Car());
-		if(first == nullptr)
+		variable = first == nullptr ? nullptr : std::dynamic_pointer_cast<Symbol>(first->Car());
+		if(variable == nullptr)
 		{
 			loge << "define expects a name\n";
-			return nullptr;
+			return false;
 		}
 		std::shared_ptr<List> funargs = first->Cdr();
-		funargs = funargs == nullptr ? std::make_shared<List>() : funargs;
-		variable = std::dynamic_pointer_cast<Symbol>(first->Car());
+		funargs = funargs == nullptr ? Heap::make<List>() : funargs;
 		std::shared_ptr<Sexp> body = params->Cdr()->Car();
 		
 		std::vector<std::shared_ptr<Sexp>> listElements;
-		listElements.push_back(std::make_shared<Symbol>("lambda"));
+		listElements.push_back(Symbol::intern("lambda"));
 		listElements.push_back(funargs);
 		listElements.push_back(body);
-		exp = std::make_shared<List>(listElements);
+		exp = Heap::make<List>(listElements);
 	}
 	else
 	{
 		exp = params->Cdr()->Car();
 	}
-	exp = exp->eval(context);
+	value = exp->eval(context);
+	return true;
+}
+
+std::shared_ptr<Sexp> DefineFunction::eval(std::shared_ptr<Environment> context, std::shared_ptr<List> params) const
+{
+	if(Future::running())
+	{
+		loge << "define can't be used in a future\n";
+		return nullptr;
+	}
+	std::shared_ptr<Symbol> variable;
+	std::shared_ptr<Sexp> exp;
+	if(!definition(context, params, variable, exp) || exp == nullptr)
+		return nullptr;
 	
 	//env is the global environment here
-	env->bindArg(variable->getName(), exp);
+	env->bindArg(variable->getId(), exp);
 	
 	//not really needed for define to print out result,
 	// but I think it can be useful
@@ -509,10 +1237,22 @@ IfLambda::IfLambda(std::shared_ptr<Environment> env) : SyntaxLambda{env} {}
 std::shared_ptr<Sexp> IfLambda::eval(std::shared_ptr<Environment> context, std::shared_ptr<List> params) const
 {
 	std::shared_ptr<Sexp> test = params->Car()->eval(context);
+	if(test == nullptr)
+		return nullptr;
 	std::shared_ptr<Sexp> trueExp = params->Cdr()->Car();
 	std::shared_ptr<Sexp> falseExp = params->Cdr()->Cdr()->Car();
 	//Sexp* t; t->operator bool()
-	return test->operator bool() ? trueExp->eval(context) : falseExp->eval(context);
+	return TailCall::run(test->operator bool() ? trueExp : falseExp, context);
+}
+
+std::shared_ptr<Sexp> IfLambda::evalTail(std::shared_ptr<Environment> context, std::shared_ptr<List> params, TailCall& tail) const
+{
+	std::shared_ptr<Sexp> test = params->Car()->eval(context);
+	if(test == nullptr)
+		return nullptr;
+	tail.exp = test->operator bool() ? params->Cdr()->Car() : params->Cdr()->Cdr()->Car();
+	tail.context = context;
+	return nullptr;
 }
 
 void IfLambda::print(std::ostream &os) const
@@ -522,24 +1262,27 @@ void IfLambda::print(std::ostream &os) const
 
 
 //(and ...)
-AndBooleanAggregateFunction::AndBooleanAggregateFunction(std::shared_ptr<Environment> env) : Lambda{env} {}
+AndBooleanAggregateFunction::AndBooleanAggregateFunction(std::shared_ptr<Environment> env) : SyntaxLambda{env} {}
 std::shared_ptr<Sexp> AndBooleanAggregateFunction::eval(std::shared_ptr<Environment> context, std::shared_ptr<List> params) const
 {
-	if(params->size() < 1)
+	//as syntax, the arguments are the rest of the form: nullptr if there are none
+	if(params == nullptr || params->Car() == nullptr)
 	{
-		loge << "not enough arguments for " << *this << ". (Expected: at least 1, got: " << params->size() << ")\n";
+		loge << "not enough arguments for " << *this << ". (Expected: at least 1, got: 0)\n";
 		return nullptr;
 	}
 	for(auto s : *params)
 	{
 		std::shared_ptr<Sexp> head = s->eval(context);
+		if(head == nullptr)
+			return nullptr;
 		bool val = (bool) *head;
 		if(!val)
 		{
-			return env->getValue("#f");
+			return Symbol::boolean(false);
 		}
 	}
-	return env->getValue("#t");
+	return Symbol::boolean(true);
 }
 void AndBooleanAggregateFunction::print(std::ostream &os) const
 {
@@ -547,24 +1290,27 @@ void AndBooleanAggregateFunction::print(std::ostream &os) const
 }
 
 //(or ...)
-OrBooleanAggregateFunction::OrBooleanAggregateFunction(std::shared_ptr<Environment> env) : Lambda{env} {}
+OrBooleanAggregateFunction::OrBooleanAggregateFunction(std::shared_ptr<Environment> env) : SyntaxLambda{env} {}
 std::shared_ptr<Sexp> OrBooleanAggregateFunction::eval(std::shared_ptr<Environment> context, std::shared_ptr<List> params) const
 {
-	if(params->size() < 1)
+	//as syntax, the arguments are the rest of the form: nullptr if there are none
+	if(params == nullptr || params->Car() == nullptr)
 	{
-		loge << "not enough arguments for " << *this << ". (Expected: at least 1, got: " << params->size() << ")\n";
+		loge << "not enough arguments for " << *this << ". (Expected: at least 1, got: 0)\n";
 		return nullptr;
 	}
 	for(auto s : *params)
 	{
 		std::shared_ptr<Sexp> head = s->eval(context);
+		if(head == nullptr)
+			return nullptr;
 		bool val = (bool) *head;
-		if(!val)
+		if(val)
 		{
-			return env->getValue("#t");
+			return Symbol::boolean(true);
 		}
 	}
-	return env->getValue("#f");
+	return Symbol::boolean(false);
 }
 void OrBooleanAggregateFunction::print(std::ostream &os) const
 {
@@ -572,232 +1318,387 @@ void OrBooleanAggregateFunction::print(std::ostream &os) const
 }
 
 
-Number* CommonInteger::ConvertAndCheck(Sexp* s)
+//(gc)
+GcFunction::GcFunction(std::shared_ptr<Environment> env) : Lambda{env} {}
+std::shared_ptr<Sexp> GcFunction::eval(std::shared_ptr<Environment> context, std::shared_ptr<List> params) const
+{
+	//the heap is paused while futures of the interpreter are queued or running
+	if(!Future::running() && FutureGroup::current() != nullptr)
+		FutureGroup::current()->wait();
+	Heap::collect();
+	return Number::make(static_cast<int64_t>(Heap::getStats().last.reclaimedObjects));
+}
+void GcFunction::print(std::ostream &os) const
+{
+	os << "gc";
+}
+
+//(gc-stats)
+GcStatsFunction::GcStatsFunction(std::shared_ptr<Environment> env) : Lambda{env} {}
+std::shared_ptr<Sexp> GcStatsFunction::eval(std::shared_ptr<Environment> context, std::shared_ptr<List> params) const
 {
-	Symbol* unboundVariable = dynamic_cast<Symbol*>(s);
-	if(unboundVariable != nullptr)
+	const HeapStats& stats = Heap::getStats();
+	std::vector<std::shared_ptr<Sexp>> entries;
+	auto entry = [&entries](const char* name, double value)
 	{
-		loge << *s << " is unbound\n";
+		entries.push_back(Heap::make<List>(std::vector<std::shared_ptr<Sexp>>{Symbol::intern(name), Number::make(static_cast<int64_t>(value))}));
+	};
+	entry("collections", stats.collections);
+	entry("full-collections", stats.fullCollections);
+	entry("marking-cycles", stats.markingCycles);
+	entry("last-pause-us", stats.last.pauseMicroseconds);
+	entry("max-pause-us", stats.maxPauseMicroseconds);
+	entry("total-pause-us", stats.totalPauseMicroseconds);
+	entry("last-promoted-bytes", stats.last.promotedBytes);
+	entry("last-reclaimed-bytes", stats.last.reclaimedBytes);
+	//totals in kilobytes, so they fit in a number for a long time
+	entry("promoted-kb", stats.promotedBytes / 1024);
+	entry("reclaimed-kb", stats.reclaimedBytes / 1024);
+	entry("nursery-objects", Heap::getNurseryCount());
+	entry("old-objects", Heap::getOldCount());
+	entry("allocations", stats.allocations);
+	entry("allocated-kb", stats.allocatedBytes / 1024);
+	return Heap::make<List>(entries);
+}
+void GcStatsFunction::print(std::ostream &os) const
+{
+	os << "gc-stats";
+}
+
+//(heap-stats)
+HeapStatsFunction::HeapStatsFunction(std::shared_ptr<Environment> env) : Lambda{env} {}
+std::shared_ptr<Sexp> HeapStatsFunction::eval(std::shared_ptr<Environment> context, std::shared_ptr<List> params) const
+{
+	const HeapStats& stats = Heap::getStats();
+	std::vector<std::shared_ptr<Sexp>> entries;
+	auto entry = [&entries](const std::string& name, int64_t value)
+	{
+		entries.push_back(Heap::make<List>(std::vector<std::shared_ptr<Sexp>>{Symbol::intern(name), Number::make(value)}));
+	};
+	//in the order of AllocationKind
+	const char* const kinds[ALLOCATION_KINDS] = {"numbers", "lists", "lambdas", "environments", "other"};
+	const char* const kindBytes[ALLOCATION_KINDS] = {"number-bytes", "list-bytes", "lambda-bytes", "environment-bytes", "other-bytes"};
+	for(size_t kind = 0; kind < ALLOCATION_KINDS; kind++)
+	{
+		entry(kinds[kind], stats.liveObjects[kind]);
+		entry(kindBytes[kind], stats.liveBytes[kind]);
+	}
+	entry("symbols", SymbolTable::count());
+	entry("symbol-bytes", SymbolTable::bytes());
+	entry("live-bytes", stats.totalLiveBytes);
+	entry("peak-bytes", stats.peakLiveBytes);
+	return Heap::make<List>(entries);
+}
+void HeapStatsFunction::print(std::ostream &os) const
+{
+	os << "heap-stats";
+}
+
+
+//LoadFunction
+
+LoadFunction::LoadFunction(std::shared_ptr<Environment> env, SchemeInterpreter* interpreter) : Lambda{env}, interpreter{interpreter} {}
+std::shared_ptr<Sexp> LoadFunction::eval(std::shared_ptr<Environment> context, std::shared_ptr<List> params) const
+{
+	if(params->Car() == nullptr || params->Cdr() != nullptr || params->Car()->getKind() != Kind::STRING)
+	{
+		loge << "load expects a file name string\n";
 		return nullptr;
 	}
-	Number* num = dynamic_cast<Number*>(s);
-	if(num == nullptr)
+	if(Future::running())
 	{
-		loge << *s << " is not a number\n";
+		loge << "load can't be used in a future\n";
 		return nullptr;
 	}
-	return num;
+	if(!interpreter->load(static_cast<String*>(params->Car().get())->getValue()))
+		return nullptr;
+	return Symbol::boolean(true);
+}
+void LoadFunction::print(std::ostream &os) const
+{
+	os << "load";
 }
 
 
-BasicCompareFunction::BasicCompareFunction(std::shared_ptr<Environment> env) : Lambda{env} {}
-std::shared_ptr<Sexp> BasicCompareFunction::eval(std::shared_ptr<Environment> context, std::shared_ptr<List> params) const
+Number* CommonInteger::ConvertAndCheck(Sexp* s)
 {
-	if(params->size() < 2)
+	switch(s->getKind())
 	{
-		loge << "not enough arguments for " << *this << ". (Expected: at least 2, got: " << params->size() << ")\n";
+	case Kind::NUMBER:
+		return static_cast<Number*>(s);
+	case Kind::SYMBOL:
+		loge << *s << " is unbound\n";
 		return nullptr;
-	}
-	Number* num = CommonInteger::ConvertAndCheck(params->Car().get());
-	if(num == nullptr)
+	default:
+		loge << *s << " is not a number\n";
 		return nullptr;
-	
-	int val = (int)*num;
-	
-	bool res = true;
-	
-	for(auto s : *params->Cdr())
-	{
-		num = CommonInteger::ConvertAndCheck(s.get());
-		if(num == nullptr)
-			return nullptr;
-		res = res && do_operator(val, (int)*num);
-		val = (int)*num;
-	}	
-	return res ? env->getValue("#t") : env->getValue("#f");
+	}
 }
 
-//Less
-LessFunction::LessFunction(std::shared_ptr<Environment> env) : BasicCompareFunction{env} {}
-bool LessFunction::do_operator(int left, int right) const
+std::shared_ptr<Number> CommonInteger::add(const Number& left, const Number& right)
 {
-	return left < right;
+	int64_t result;
+	if(left.isFixnum() && right.isFixnum() && !__builtin_add_overflow(left.getFixnum(), right.getFixnum(), &result))
+		return Number::make(result);
+	return Number::make(left.toBigInt() + right.toBigInt());
 }
-void LessFunction::print(std::ostream &os) const
+
+std::shared_ptr<Number> CommonInteger::subtract(const Number& left, const Number& right)
 {
-	os << "basic<";
+	int64_t result;
+	if(left.isFixnum() && right.isFixnum() && !__builtin_sub_overflow(left.getFixnum(), right.getFixnum(), &result))
+		return Number::make(result);
+	return Number::make(left.toBigInt() - right.toBigInt());
 }
 
-//Greater
-GreaterFunction::GreaterFunction(std::shared_ptr<Environment> env) : BasicCompareFunction{env} {}
-bool GreaterFunction::do_operator(int left, int right) const
+std::shared_ptr<Number> CommonInteger::multiply(const Number& left, const Number& right)
 {
-	return left > right;
+	int64_t result;
+	if(left.isFixnum() && right.isFixnum() && !__builtin_mul_overflow(left.getFixnum(), right.getFixnum(), &result))
+		return Number::make(result);
+	return Number::make(left.toBigInt() * right.toBigInt());
 }
-void GreaterFunction::print(std::ostream &os) const
+
+std::shared_ptr<Number> CommonInteger::divide(const Number& left, const Number& right)
 {
-	os << "basic>";
+	//the only overflowing fixnum division is INT64_MIN / -1
+	if(left.isFixnum() && right.isFixnum() && !(left.getFixnum() == INT64_MIN && right.getFixnum() == -1))
+		return Number::make(left.getFixnum() / right.getFixnum());
+	return Number::make(left.toBigInt() / right.toBigInt());
 }
 
-//Equal
-EqualFunction::EqualFunction(std::shared_ptr<Environment> env) : BasicCompareFunction{env} {}
-bool EqualFunction::do_operator(int left, int right) const
+int CommonInteger::compare(const Number& left, const Number& right)
 {
-	return left == right;
+	if(left.isFixnum() && right.isFixnum())
+		return left.getFixnum() < right.getFixnum() ? -1 : left.getFixnum() > right.getFixnum() ? 1 : 0;
+	return BigInt::compare(left.toBigInt(), right.toBigInt());
 }
-void EqualFunction::print(std::ostream &os) const
+
+
+//Operators
+
+bool Operators::Divide::valid(const Number&, const Number& right)
 {
-	os << "basic=";
+	if(right.isFixnum() && right.getFixnum() == 0)
+	{
+		loge << "division by zero.\n";
+		return false;
+	}
+	return true;
 }
 
+namespace
+{
+	/**	logs the error of a primitive called with less than 2 arguments, params is checked without walking it */
+	bool checkAtLeastTwo(const Lambda& function, const List& params)
+	{
+		if(params.Car() != nullptr && params.Cdr() != nullptr)
+			return true;
+		loge << "not enough arguments for " << function << ". (Expected: at least 2, got: " << (params.Car() == nullptr ? 0 : 1) << ")\n";
+		return false;
+	}
+}
 
 
-//BasicArithmeticFunction
+//ArithmeticFunction
 
-BasicArithmeticFunction::BasicArithmeticFunction(std::shared_ptr<Environment> env) : Lambda{env} {}
+template <typename Op>
+ArithmeticFunction<Op>::ArithmeticFunction(std::shared_ptr<Environment> env) : Lambda{env} {}
 
-std::shared_ptr<Sexp> BasicArithmeticFunction::eval(std::shared_ptr<Environment> context, std::shared_ptr<List> params) const
+template <typename Op>
+std::shared_ptr<Sexp> ArithmeticFunction<Op>::eval(std::shared_ptr<Environment> context, std::shared_ptr<List> params) const
 {
-	if(params->size() < 2)
-	{
-		loge << "not enough arguments for " << *this << ". (Expected: at least 2, got: " << params->size() << ")\n";
+	if(!checkAtLeastTwo(*this, *params))
 		return nullptr;
-	}
 	Number* num = CommonInteger::ConvertAndCheck(params->Car().get());
 	if(num == nullptr)
 		return nullptr;
-	int res = (int)*num;
+	std::shared_ptr<Number> res = std::static_pointer_cast<Number>(params->Car());
 	for(auto s : *params->Cdr())
 	{
 		num = CommonInteger::ConvertAndCheck(s.get());
-		if(num == nullptr)
-			return nullptr;
-		if(checkParamsValid(res, (int)*num))
-		{
-			res = do_operator(res, (int)*num);
-		}
-		else
-		{
+		if(num == nullptr || !Op::valid(*res, *num))
 			return nullptr;
-		}
-	}	
+		res = Op::apply(*res, *num);
+	}
 	//all variables bound
-	return std::make_shared<Number>(res);
+	return res;
 }
 
-bool BasicArithmeticFunction::checkParamsValid(int left, int right) const
+template <typename Op>
+std::shared_ptr<Sexp> ArithmeticFunction<Op>::evalBinary(const std::shared_ptr<Sexp>& left, const std::shared_ptr<Sexp>& right) const
 {
-	return true;
+	Number* l = CommonInteger::ConvertAndCheck(left.get());
+	if(l == nullptr)
+		return nullptr;
+	Number* r = CommonInteger::ConvertAndCheck(right.get());
+	if(r == nullptr || !Op::valid(*l, *r))
+		return nullptr;
+	return Op::apply(*l, *r);
 }
 
-
-//AddFunction
-AddFunction::AddFunction(std::shared_ptr<Environment> env) : BasicArithmeticFunction{env} {}
-
-int AddFunction::do_operator(int left, int right) const
-{
-	return left + right;
-}
-void AddFunction::print(std::ostream &os) const
+template <typename Op>
+void ArithmeticFunction<Op>::print(std::ostream &os) const
 {
-	os << "basic+";
+	os << Op::name();
 }
 
+template class ArithmeticFunction<Operators::Add>;
+template class ArithmeticFunction<Operators::Subtract>;
+template class ArithmeticFunction<Operators::Multiply>;
+template class ArithmeticFunction<Operators::Divide>;
 
-//MultiplyFunction
-MultiplyFunction::MultiplyFunction(std::shared_ptr<Environment> env) : BasicArithmeticFunction{env} {}
-
-int MultiplyFunction::do_operator(int left, int right) const
-{
-	return left * right;
-}
-
-void MultiplyFunction::print(std::ostream &os) const
-{
-	os << "basic*";
-}
 
-//MinusFunction
-MinusFunction::MinusFunction(std::shared_ptr<Environment> env) : BasicArithmeticFunction{env} {}
+//CompareFunction
 
-int MinusFunction::do_operator(int left, int right) const
-{
-	return left - right;
-}
+template <typename Op>
+CompareFunction<Op>::CompareFunction(std::shared_ptr<Environment> env) : Lambda{env} {}
 
-void MinusFunction::print(std::ostream &os) const
+template <typename Op>
+std::shared_ptr<Sexp> CompareFunction<Op>::eval(std::shared_ptr<Environment> context, std::shared_ptr<List> params) const
 {
-	os << "basic-";
+	if(!checkAtLeastTwo(*this, *params))
+		return nullptr;
+	Number* num = CommonInteger::ConvertAndCheck(params->Car().get());
+	if(num == nullptr)
+		return nullptr;
+	
+	bool res = true;
+	
+	for(auto s : *params->Cdr())
+	{
+		Number* next = CommonInteger::ConvertAndCheck(s.get());
+		if(next == nullptr)
+			return nullptr;
+		if(num->isFixnum() && next->isFixnum())
+			res = res && Op::apply(num->getFixnum(), next->getFixnum());
+		else
+			res = res && Op::apply(CommonInteger::compare(*num, *next), 0);
+		num = next;
+	}	
+	return Symbol::boolean(res);
 }
 
-//DivisionFunction
-DivisionFunction::DivisionFunction(std::shared_ptr<Environment> env) : BasicArithmeticFunction{env} {}
-
-int DivisionFunction::do_operator(int left, int right) const
+template <typename Op>
+std::shared_ptr<Sexp> CompareFunction<Op>::evalBinary(const std::shared_ptr<Sexp>& left, const std::shared_ptr<Sexp>& right) const
 {
-	return left / right;
+	Number* l = CommonInteger::ConvertAndCheck(left.get());
+	if(l == nullptr)
+		return nullptr;
+	Number* r = CommonInteger::ConvertAndCheck(right.get());
+	if(r == nullptr)
+		return nullptr;
+	if(l->isFixnum() && r->isFixnum())
+		return Symbol::boolean(Op::apply(l->getFixnum(), r->getFixnum()));
+	return Symbol::boolean(Op::apply(CommonInteger::compare(*l, *r), 0));
 }
 
-bool DivisionFunction::checkParamsValid(int left, int right) const
+template <typename Op>
+void CompareFunction<Op>::print(std::ostream &os) const
 {
-	if(right == 0)
-	{
-		loge << "division by zero.\n";
-		return false;
-	}
-	return true;
+	os << Op::name();
 }
 
-void DivisionFunction::print(std::ostream &os) const
-{
-	os << "basic/";
-}
+template class CompareFunction<Operators::Less>;
+template class CompareFunction<Operators::Greater>;
+template class CompareFunction<Operators::Equal>;
 
 
 
 
 //SchemeInterpreter
 
-SchemeInterpreter::SchemeInterpreter()
-	: exit{std::make_shared<Symbol>("exit")}
-	, help{std::make_shared<Symbol>("help")}
-	, symbol_logdebug{std::make_shared<Symbol>("logdebug")}
-	, symbol_logerror{std::make_shared<Symbol>("logerror")}
-	, symbol_lognone{std::make_shared<Symbol>("lognone")}
-	, exited{false}
-	, global{std::make_shared<Environment>()}
+struct SchemeInterpreter::Activation
 {
-	Environment::Global = global.get();
+	Heap::Scope heapScope;
+	LogSettings::Scope logScope;
+	FutureGroup::Scope futureScope;
+	
+	Activation(const SchemeInterpreter& interpreter) : heapScope{interpreter.heap}, logScope{interpreter.logSettings}, futureScope{interpreter.futures.get()} {}
+};
+
+SchemeInterpreter::SchemeInterpreter(bool prelude)
+	: logSettings{LogLevel::ERROR}
+	, futures{new FutureGroup(heap)}
+	, exit{Symbol::intern("exit")}
+	, help{Symbol::intern("help")}
+	, symbol_logdebug{Symbol::intern("logdebug")}
+	, symbol_logerror{Symbol::intern("logerror")}
+	, symbol_lognone{Symbol::intern("lognone")}
+	, symbol_enginetree{Symbol::intern("enginetree")}
+	, symbol_enginebytecode{Symbol::intern("enginebytecode")}
+	, symbol_dumpbytecode{Symbol::intern("dumpbytecode")}
+	, symbol_optimize{Symbol::intern("optimize")}
+	, symbol_dumpoptimized{Symbol::intern("dumpoptimized")}
+	, symbol_dumptrace{Symbol::intern("dumptrace")}
+	, symbol_allocstats{Symbol::intern("allocstats")}
+	, exited{false}
+	, readFailed{false}
+	, engine{Engine::TREE}
+	, dumpBytecode{false}
+	, optimize{true}
+	, dumpOptimized{false}
+	, printAllocations{false}
+	, lastEval{0, 0, 0, 0}
+{
+	Activation activation{*this};
+	global = Heap::make<Environment>();
 	
 	global->bindArg("exit", exit);
 	global->bindArg("help", help);
 	global->bindArg("logdebug", symbol_logdebug);
 	global->bindArg("logerror", symbol_logerror);
 	global->bindArg("lognone", symbol_lognone);
+	global->bindArg("enginetree", symbol_enginetree);
+	global->bindArg("enginebytecode", symbol_enginebytecode);
+	global->bindArg("dumpbytecode", symbol_dumpbytecode);
+	global->bindArg("optimize", symbol_optimize);
+	global->bindArg("dumpoptimized", symbol_dumpoptimized);
+	global->bindArg("dumptrace", symbol_dumptrace);
+	global->bindArg("allocstats", symbol_allocstats);
+	
+	
 	
+	global->bindArg("define", Heap::make<DefineFunction>(global));
+	global->bindArg("lambda", Heap::make<CreateLambda>(global));
+	global->bindArg("if", Heap::make<IfLambda>(global));
+	//not bound: only the optimizer makes inlined calls
+	inlinedCall = Heap::make<InlinedCall>(global);
 	
+	global->bindArg(SymbolTable::True, Symbol::boolean(true));
+	global->bindArg(SymbolTable::False, Symbol::boolean(false));
 	
-	global->bindArg("define", std::make_shared<DefineFunction>(global));
-	global->bindArg("lambda", std::make_shared<CreateLambda>(global));
-	global->bindArg("if", std::make_shared<IfLambda>(global));
+	global->bindArg("and", Heap::make<AndBooleanAggregateFunction>(global));
+	global->bindArg("or", Heap::make<OrBooleanAggregateFunction>(global));
 	
-	global->bindArg("#t", std::make_shared<Symbol>("#t"));
-	global->bindArg("#f", std::make_shared<Symbol>("#f"));
 	
-	eval("(define not (lambda (x) (if x #f #t)))");
+	global->bindArg("<", Heap::make<LessFunction>(global));
+	global->bindArg(">", Heap::make<GreaterFunction>(global));
+	global->bindArg("=", Heap::make<EqualFunction>(global));
 	
-	global->bindArg("and", std::make_shared<AndBooleanAggregateFunction>(global));
-	global->bindArg("or", std::make_shared<OrBooleanAggregateFunction>(global));
+	global->bindArg("+", Heap::make<AddFunction>(global));
+	global->bindArg("*", Heap::make<MultiplyFunction>(global));
+	global->bindArg("-", Heap::make<MinusFunction>(global));
+	global->bindArg("/", Heap::make<DivisionFunction>(global));
 	
+	global->bindArg("gc", Heap::make<GcFunction>(global));
+	global->bindArg("gc-stats", Heap::make<GcStatsFunction>(global));
+	global->bindArg("heap-stats", Heap::make<HeapStatsFunction>(global));
+	global->bindArg("load", Heap::make<LoadFunction>(global, this));
 	
-	global->bindArg("<", std::make_shared<LessFunction>(global));
-	global->bindArg(">", std::make_shared<GreaterFunction>(global));
-	global->bindArg("=", std::make_shared<EqualFunction>(global));
+	TypedVectorFunction::defineAll(global);
+	MemoFunction::defineAll(global);
+	FutureFunction::defineAll(global);
+	ProfileSyntax::defineAll(global);
+	ContinuationFunction::defineAll(global);
+	Heap::markRoot(global.get());
 	
-	global->bindArg("+", std::make_shared<AddFunction>(global));
-	global->bindArg("*", std::make_shared<MultiplyFunction>(global));
-	global->bindArg("-", std::make_shared<MinusFunction>(global));
-	global->bindArg("/", std::make_shared<DivisionFunction>(global));
+	builtins = global->getVariables();
+	builtins[Symbol::intern("inlined")->getId()] = inlinedCall;
+	if(prelude)
+	{
+		eval("(define not (lambda (x) (if x #f #t)))");
+	}
 	
 	
 	
@@ -818,52 +1719,72 @@ SchemeInterpreter::SchemeInterpreter()
 	" * : multiply\n"
 	" - : minus\n"
 	" / : division\n"
+	" load - (load \"file.scm\") evaluates the forms of a file\n"
+	" gc - runs a full garbage collection, returns the number of freed objects\n"
+	" gc-stats - collection counts, pause times (microseconds), promoted/reclaimed memory of the garbage collector and allocations\n"
+	" heap-stats - live objects and bytes by kind (numbers, lists, lambdas, environments), interned symbols, live and peak bytes of the heap\n"
+	" make-s32vector, make-s64vector - (make-s64vector n [fill]) creates a typed vector of 32 or 64 bit integers\n"
+	" s32vector, s64vector - (s64vector 1 2 3) creates a typed vector of the arguments\n"
+	" s32vector-length, s32vector-ref, s32vector-set! (and the same for s64) - (s64vector-set! v i x)\n"
+	" vector+, vector-, vector*, vector/, vector<, vector>, vector= - element-wise operations on typed vectors (or a vector and a number)\n"
+	" vector-map - (vector-map op v w) applies +, -, *, /, <, > or = element-wise\n"
+	" vector-sum, vector-min, vector-max, vector-dot - reductions of typed vectors\n"
+	" simd-isa - the instruction set the typed vector operations run on\n"
+	" memoize - (memoize f [capacity]) a function that remembers the results of f for the last capacity arguments (4096 by default)\n"
+	" define-memoized - (define-memoized (fib n) body [capacity]) defines a memoized function, its recursive calls are memoized too\n"
+	" memo-stats - (memo-stats f) hits, misses, evictions, size and capacity of a memoized function\n"
+	" future - (future exp) evaluates exp on a worker thread, (touch f) waits for its value - futures should not define or redefine globals\n"
+	" parallel-map - (parallel-map f list) calls f on the elements of list on the worker threads\n"
+	" future-workers - the number of worker threads (one per core)\n"
+	" call/ec - (call/ec f) calls f with an escape continuation k, (k v) makes call/ec return v at once - call-with-escape-continuation is the same\n"
+	" call/cc - like call/ec: the continuations can only escape, once - call-with-current-continuation is the same\n"
+	" profile - (profile exp [file]) evaluates exp, and prints the calls, time and allocations of the functions it called, file gets the stacks for flame graphs\n"
+	" profile-sample - (profile-sample exp [file]) like profile, but samples the running function every millisecond instead of timing every call\n"
 	" You can call a function by placing the function and the parameters in a list:\n"
-	" (function param1 param2)\n";
+	" (function param1 param2)\n"
+	"\n"
+	" enginetree - evaluate with the tree walking evaluator (default)\n"
+	" enginebytecode - compile forms to bytecode and run them on the VM\n"
+	" dumpbytecode - toggles printing the bytecode of each form\n"
+	" optimize - toggles the optimizer (constant folding, dead if branches, inlining small functions), it is on by default\n"
+	" dumpoptimized - toggles printing each form after the optimizer\n"
+	" dumptrace - prints the calls and evaluations recorded since the last dumptrace while the log level was logdebug\n"
+	" allocstats - toggles printing the allocations and the change of the live bytes after each result\n";
 	
 }
 
 std::shared_ptr<Sexp> SchemeInterpreter::eval(std::string str)
 {
-	
-	std::istringstream ss(str);
-	return eval(read(ss));
+	Activation activation{*this};
+	Lexer lexer{std::move(str), "<string>"};
+	std::shared_ptr<Sexp> exp = read(lexer);
+	return exp == nullptr ? nullptr : eval(exp);
 }
 
 std::shared_ptr<Sexp> SchemeInterpreter::createAtom(std::string temp)
 {
 
-	int num = strtol(temp.c_str(), nullptr, 10);
-	if(num != 0 || temp == "0")
+	std::shared_ptr<Number> num = Number::parse(temp);
+	if(num != nullptr)
 	{
-		return std::make_shared<Number>(num);
+		return num;
 	}
 	else
 	{
-		return std::make_shared<Symbol>(temp);
+		return Symbol::intern(temp);
 	}
 }
 
-std::shared_ptr<Sexp> SchemeInterpreter::readAtom(char c, std::istream& is)
+std::shared_ptr<Sexp> SchemeInterpreter::readAtom(const std::string& text)
 {
-	std::string temp;
-	getline (is, temp);
-	temp.insert(temp.begin(), c);
-	size_t varlength = temp.find_first_of("; \t\n\v\f\r");
-	temp = varlength != std::string::npos ? temp.substr(0, varlength) : temp;
-	
-	
-	std::shared_ptr<Sexp> expression = global->getValue(temp);
+	Activation activation{*this};
+	std::shared_ptr<Sexp> expression = Number::parse(text);
 	if(expression == nullptr)
 	{
-		int num = strtol(temp.c_str(), nullptr, 10);
-		if(num != 0 || temp == "0")
-		{
-			expression = std::make_shared<Number>(num);
-		}
-		else
+		expression = global->getValue(SymbolTable::intern(text));
+		if(expression == nullptr)
 		{
-			loge << "undefined variable: " << temp << "\n";
+			loge << "undefined variable: " << text << "\n";
 			return nullptr;
 		}
 	}
@@ -871,101 +1792,125 @@ std::shared_ptr<Sexp> SchemeInterpreter::readAtom(char c, std::istream& is)
 }
 
 
-std::shared_ptr<Sexp> SchemeInterpreter::read(std::istream& is)
+std::shared_ptr<Sexp> SchemeInterpreter::read(Lexer& lexer)
 {
-	
-	char c;
-	
-	while(is.get(c) && isspace(c));
-	if(c != '(')
+	Activation activation{*this};
+	Lexer::Token token = lexer.next();
+	switch(token.type)
 	{
-		//atom
-		return readAtom(c);
+		case Lexer::TokenType::END:
+			return nullptr;
+		case Lexer::TokenType::ATOM:
+			return readAtom(token.text);
+		case Lexer::TokenType::STRING:
+			return Heap::make<String>(std::move(token.text));
+		case Lexer::TokenType::OPEN:
+			break;
+		case Lexer::TokenType::CLOSE:
+			loge << lexer.location(token) << ": unexpected )\n";
+			readFailed = true;
+			return nullptr;
+		case Lexer::TokenType::ERROR:
+			loge << lexer.location(token) << ": " << token.text << "\n";
+			readFailed = true;
+			return nullptr;
 	}
-	else
+	
+	//elements of the lists opened so far, the innermost one is the last
+	std::vector<std::vector<std::shared_ptr<Sexp>>> listElements(1);
+	std::vector<Lexer::Token> opened{token};
+	while(true)
 	{
-		//list
-		bool comment = false;
-		
-		int parentheses = 1;
-		std::vector<std::vector<std::shared_ptr<Sexp>>> listElements;
-		listElements.push_back(std::vector<std::shared_ptr<Sexp>>());
-		
-		std::string temp;
-		do
+		token = lexer.next();
+		switch(token.type)
 		{
-			bool wasDelimiter = false;
-			while(comment)
-			{
-				is.get(c);
-				if(c == '\n')
+			case Lexer::TokenType::OPEN:
+				listElements.emplace_back();
+				opened.push_back(std::move(token));
+				break;
+			case Lexer::TokenType::CLOSE:
 				{
-					comment = false;
-				}
-			}
-			while(is.get(c) && isspace(c)){
-				wasDelimiter = true;
-			}
-			if(c == '(' || c == ')')
-			{
-				wasDelimiter = true;
-			}
-			if(wasDelimiter && temp.size() > 0)
-			{
-				listElements[parentheses - 1].push_back(createAtom(temp));
-				temp = "";
-			}
-			switch (c)
-			{
-				case ')' :
-				{
-					parentheses--;
-					std::shared_ptr<List> l = std::make_shared<List>(listElements[parentheses]);
+					std::shared_ptr<List> l = Heap::make<List>(listElements.back());
 					logd << *l << "\n";
 					listElements.pop_back();
-					if(parentheses > 0)
-					{
-						listElements[parentheses - 1].push_back(l);
-					}
-					else
-					{
-						std::string line;
-						getline(is, line);
+					opened.pop_back();
+					if(listElements.empty())
 						return l;
-					}
-					break;
-				}
-				case '(' :
-				{
-					parentheses++;
-					listElements.push_back(std::vector<std::shared_ptr<Sexp>>());
-					break;
-				}
-				case ';' :
-				{
-					//comment
-					comment = true;
-					break;
-				}
-				default:
-				{
-					temp.push_back(c);
-					break;
+					listElements.back().push_back(l);
 				}
-			}
-			
+				break;
+			case Lexer::TokenType::ATOM:
+				listElements.back().push_back(createAtom(token.text));
+				break;
+			case Lexer::TokenType::STRING:
+				listElements.back().push_back(Heap::make<String>(std::move(token.text)));
+				break;
+			case Lexer::TokenType::END:
+				loge << lexer.location(opened.back()) << ": ( is not closed\n";
+				readFailed = true;
+				return nullptr;
+			case Lexer::TokenType::ERROR:
+				loge << lexer.location(token) << ": " << token.text << "\n";
+				readFailed = true;
+				return nullptr;
 		}
-		while(parentheses > 0);
 	}
-	
-	throw("parsing error");
-	
-	
 }
 
 std::shared_ptr<Sexp> SchemeInterpreter::eval(std::shared_ptr<Sexp> exp)
 {
-	return exp->eval(global);
+	Activation activation{*this};
+	const HeapStats& stats = Heap::getStats();
+	size_t allocations = stats.allocations, allocatedBytes = stats.allocatedBytes;
+	int64_t liveBytes = stats.totalLiveBytes;
+	if(optimize)
+	{
+		exp = Optimizer{global, inlinedCall}.optimize(exp);
+		if(dumpOptimized)
+			std::cout << "optimized: " << *exp << "\n";
+	}
+	if(engine == Engine::BYTECODE)
+	{
+		std::shared_ptr<CodeObject> code = BytecodeCompiler{global}.compileTopLevel(exp);
+		if(dumpBytecode)
+			code->dump(std::cout);
+		exp = VirtualMachine::run(code, global);
+	}
+	else
+	{
+		exp = exp->eval(global);
+	}
+	//an escape its call/ec didn't take ends with the form
+	Continuation::clear();
+	//between top level forms only shared_ptrs refer to tracked objects, so the collector can run
+	Heap::collectIfNeeded();
+	lastEval = EvalAllocations{stats.allocations - allocations, stats.allocatedBytes - allocatedBytes, stats.totalLiveBytes - liveBytes, stats.peakLiveBytes};
+	return exp;
+}
+
+void SchemeInterpreter::setEngine(Engine engine)
+{
+	this->engine = engine;
+}
+
+void SchemeInterpreter::setDumpBytecode(bool dump)
+{
+	dumpBytecode = dump;
+}
+
+void SchemeInterpreter::setOptimize(bool optimize)
+{
+	this->optimize = optimize;
+}
+
+void SchemeInterpreter::setDumpOptimized(bool dump)
+{
+	dumpOptimized = dump;
+}
+
+void SchemeInterpreter::setPrintAllocations(bool print)
+{
+	printAllocations = print;
 }
 
 void SchemeInterpreter::print(std::shared_ptr<Sexp> exp)
@@ -973,84 +1918,204 @@ void SchemeInterpreter::print(std::shared_ptr<Sexp> exp)
 	std::cout << *exp << "\n";
 }
 
+bool SchemeInterpreter::command(std::shared_ptr<Sexp> exp)
+{
+	if (exp == exit)
+	{
+		exited = true;
+		return true;
+	}
+	if (exp == help)
+	{
+		std::cout << helpDialog;
+		return true;
+	}
+	if (exp == symbol_logdebug)
+	{
+		if(trace == nullptr)
+		{
+			trace.reset(new TraceBuffer());
+			logSettings.trace = trace.get();
+		}
+		logSettings.level = LogLevel::DEBUG;
+	}
+	if (exp == symbol_logerror)
+	{
+		logSettings.level = LogLevel::ERROR;
+	}
+	if (exp == symbol_lognone)
+	{
+		logSettings.level = LogLevel::NONE;
+	}
+	if (exp == symbol_enginetree)
+	{
+		setEngine(Engine::TREE);
+	}
+	if (exp == symbol_enginebytecode)
+	{
+		setEngine(Engine::BYTECODE);
+	}
+	if (exp == symbol_dumpbytecode)
+	{
+		setDumpBytecode(!dumpBytecode);
+	}
+	if (exp == symbol_optimize)
+	{
+		setOptimize(!optimize);
+	}
+	if (exp == symbol_dumpoptimized)
+	{
+		setDumpOptimized(!dumpOptimized);
+	}
+	if (exp == symbol_dumptrace)
+	{
+		dumpTrace(std::cout);
+	}
+	if (exp == symbol_allocstats)
+	{
+		setPrintAllocations(!printAllocations);
+	}
+	return false;
+}
+
 void SchemeInterpreter::run()
 {
+	Activation activation{*this};
+	Lexer lexer{std::cin};
 	exited = false;
 	while(!exited)
 	{
 		std::cout << ">";
-		std::shared_ptr<Sexp> exp = read();
+		std::shared_ptr<Sexp> exp = read(lexer);
 		
-		if (exp == exit)
+		if(exp == nullptr)
 		{
-			exited = true;
+			exited = lexer.atEnd();
 			continue;
 		}
-		if (exp == help)
+		if(command(exp))
 		{
-			std::cout << helpDialog;
 			continue;
 		}
-		if (exp == symbol_logdebug)
-		{
-			Log = LogSettings{LogLevel::DEBUG};
-		}
-		if (exp == symbol_logerror)
-		{
-			Log = LogSettings{LogLevel::ERROR};
-		}
-		if (exp == symbol_lognone)
+		exp = eval(exp);
+		if(exp != nullptr)
+			print(exp);
+		if(printAllocations)
 		{
-			Log = LogSettings{LogLevel::NONE};
+			std::cout << "; " << lastEval.allocations << " allocations, " << lastEval.allocatedBytes << " bytes, live "
+				<< (lastEval.liveBytesDelta >= 0 ? "+" : "") << lastEval.liveBytesDelta << " bytes, peak " << lastEval.peakLiveBytes << " bytes\n";
 		}
-		
+	}
+	std::cout << "Program terminated\n";
+}
+
+bool SchemeInterpreter::evalAll(Lexer& lexer)
+{
+	Activation activation{*this};
+	bool parsed = true;
+	while(!exited)
+	{
+		readFailed = false;
+		std::shared_ptr<Sexp> exp = read(lexer);
 		if(exp == nullptr)
 		{
+			//the error is already logged, the reading goes on after it
+			parsed = parsed && !readFailed;
+			if(lexer.atEnd())
+				break;
 			continue;
 		}
-		exp = eval(exp);
-		if(exp != nullptr)
-			print(exp);
-		
+		if(!command(exp))
+			eval(exp);
 	}
-	std::cout << "Program terminated\n";
+	return parsed;
 }
 
+bool SchemeInterpreter::load(const std::string& path)
+{
+	Activation activation{*this};
+	std::string text;
+	if(!Lexer::readFile(path, text))
+	{
+		loge << "can't read " << path << "\n";
+		return false;
+	}
+	Lexer lexer{std::move(text), path};
+	return evalAll(lexer);
+}
 
-SchemeInterpreter::~SchemeInterpreter()
+bool SchemeInterpreter::hasExited() const
 {
-	//read comments of Environment::clearFunctionReferences() in header
-	global->clearFunctionReferences();
+	return exited;
 }
 
+bool SchemeInterpreter::saveImage(const std::string& path) const
+{
+	Activation activation{*this};
+	return HeapImage::save(path, *global, builtins);
+}
 
-LogSettings::LogSettings(LogLevel level) : level{level} {}
+bool SchemeInterpreter::loadImage(const std::string& path)
+{
+	Activation activation{*this};
+	return HeapImage::load(path, global, builtins);
+}
 
-template <typename T>
-ErrorLog& ErrorLog::operator << (T&& t)
+void SchemeInterpreter::dumpTrace(std::ostream& os) const
 {
-	if(Log.level >= LogLevel::ERROR)
-		std::cout << std::forward<T>(t);
-	return *this;
+	Activation activation{*this};
+	if(trace != nullptr)
+		trace->dump(os, global.get());
 }
 
-template <typename T>
-DebugLog& DebugLog::operator << (T&& t)
+HeapStats SchemeInterpreter::getHeapStats() const
 {
-	if(Log.level >= LogLevel::DEBUG)
-		std::cout << std::forward<T>(t);
-	return *this;
+	Activation activation{*this};
+	return Heap::getStats();
+}
+
+const EvalAllocations& SchemeInterpreter::getLastEvalAllocations() const
+{
+	return lastEval;
+}
+
+void SchemeInterpreter::bindNative(const std::string& name, const std::function<std::shared_ptr<Lambda>(std::shared_ptr<Environment>)>& make)
+{
+	Activation activation{*this};
+	std::shared_ptr<Lambda> native = make(global);
+	global->bindArg(name, native);
+	builtins[Symbol::intern(name)->getId()] = native;
+}
+
+
+SchemeInterpreter::~SchemeInterpreter()
+{
+	//the global environment and the functions in it reference each other,
+	// the collector frees them once the interpreter lets go of the environment
+	Activation activation{*this};
+	futures->wait();
+	builtins.clear();
+	inlinedCall = nullptr;
+	global = nullptr;
+	Heap::collect();
+}
+
+
+LogSettings::LogSettings(LogLevel level, TraceBuffer* trace) : level{level}, trace{trace} {}
+
+namespace
+{
+	const LogSettings defaultLogSettings{LogLevel::ERROR};
 }
 
+thread_local const LogSettings* LogSettings::active = &defaultLogSettings;
 
-template <typename T>
-ErrorLog& ErrorLogProxy::operator << (T&& t)
+LogSettings::Scope::Scope(const LogSettings& settings) : previous{active}
 {
-	return logerror << "Error: " << std::forward<T>(t);
+	active = &settings;
 }
 
-template <typename T>
-DebugLog& DebugLogProxy::operator << (T&& t)
+LogSettings::Scope::~Scope()
 {
-	return logdebug << "Debug: " << std::forward<T>(t);
+	active = previous;
 }
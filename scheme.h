@@ -2,7 +2,15 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <unordered_map>
+#include <deque>
 #include <memory>
+#include <mutex>
+#include <functional>
+
+#include "heap.h"
+#include "bignum.h"
+#include "lexer.h"
 
 
 
@@ -12,12 +20,59 @@
 
 
 class Environment;
-/**	S-expression or "symbolic expression" - the base class of all expressions */
-class Sexp
+class Lambda;
+struct TailCall;
+
+/**	kind tag of the expressions, the evaluator dispatches on it instead of dynamic_cast
+ * 	the classes are still there for printing, and to extend them */
+enum class Kind : unsigned char
+{
+	NUMBER,
+	SYMBOL,
+	/**	a variable resolved to its lexical address */
+	LOCAL_VARIABLE,
+	/**	a global variable resolved to its cell */
+	GLOBAL_VARIABLE,
+	/**	the value of (future exp) (see future.h) */
+	FUTURE,
+	LIST,
+	/**	s32vector or s64vector (see typedvector.h) */
+	TYPED_VECTOR,
+	STRING,
+	/**	the body of a lambda expression the optimizer rewrote, with the body as written (see optimizer.h) */
+	OPTIMIZED_BODY,
+	/**	a resolved lambda expression, evaluates to a closure */
+	LAMBDA_EXPRESSION,
+	/**	user lambda run by the tree walking evaluator */
+	CLOSURE,
+	/**	user lambda compiled to bytecode */
+	COMPILED_CLOSURE,
+	/**	function implemented in C++, gets its arguments evaluated */
+	PRIMITIVE,
+	/**	define, lambda, if: get their arguments unevaluated */
+	SPECIAL_FORM
+};
+
+/**	S-expression or "symbolic expression" - the base class of all expressions
+ * 	expressions are always owned by shared_ptrs, so self evaluating ones can return themselves */
+class Sexp : public std::enable_shared_from_this<Sexp>
 {
+	Kind kind;
+protected:
+	Sexp(Kind kind);
 public:
+	Kind getKind() const {return kind;}
+	
+	/**	closures, primitives and special forms (all of them are Lambdas) */
+	bool isLambda() const {return kind >= Kind::CLOSURE;}
+	
 	/**	an expression can be evaluated in a context*/
 	virtual std::shared_ptr<Sexp> eval(std::shared_ptr<Environment> context) const = 0;
+	
+	/**	evaluation in tail position: instead of evaluating an expression in tail position (a branch of if, the body of a called lambda)
+	 * 	it can be stored in tail, and the driver loop in TailCall::run evaluates it without growing the C++ stack
+	 * 	the default evaluates the whole expression with eval */
+	virtual std::shared_ptr<Sexp> evalTail(std::shared_ptr<Environment> context, TailCall& tail) const;
 	virtual void print(std::ostream &os) const = 0;
 	virtual ~Sexp();
 	
@@ -26,65 +81,208 @@ public:
 	
 };
 
+/**	a handle of an object that lives until the process exits, shared by all the interpreters (the cached numbers, the symbols)
+ * 	the handle has no reference count: copying and dropping it doesn't write to a cache line that the threads of every interpreter write to
+ * 	owner keeps the object alive, and its shared_from_this working */
+template <typename T>
+std::shared_ptr<T> immortal(const std::shared_ptr<T>& owner)
+{
+	return std::shared_ptr<T>(std::shared_ptr<T>(), owner.get());
+}
+
 class List;
+class Symbol;
 
-/**	Environment is a context for storing variable bindings, and they can refer to their parents (except the global context) */
-class Environment
+/**	SymbolTable interns symbol names: each name is stored once, and identified by a small integer id,
+ * 	so symbols and variable bindings can be compared by id instead of by string */
+class SymbolTable
+{
+	/**	the table is shared by the interpreters of the process, which can run on different threads
+	 * 	recursive, as making a Symbol looks its name up */
+	std::recursive_mutex mutex;
+	std::unordered_map<std::string, int> ids;
+	/**	deque, so references to names stay valid when new names are interned */
+	std::deque<std::string> names;
+	/**	the owners of the Symbols, symbol hands out immortal handles of them */
+	std::vector<std::shared_ptr<Symbol>> symbols;
+	
+	SymbolTable();
+	static SymbolTable& instance();
+public:
+	/**	ids of symbols the interpreter itself refers to - they are interned first */
+	enum : int {False = 0, True = 1};
+	
+	/**	returns the id of name, interning it if it is new */
+	static int intern(const std::string& name);
+	
+	static const std::string& name(int id);
+	
+	/**	the unique Symbol object belonging to the id, an immortal handle */
+	static std::shared_ptr<Symbol> symbol(int id);
+	
+	/**	number of interned names, and the bytes of the names and of the Symbol objects made of them
+	 * 	symbols are shared by the interpreters, so they are not counted by the heaps */
+	static size_t count();
+	static size_t bytes();
+};
+
+/**	the binding of a global variable: the global environment has one cell per name, created when the name is bound or first referenced from a lambda
+ * 	redefining the variable updates the value of the cell in place, so the references resolved to the cell (GlobalVariable, the global
+ * 	operands of compiled code) read the variable with a single load, without looking its name up */
+struct GlobalCell
+{
+	int id;
+	/**	nullptr while the variable is unbound */
+	std::shared_ptr<Sexp> value;
+};
+
+/**	Environment is a context for storing variable bindings, and they can refer to their parents (except the global context)
+ * 	The global environment stores its bindings in a map, environments of function calls (frames)
+ * 	store the arguments in a flat array in the order of the lambda's argument names
+ * 	the callers evaluate the arguments straight into the slots, frames of up to INLINE_SLOTS arguments need no allocation besides the frame */
+class Environment : public Collectable, public std::enable_shared_from_this<Environment>
 {
 	std::shared_ptr<Environment> parent;
-	std::map<std::string, std::shared_ptr<Sexp>> variables;
+	/**	keys are interned symbol ids, the cells are shared with the references resolved to them */
+	std::unordered_map<int, std::shared_ptr<GlobalCell>> variables;
+	/**	futures look variables up and add cells on other threads (see future.h), so the global environment guards variables with it, nullptr for frames */
+	mutable std::unique_ptr<std::mutex> variablesMutex;
+	
+	/**	argument names of the lambda the frame belongs to, nullptr for the global environment */
+	std::shared_ptr<const std::vector<int>> names;
+	
+	enum : size_t {INLINE_SLOTS = 4};
+	std::shared_ptr<Sexp> inlineSlots[INLINE_SLOTS];
+	/**	storage for frames with more than INLINE_SLOTS arguments */
+	std::unique_ptr<std::shared_ptr<Sexp>[]> extraSlots;
+	/**	inlineSlots or extraSlots */
+	std::shared_ptr<Sexp>* slots;
+	size_t slotCount;
 	
 public:
-	Environment(std::shared_ptr<Environment> parent = nullptr, std::vector<std::string> names = std::vector<std::string>(), std::shared_ptr<List> values = nullptr);
+	static constexpr AllocationKind ALLOCATION_KIND = AllocationKind::ENVIRONMENT;
 	
-	void bindArg(std::string name, std::shared_ptr<Sexp> val);
+	/**	the slots of frames start unbound, the caller fills them with setSlot */
+	Environment(std::shared_ptr<Environment> parent = nullptr, std::shared_ptr<const std::vector<int>> names = nullptr);
+	Environment(const Environment&) = delete;
+	Environment& operator=(const Environment&) = delete;
 	
-	std::shared_ptr<Sexp> getValue(std::string name);
+	void bindArg(int id, std::shared_ptr<Sexp> val);
+	void bindArg(const std::string& name, std::shared_ptr<Sexp> val);
 	
-	void print(std::ostream& os) const;
+	std::shared_ptr<Sexp> getValue(int id);
+	std::shared_ptr<Sexp> getValue(const std::string& name);
 	
-	static Environment* Global;
+	/**	value of a variable by its lexical address: the slot in the frame depth levels above this one */
+	const std::shared_ptr<Sexp>& getSlot(int depth, int slot) const;
+	void setSlot(int slot, std::shared_ptr<Sexp> val);
+	/**	number of argument slots of the frame, 0 for the global environment */
+	size_t getSlotCount() const;
 	
+	Environment* getParent() const;
 	
-	/**	functions in global environment reference the global environment and the global environment references them
-	 * 	so the shared reference loop must be broken to be able to destroy them */
-	void clearFunctionReferences();
+	/**	argument names of the frame, nullptr for the global environment */
+	const std::vector<int>* getNames() const;
+	
+	/**	the cell of a global variable, an unbound one is created if id has none yet - only for the global environment */
+	const std::shared_ptr<GlobalCell>& getCell(int id);
+	
+	/**	bindings of the global environment (frames keep their arguments in slots), without the unbound cells */
+	std::unordered_map<int, std::shared_ptr<Sexp>> getVariables() const;
+	
+	void print(std::ostream& os) const;
+	
+	std::shared_ptr<void> sharedFromThis();
+	void traverse(References& references) const;
+	void clearReferences();
+	size_t gcSize() const;
 };
 
 std::ostream & operator<<(std::ostream & os, const Environment& e);
 
+/**	adds s to the references if it is tracked by the collector (lists and lambdas), for the traverse methods of Collectables */
+void addReference(References& references, const std::shared_ptr<Sexp>& s);
+
+/**	an expression left to be evaluated in tail position (see Sexp::evalTail) */
+struct TailCall
+{
+	std::shared_ptr<Sexp> exp;
+	std::shared_ptr<Environment> context;
+	/**	the closure exp is the body of, if it was left by a call (see Lambda::evalFrame), for the Profiler */
+	const Lambda* callee;
+	
+	TailCall(std::shared_ptr<Sexp> exp = nullptr, std::shared_ptr<Environment> context = nullptr, const Lambda* callee = nullptr);
+	
+	/**	evaluates exp in context, and then every expression left in tail position, until there is a result
+	 * 	this is what makes tail calls run in constant C++ stack space */
+	static std::shared_ptr<Sexp> run(std::shared_ptr<Sexp> exp, std::shared_ptr<Environment> context, const Lambda* callee = nullptr);
+};
+
 
 std::ostream & operator<<(std::ostream & os, const Sexp& e);
 
 /**	Atom is the base class of Symbol and Number */
 class Atom : public Sexp
 {
+protected:
+	Atom(Kind kind);
 public:
 	virtual ~Atom();
 };
 
-/**	Number is an integer */
+/**	Number is an exact integer: a 64 bit fixnum, or a BigInt if it doesn't fit in one
+ * 	numbers are immutable, so small ones are preallocated and shared: get numbers with Number::make */
 class Number : public Atom
 {
-	int value;
+	int64_t value;
+	/**	the value if it doesn't fit in a fixnum, nullptr for fixnums */
+	std::unique_ptr<const BigInt> big;
 	
 public:
-	Number(int val = 0);
+	/**	range of the preallocated numbers */
+	enum : int {CACHE_MIN = -1024, CACHE_MAX = 16383};
+	
+	static constexpr AllocationKind ALLOCATION_KIND = AllocationKind::NUMBER;
+	
+	Number(int64_t val = 0);
+	Number(BigInt val);
+	
+	/**	a preallocated number (an immortal handle) if val is in the cached range, a new one otherwise */
+	static std::shared_ptr<Number> make(int64_t val);
+	/**	a fixnum if val fits in one */
+	static std::shared_ptr<Number> make(BigInt val);
+	
+	/**	parses an integer literal of any length, nullptr if text is not one */
+	static std::shared_ptr<Number> parse(const std::string& text);
+	
+	bool isFixnum() const {return big == nullptr;}
+	/**	the value of a fixnum */
+	int64_t getFixnum() const {return value;}
+	BigInt toBigInt() const;
+	
+	/**	numbers evaluate to themselves */
 	std::shared_ptr<Sexp> eval(std::shared_ptr<Environment> context) const;
 	virtual void print(std::ostream &os) const;
 	
-	operator int();
 	~Number();
 };
 
-/**	Symbol is a variable name */
+/**	Symbol is a variable name
+ * 	symbols are interned: there is only one Symbol object for each name, get it with Symbol::intern */
 class Symbol : public Atom
 {
-	std::string Name;
+	int id;
+	const std::string* Name;
 public:
-	Symbol(std::string Name);
+	Symbol(int id);
 	
-	std::string getName() const;
+	static std::shared_ptr<Symbol> intern(const std::string& name);
+	
+	/**	the #t or #f symbol */
+	static const std::shared_ptr<Symbol>& boolean(bool value);
+	
+	int getId() const;
+	const std::string& getName() const;
 	virtual void print(std::ostream &os) const;
 	
 	std::shared_ptr<Sexp> eval(std::shared_ptr<Environment> context) const;
@@ -97,17 +295,72 @@ public:
 
 
 
+/**	String is a string literal, it evaluates to itself */
+class String : public Atom
+{
+	std::string value;
+public:
+	String(std::string value);
+	
+	const std::string& getValue() const;
+	
+	std::shared_ptr<Sexp> eval(std::shared_ptr<Environment> context) const;
+	/**	prints the literal: in quotes, with " and \\ escaped */
+	virtual void print(std::ostream &os) const;
+};
+
+
+/**	variable reference inside a lambda body, resolved to its lexical address by LexicalResolver
+ * 	depth is the number of frames to go up, slot is the index of the argument in that frame */
+class LocalVariable : public Atom
+{
+	int id;
+	int depth;
+	int slot;
+public:
+	LocalVariable(int id, int depth, int slot);
+	
+	int getId() const;
+	int getDepth() const;
+	int getSlot() const;
+	
+	std::shared_ptr<Sexp> eval(std::shared_ptr<Environment> context) const;
+	virtual void print(std::ostream &os) const;
+};
+
+
+/**	global variable reference inside a lambda body, resolved to its cell by LexicalResolver */
+class GlobalVariable : public Atom
+{
+	std::shared_ptr<GlobalCell> cell;
+public:
+	GlobalVariable(std::shared_ptr<GlobalCell> cell);
+	
+	int getId() const;
+	const std::shared_ptr<GlobalCell>& getCell() const;
+	
+	std::shared_ptr<Sexp> eval(std::shared_ptr<Environment> context) const;
+	virtual void print(std::ostream &os) const;
+};
+
+
 class ListForwardIterator;
 class ConstListForwardIterator;
 
 /**	List  - also known as a Cons cell */
-class List : public Sexp
+class List : public Sexp, public Collectable
 {
 	std::shared_ptr<Sexp> car;
 	std::shared_ptr<List> cdr;
 public:
+	static constexpr AllocationKind ALLOCATION_KIND = AllocationKind::LIST;
+	
 	List(std::shared_ptr<Sexp> car = nullptr, std::shared_ptr<List> cdr = nullptr);
 	List(std::vector<std::shared_ptr<Sexp>> elements);
+	List(const std::shared_ptr<Sexp>* elements, size_t count);
+	
+	/**	arguments of primitive calls up to this count are collected without allocating */
+	enum : size_t {ARGUMENT_BUFFER_SIZE = 4};
 	
 	std::shared_ptr<Sexp> Car();
 	std::shared_ptr<List> Cdr();
@@ -120,6 +373,9 @@ public:
 	
 	/**	if car/head is a function then call it with cdr/tail as arguments */
 	virtual std::shared_ptr<Sexp> eval(std::shared_ptr<Environment> context) const;
+	
+	/**	like eval, but the body of a called lambda (or the chosen branch of an if) is left in tail */
+	virtual std::shared_ptr<Sexp> evalTail(std::shared_ptr<Environment> context, TailCall& tail) const;
 	~List();
 	
 	using iterator = ListForwardIterator;
@@ -131,6 +387,11 @@ public:
 	
 	const_iterator begin() const;
     const_iterator end() const;
+	
+	std::shared_ptr<void> sharedFromThis();
+	void traverse(References& references) const;
+	void clearReferences();
+	size_t gcSize() const;
 };
 
 /**	non-const iterator for List */
@@ -156,7 +417,7 @@ public:
 };
 
 /**	lambda is an anonymous function */
-class Lambda : public Sexp
+class Lambda : public Sexp, public Collectable
 {
 protected:
 
@@ -165,13 +426,34 @@ protected:
 	/**	arglist is a list of symbols */
 	std::shared_ptr<List> arglist;
 	std::shared_ptr<Sexp> body;
+	/**	the body as written if the optimizer rewrote it, printed instead of body (nullptr otherwise) */
+	std::shared_ptr<Sexp> source;
 	
-	/**	args is just the names of the symbols in arglist */
-	std::vector<std::string> args;
+	/**	args is just the interned ids of the symbols in arglist, shared with the frames of the calls */
+	std::shared_ptr<const std::vector<int>> args;
 	
 public:
+	static constexpr AllocationKind ALLOCATION_KIND = AllocationKind::LAMBDA;
+	
 	Lambda(std::shared_ptr<Environment> env);
 	Lambda(std::shared_ptr<Environment> env, std::shared_ptr<List> arglist, std::shared_ptr<Sexp> body);
+	/**	Kind::CLOSURE if there is a body, Kind::PRIMITIVE otherwise */
+	Lambda(std::shared_ptr<Environment> env, std::shared_ptr<List> arglist, std::shared_ptr<const std::vector<int>> args, std::shared_ptr<Sexp> body, std::shared_ptr<Sexp> source = nullptr);
+protected:
+	Lambda(Kind kind, std::shared_ptr<Environment> env, std::shared_ptr<List> arglist, std::shared_ptr<const std::vector<int>> args, std::shared_ptr<Sexp> body, std::shared_ptr<Sexp> source = nullptr);
+public:
+	
+	/**	if arglist is a list of symbols */
+	static bool isArglist(const std::shared_ptr<Sexp>& arglist);
+	/**	the interned ids of the symbols in arglist, nullptr (and logs the error) if it is not a list of symbols */
+	static std::shared_ptr<const std::vector<int>> argumentIds(std::shared_ptr<Sexp> arglist);
+	
+	/**	the environment the lambda was created in */
+	std::shared_ptr<Environment> getEnv() const;
+	std::shared_ptr<List> getArglist() const;
+	std::shared_ptr<Sexp> getBody() const;
+	/**	the body as written, nullptr if it is body */
+	std::shared_ptr<Sexp> getSource() const;
 	
 	/**	lambdas return themselves */
 	virtual std::shared_ptr<Sexp> eval(std::shared_ptr<Environment> context) const;
@@ -180,8 +462,70 @@ public:
 	/**	function call - this involves creating a new environment*/
 	virtual std::shared_ptr<Sexp> eval(std::shared_ptr<Environment> context, std::shared_ptr<List> params) const;
 	
-	/**	Environment::clearFunctionReferences uses this */
-	void clearEnv();
+	/**	an unbound frame for a call, the caller evaluates the arguments into its slots, and calls evalFrame with it
+	 * 	nullptr for functions without a body (primitives, syntax), they get their arguments in a list */
+	std::shared_ptr<Environment> makeFrame() const;
+	
+	/**	a frame from makeFrame, bound to the values of params, nullptr (and logs an error) if their number is wrong */
+	std::shared_ptr<Environment> bindFrame(std::shared_ptr<List> params) const;
+	
+	/**	function call with a frame from makeFrame: the body is left in tail with the frame
+	 * 	subclasses with a different way of calling override it */
+	virtual std::shared_ptr<Sexp> evalFrame(std::shared_ptr<Environment> frame, TailCall& tail) const;
+	
+	/**	evalFrame, and the tail calls it leaves, until there is a result */
+	std::shared_ptr<Sexp> run(std::shared_ptr<Environment> frame) const;
+	
+	/**	call of a primitive with two evaluated arguments, the callers use it instead of eval to skip building the argument list
+	 * 	the default builds the list and calls eval, the arithmetic and compare primitives override it */
+	virtual std::shared_ptr<Sexp> evalBinary(const std::shared_ptr<Sexp>& left, const std::shared_ptr<Sexp>& right) const;
+	
+	/**	function call in tail position: user lambdas create the new environment, and leave their body in tail
+	 * 	functions without a body (primitives, syntax) call eval, subclasses with a different way of calling override it */
+	virtual std::shared_ptr<Sexp> evalTail(std::shared_ptr<Environment> context, std::shared_ptr<List> params, TailCall& tail) const;
+	
+	std::shared_ptr<void> sharedFromThis();
+	void traverse(References& references) const;
+	void clearReferences();
+	size_t gcSize() const;
+};
+
+/**	a lambda expression whose body was already resolved by LexicalResolver (nested lambdas are resolved together with the enclosing one)
+ * 	evaluating it creates the closure without going through CreateLambda again */
+class LambdaExpression : public Sexp
+{
+	std::shared_ptr<List> arglist;
+	std::shared_ptr<const std::vector<int>> args;
+	std::shared_ptr<Sexp> body;
+	/**	the body as written, if the optimizer rewrote it (see Lambda) */
+	std::shared_ptr<Sexp> source;
+public:
+	LambdaExpression(std::shared_ptr<List> arglist, std::shared_ptr<const std::vector<int>> args, std::shared_ptr<Sexp> body, std::shared_ptr<Sexp> source = nullptr);
+	
+	std::shared_ptr<List> getArglist() const;
+	std::shared_ptr<Sexp> getBody() const;
+	std::shared_ptr<Sexp> getSource() const;
+	
+	std::shared_ptr<Sexp> eval(std::shared_ptr<Environment> context) const;
+	void print(std::ostream &os) const;
+};
+
+/**	lexical addressing pass: runs when a lambda is created, and rewrites the variable references of its body
+ * 	that are bound by the lambda or the lambdas around it into LocalVariables (frame depth, slot index)
+ * 	and references to global variables into GlobalVariables (the cell of the variable) */
+class LexicalResolver
+{
+	Environment* global;
+	/**	argument names of the enclosing lambdas, innermost first - the index is the frame depth */
+	std::vector<const std::vector<int>*> scopes;
+	
+	/**	the global binding of the head of a form, if it is not shadowed by a local variable */
+	std::shared_ptr<Sexp> specialForm(std::shared_ptr<Sexp> head) const;
+public:
+	/**	context is where the lambda with arguments args is created */
+	LexicalResolver(std::shared_ptr<Environment> context, const std::vector<int>& args);
+	
+	std::shared_ptr<Sexp> resolve(std::shared_ptr<Sexp> exp);
 };
 
 /** base class for define, createlambda, and if */
@@ -211,6 +555,10 @@ class DefineFunction : public SyntaxLambda
 public:
 	DefineFunction(std::shared_ptr<Environment> env);
 	
+	/**	evaluates the value of a definition (the params of define), and sets variable to the name it is bound to
+	 * 	false (and logs the error) if there is no name */
+	static bool definition(std::shared_ptr<Environment> context, std::shared_ptr<List> params, std::shared_ptr<Symbol>& variable, std::shared_ptr<Sexp>& value);
+	
 	virtual std::shared_ptr<Sexp> eval(std::shared_ptr<Environment> context, std::shared_ptr<List> params) const;
 	
 	void print(std::ostream &os) const;
@@ -225,10 +573,14 @@ class IfLambda : public SyntaxLambda
 	
 	virtual std::shared_ptr<Sexp> eval(std::shared_ptr<Environment> context, std::shared_ptr<List> params) const;
 	
+	/**	evaluates the test, and leaves the chosen branch in tail */
+	virtual std::shared_ptr<Sexp> evalTail(std::shared_ptr<Environment> context, std::shared_ptr<List> params, TailCall& tail) const;
+	
 	void print(std::ostream &os) const;
 };
 
-class AndBooleanAggregateFunction : public Lambda
+/**	(and exps...) is #t if every exp is true, the exps after the first false one are not evaluated */
+class AndBooleanAggregateFunction : public SyntaxLambda
 {
 public:
 	AndBooleanAggregateFunction(std::shared_ptr<Environment> env);
@@ -236,7 +588,8 @@ public:
 	void print(std::ostream &os) const;
 };
 
-class OrBooleanAggregateFunction : public Lambda
+/**	(or exps...) is #t if an exp is true, the exps after the first true one are not evaluated */
+class OrBooleanAggregateFunction : public SyntaxLambda
 {
 public:
 	OrBooleanAggregateFunction(std::shared_ptr<Environment> env);
@@ -244,126 +597,289 @@ public:
 	void print(std::ostream &os) const;
 };
 
-
-namespace CommonInteger
-{
-	/**	this is used for basic operations: +, -, *, /, <, >, =
-	 * 	checks if expression is an unbound variable or a non-number
-	 * 	if successful, returns the number, upon failure returns nullptr */
-	Number* ConvertAndCheck(Sexp* s);
-};
-
-/** base class for  <, >, and = boolean operators - they can take more than two args */
-class BasicCompareFunction : public Lambda
+/**	(gc) runs a full collection, returns the number of objects it freed */
+class GcFunction : public Lambda
 {
 public:
-	BasicCompareFunction(std::shared_ptr<Environment> env);
+	GcFunction(std::shared_ptr<Environment> env);
 	virtual std::shared_ptr<Sexp> eval(std::shared_ptr<Environment> context, std::shared_ptr<List> params) const;
-	virtual bool do_operator(int left, int right) const = 0;
-};
-
-class LessFunction : public BasicCompareFunction
-{
-public:
-	LessFunction(std::shared_ptr<Environment> env);
-	virtual bool do_operator(int left, int right) const;
 	void print(std::ostream &os) const;
 };
 
-class GreaterFunction : public BasicCompareFunction
+/**	(gc-stats) returns the collector's telemetry (Heap::getStats) as a list of (name value) lists */
+class GcStatsFunction : public Lambda
 {
 public:
-	GreaterFunction(std::shared_ptr<Environment> env);
-	virtual bool do_operator(int left, int right) const;
+	GcStatsFunction(std::shared_ptr<Environment> env);
+	virtual std::shared_ptr<Sexp> eval(std::shared_ptr<Environment> context, std::shared_ptr<List> params) const;
 	void print(std::ostream &os) const;
 };
 
-class EqualFunction : public BasicCompareFunction
+/**	(heap-stats) returns the live objects and bytes by kind (HeapStats::liveObjects), the interned symbols, and the live and peak bytes of the heap,
+ * 	as a list of (name value) lists like gc-stats */
+class HeapStatsFunction : public Lambda
 {
 public:
-	EqualFunction(std::shared_ptr<Environment> env);
-	virtual bool do_operator(int left, int right) const;
+	HeapStatsFunction(std::shared_ptr<Environment> env);
+	virtual std::shared_ptr<Sexp> eval(std::shared_ptr<Environment> context, std::shared_ptr<List> params) const;
 	void print(std::ostream &os) const;
 };
 
 
-/**	base class for +, -, *, / */
-class BasicArithmeticFunction : public Lambda
-{
-public:
-	BasicArithmeticFunction(std::shared_ptr<Environment> env);
-	virtual std::shared_ptr<Sexp> eval(std::shared_ptr<Environment> context, std::shared_ptr<List> params) const;
-	virtual int do_operator(int left, int right) const = 0;
-	virtual bool checkParamsValid(int left, int right) const;
-};
-
-class AddFunction : public BasicArithmeticFunction
+namespace CommonInteger
 {
-public:
-	AddFunction(std::shared_ptr<Environment> env);
+	/**	this is used for basic operations: +, -, *, /, <, >, =
+	 * 	checks if expression is an unbound variable or a non-number
+	 * 	if successful, returns the number, upon failure returns nullptr */
+	Number* ConvertAndCheck(Sexp* s);
 	
-	int do_operator(int left, int right) const;
+	/**	exact arithmetic: the fixnum fast path checks for overflow with the compiler builtins, and falls back to BigInts
+	 * 	divide truncates towards zero, right must not be zero */
+	std::shared_ptr<Number> add(const Number& left, const Number& right);
+	std::shared_ptr<Number> subtract(const Number& left, const Number& right);
+	std::shared_ptr<Number> multiply(const Number& left, const Number& right);
+	std::shared_ptr<Number> divide(const Number& left, const Number& right);
 	
-	void print(std::ostream &os) const;
+	/**	-1, 0 or 1 if left is less than, equal to, or greater than right */
+	int compare(const Number& left, const Number& right);
 };
 
-class MultiplyFunction : public BasicArithmeticFunction
+/**	operator functors the arithmetic and compare primitives are generated from
+ * 	they are plain structs with static functions, so the templates below inline them */
+namespace Operators
+{
+	/**	arithmetic operators: apply is the exact operation, valid checks the operands (logs the error if they are invalid) */
+	struct Add
+	{
+		static std::shared_ptr<Number> apply(const Number& left, const Number& right) {return CommonInteger::add(left, right);}
+		static bool valid(const Number&, const Number&) {return true;}
+		static const char* name() {return "basic+";}
+	};
+	
+	struct Subtract
+	{
+		static std::shared_ptr<Number> apply(const Number& left, const Number& right) {return CommonInteger::subtract(left, right);}
+		static bool valid(const Number&, const Number&) {return true;}
+		static const char* name() {return "basic-";}
+	};
+	
+	struct Multiply
+	{
+		static std::shared_ptr<Number> apply(const Number& left, const Number& right) {return CommonInteger::multiply(left, right);}
+		static bool valid(const Number&, const Number&) {return true;}
+		static const char* name() {return "basic*";}
+	};
+	
+	struct Divide
+	{
+		static std::shared_ptr<Number> apply(const Number& left, const Number& right) {return CommonInteger::divide(left, right);}
+		/**	right must not be zero */
+		static bool valid(const Number& left, const Number& right);
+		static const char* name() {return "basic/";}
+	};
+	
+	/**	compare operators compare fixnums, bignums are compared with CommonInteger::compare(left, right) and 0 */
+	struct Less
+	{
+		static bool apply(int64_t left, int64_t right) {return left < right;}
+		static const char* name() {return "basic<";}
+	};
+	
+	struct Greater
+	{
+		static bool apply(int64_t left, int64_t right) {return left > right;}
+		static const char* name() {return "basic>";}
+	};
+	
+	struct Equal
+	{
+		static bool apply(int64_t left, int64_t right) {return left == right;}
+		static const char* name() {return "basic=";}
+	};
+}
+
+/**	+, -, *, / with any number of arguments (at least 2), folded from the left: (- a b c) is (- (- a b) c)
+ * 	the two argument call has its own entry point (evalBinary), without an argument list or virtual calls */
+template <typename Op>
+class ArithmeticFunction : public Lambda
 {
 public:
-	MultiplyFunction(std::shared_ptr<Environment> env);
-	
-	int do_operator(int left, int right) const;
-	
+	ArithmeticFunction(std::shared_ptr<Environment> env);
+	virtual std::shared_ptr<Sexp> eval(std::shared_ptr<Environment> context, std::shared_ptr<List> params) const;
+	virtual std::shared_ptr<Sexp> evalBinary(const std::shared_ptr<Sexp>& left, const std::shared_ptr<Sexp>& right) const;
 	void print(std::ostream &os) const;
 };
 
-class MinusFunction : public BasicArithmeticFunction
+/**	<, > and = with any number of arguments (at least 2), true if the operator holds for all neighbouring pairs */
+template <typename Op>
+class CompareFunction : public Lambda
 {
 public:
-	MinusFunction(std::shared_ptr<Environment> env);
-	
-	int do_operator(int left, int right) const;
-	
+	CompareFunction(std::shared_ptr<Environment> env);
+	virtual std::shared_ptr<Sexp> eval(std::shared_ptr<Environment> context, std::shared_ptr<List> params) const;
+	virtual std::shared_ptr<Sexp> evalBinary(const std::shared_ptr<Sexp>& left, const std::shared_ptr<Sexp>& right) const;
 	void print(std::ostream &os) const;
 };
 
-class DivisionFunction : public BasicArithmeticFunction
+using AddFunction = ArithmeticFunction<Operators::Add>;
+using MinusFunction = ArithmeticFunction<Operators::Subtract>;
+using MultiplyFunction = ArithmeticFunction<Operators::Multiply>;
+using DivisionFunction = ArithmeticFunction<Operators::Divide>;
+using LessFunction = CompareFunction<Operators::Less>;
+using GreaterFunction = CompareFunction<Operators::Greater>;
+using EqualFunction = CompareFunction<Operators::Equal>;
+
+
+
+
+
+
+class SchemeInterpreter;
+
+/**	(load "file") reads and evaluates the forms of a file like the batch mode does, returns #t */
+class LoadFunction : public Lambda
 {
+	SchemeInterpreter* interpreter;
 public:
-	DivisionFunction(std::shared_ptr<Environment> env);
-	
-	int do_operator(int left, int right) const;
-	
-	bool checkParamsValid(int left, int right) const;
-	
+	LoadFunction(std::shared_ptr<Environment> env, SchemeInterpreter* interpreter);
+	virtual std::shared_ptr<Sexp> eval(std::shared_ptr<Environment> context, std::shared_ptr<List> params) const;
 	void print(std::ostream &os) const;
 };
 
 
+/**	debug logging (logd and the trace events, see trace.h) is compiled in unless SCHEME_DEBUG_LOG is 0, which is the default with NDEBUG */
+#ifndef SCHEME_DEBUG_LOG
+#ifdef NDEBUG
+#define SCHEME_DEBUG_LOG 0
+#else
+#define SCHEME_DEBUG_LOG 1
+#endif
+#endif
 
+class TraceBuffer;
+
+enum class LogLevel {NONE, ERROR, DEBUG};
+struct LogSettings
+{
+	LogLevel level;
+	/**	the trace the evaluator records its events into at the DEBUG level, nullptr if they are dropped */
+	TraceBuffer* trace;
+	LogSettings(LogLevel level = LogLevel::ERROR, TraceBuffer* trace = nullptr);
+	
+	/**	the settings of the interpreter running on the calling thread, the defaults outside of interpreters */
+	static const LogSettings& current() {return *active;}
+	
+	/**	if the level of the current settings is DEBUG, always false if debug logging is not compiled in */
+	static bool debug()
+	{
+#if SCHEME_DEBUG_LOG
+		return current().level >= LogLevel::DEBUG;
+#else
+		return false;
+#endif
+	}
+	
+	/**	makes settings the current ones of the calling thread while the Scope exists, the previous ones are restored after it */
+	class Scope
+	{
+		const LogSettings* previous;
+	public:
+		Scope(const LogSettings& settings);
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+		~Scope();
+	};
+	
+private:
+	/**	the settings set by the innermost Scope of the thread, the defaults outside of them */
+	static thread_local const LogSettings* active;
+};
 
 
+class FutureGroup;
 
-/**	interpreter that handles the read-eval-print-loop, and the global context */
+/**	allocations of a top level form evaluated by SchemeInterpreter::eval, and the change of the live bytes of the heap (see HeapStats) */
+struct EvalAllocations
+{
+	size_t allocations;
+	size_t allocatedBytes;
+	int64_t liveBytesDelta;
+	int64_t peakLiveBytes;
+};
+
+/**	execution engines: the tree walking evaluator (Sexp::eval), or the bytecode compiler and VM (see bytecode.h) */
+enum class Engine {TREE, BYTECODE};
+
+/**	interpreter that handles the read-eval-print-loop, and the global context
+ * 	every interpreter has its own heap, global environment and log settings, so interpreters can run on different threads side by side,
+ * 	an interpreter itself is used by one thread at a time */
 class SchemeInterpreter
 {
+	/**	declared first, so they outlive the objects of the interpreter */
+	mutable Heap heap;
+	/**	the debug trace, made when the log level is first set to DEBUG */
+	std::unique_ptr<TraceBuffer> trace;
+	LogSettings logSettings;
+	/**	the futures of the interpreter running on the worker threads (see future.h) */
+	std::unique_ptr<FutureGroup> futures;
+	
+	/**	makes the heap, the log settings and the futures of the interpreter the current ones of the calling thread while it exists,
+	 * 	the public functions activate the interpreter, so its objects are allocated from and collected in its heap */
+	struct Activation;
+	
 	std::shared_ptr<Symbol> exit;
 	std::shared_ptr<Symbol> help;
 	std::shared_ptr<Symbol> symbol_logdebug;
 	std::shared_ptr<Symbol> symbol_logerror;
 	std::shared_ptr<Symbol> symbol_lognone;
+	std::shared_ptr<Symbol> symbol_enginetree;
+	std::shared_ptr<Symbol> symbol_enginebytecode;
+	std::shared_ptr<Symbol> symbol_dumpbytecode;
+	std::shared_ptr<Symbol> symbol_optimize;
+	std::shared_ptr<Symbol> symbol_dumpoptimized;
+	std::shared_ptr<Symbol> symbol_dumptrace;
+	std::shared_ptr<Symbol> symbol_allocstats;
 	std::string helpDialog;
 	bool exited;
+	/**	set by read on a syntax error, so evalAll can tell it from the end of the text */
+	bool readFailed;
+	
+	Engine engine;
+	/**	print the compiled code of every form evaluated by the bytecode engine */
+	bool dumpBytecode;
+	/**	run the Optimizer on every form before it is evaluated */
+	bool optimize;
+	/**	print every form after the Optimizer */
+	bool dumpOptimized;
+	/**	the REPL prints the allocations of every form after its result */
+	bool printAllocations;
+	EvalAllocations lastEval;
 	
 	std::shared_ptr<Environment> global;
+	/**	the InlinedCall the optimizer guards inlined calls with (see optimizer.h) */
+	std::shared_ptr<Lambda> inlinedCall;
+	/**	the bindings of the global environment before the prelude is evaluated, and inlinedCall: the primitives a heap image refers to by name */
+	std::unordered_map<int, std::shared_ptr<Sexp>> builtins;
+	
+	/**	binds name to the primitive made by make (from the global environment), and adds it to the builtins */
+	void bindNative(const std::string& name, const std::function<std::shared_ptr<Lambda>(std::shared_ptr<Environment>)>& make);
 public:
-	SchemeInterpreter();
+	/**	prelude: evaluate the definitions written in scheme (not), an interpreter that loads a heap image gets them from the image */
+	SchemeInterpreter(bool prelude = true);
+	
+	void setEngine(Engine engine);
+	void setDumpBytecode(bool dump);
+	void setOptimize(bool optimize);
+	void setDumpOptimized(bool dump);
+	void setPrintAllocations(bool print);
 	
 	std::shared_ptr<Sexp> createAtom(std::string temp);
 	
-	std::shared_ptr<Sexp> readAtom(char c, std::istream& is = std::cin);
+	/**	an atom read at the top level is looked up (or parsed as a number) right away */
+	std::shared_ptr<Sexp> readAtom(const std::string& text);
 	
-	std::shared_ptr<Sexp> read(std::istream& is = std::cin);
+	/**	the next form of lexer, nullptr at the end of the text (lexer.atEnd() is true then) or after a syntax error (it is logged) */
+	std::shared_ptr<Sexp> read(Lexer& lexer);
 	
 	std::shared_ptr<Sexp> eval(std::string str);
 	
@@ -371,8 +887,40 @@ public:
 	
 	void print(std::shared_ptr<Sexp> exp);
 	
+	/**	handles the interpreter commands (exit, help, logdebug...), returns true if exp was one that is not evaluated (exit, help) */
+	bool command(std::shared_ptr<Sexp> exp);
+	
+	/**	the REPL: prints a prompt, reads a form from the standard input, evaluates it and prints the result until exit or the end of the input */
 	void run();
 	
+	/**	reads and evaluates every form of lexer without printing anything but the errors, until the end of the text or exit
+	 * 	false if a form could not be read, the reading goes on after it */
+	bool evalAll(Lexer& lexer);
+	
+	/**	evalAll on the contents of the file at path, false if it can't be read or parsed (the errors are logged) */
+	bool load(const std::string& path);
+	
+	/**	if exit was evaluated */
+	bool hasExited() const;
+	
+	/**	saves the global environment to a heap image (see image.h), false if it couldn't be saved (the error is logged) */
+	bool saveImage(const std::string& path) const;
+	/**	binds the variables of a heap image in the global environment, false if it couldn't be loaded (the error is logged) */
+	bool loadImage(const std::string& path);
+	
+	/**	prints the debug trace events recorded since the last dump (see trace.h), nothing if the log level was never DEBUG */
+	void dumpTrace(std::ostream& os) const;
+	
+	/**	the collector telemetry and allocation counts of the heap of the interpreter */
+	HeapStats getHeapStats() const;
+	/**	the allocations of the last form evaluated by eval */
+	const EvalAllocations& getLastEvalAllocations() const;
+	
+	/**	binds name to a primitive calling the C++ function, its argument and result conversions are generated from the signature (see native.h, which defines it)
+	 * 	heap images refer to native functions by name, like to the other primitives: an interpreter loading one has to define them first */
+	template <typename R, typename... Args>
+	void defineNative(const std::string& name, R (*function)(Args...));
+	
 	~SchemeInterpreter();
 };
 
@@ -380,14 +928,10 @@ public:
  * 	logging errors: loge << "error message" << std::endl;
  * 	logging debugging info: logd << "debug msg" << std::endl;
  * 	loge and logd can also receive any object that has operator<<(std::ostream & os, <object type> e) implemented
- * 	The level of logging can be set in the beginning of the cpp file, 
- * 	or at runtime by entering one of the following into the console: logdebug, logerror, lognone */
-enum class LogLevel {NONE, ERROR, DEBUG};
-struct LogSettings
-{
-	LogLevel level;
-	LogSettings(LogLevel level = LogLevel::ERROR);
-};
+ * 	The level of logging is set per interpreter (see LogSettings), it is ERROR by default,
+ * 	and can be changed at runtime by entering one of the following into the console: logdebug, logerror, lognone
+ * 	logd checks the level once, before anything is formatted, and compiles to nothing without SCHEME_DEBUG_LOG,
+ * 	the hot paths of the evaluator record SCHEME_TRACE events instead (see trace.h), printed by the dumptrace command */
 
 
 struct ErrorLog
@@ -408,11 +952,35 @@ struct ErrorLogProxy
 	ErrorLog& operator << (T&& t);
 };
 
-struct DebugLogProxy
+extern ErrorLog logerror;
+extern DebugLog logdebug;
+extern ErrorLogProxy loge;
+
+/**	a statement, so the log sites have to be braced in if statements */
+#define logd if(!LogSettings::debug()) ; else logdebug << "Debug: "
+
+template <typename T>
+ErrorLog& ErrorLog::operator << (T&& t)
 {
-	template <typename T>
-	DebugLog& operator << (T&& t);
-};
+	if(LogSettings::current().level >= LogLevel::ERROR)
+		std::cout << std::forward<T>(t);
+	return *this;
+}
+
+/**	the level is checked by logd */
+template <typename T>
+DebugLog& DebugLog::operator << (T&& t)
+{
+	std::cout << std::forward<T>(t);
+	return *this;
+}
+
+
+template <typename T>
+ErrorLog& ErrorLogProxy::operator << (T&& t)
+{
+	return logerror << "Error: " << std::forward<T>(t);
+}
 
 
 
@@ -0,0 +1,289 @@
+#include <cstring>
+#include <type_traits>
+
+#include "simd.h"
+
+
+//the kernels are written once with GCC's vector extensions, and instantiated in functions compiled for each instruction set
+//(the always_inline kernels are inlined into them, so the vector operations are lowered to that instruction set)
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86
+#endif
+
+#define SIMD_INLINE inline __attribute__((always_inline))
+
+//the vectors are only passed between always_inline functions, so the ABI warning about passing them doesn't apply
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+namespace
+{
+	/**	sums are collected in 64 bit lanes split to the low and high 32 bits of the values, blocks of this many elements can't overflow them */
+	const size_t SUM_BLOCK = (size_t)1 << 30;
+
+	template <typename T, size_t BYTES>
+	struct Lanes
+	{
+		using Unsigned = typename std::make_unsigned<T>::type;
+		typedef T Vector __attribute__((vector_size(BYTES)));
+		typedef Unsigned UnsignedVector __attribute__((vector_size(BYTES)));
+		/**	a Wide has a 64 bit lane for each T lane of a Narrow */
+		typedef int64_t Wide __attribute__((vector_size(BYTES)));
+		typedef T Narrow __attribute__((vector_size(BYTES * sizeof(T) / 8)));
+		enum : size_t {COUNT = BYTES / sizeof(T), WIDE_COUNT = BYTES / 8};
+	};
+
+	template <typename V>
+	SIMD_INLINE V load(const void* p)
+	{
+		V v;
+		std::memcpy(&v, p, sizeof(V));
+		return v;
+	}
+
+	template <typename V>
+	SIMD_INLINE void store(void* p, const V& v)
+	{
+		std::memcpy(p, &v, sizeof(V));
+	}
+
+
+	//Operations
+	//they work on vectors and scalars alike, arithmetic is done on unsigned values (so it wraps around), comparisons on signed ones
+	//(vector comparisons give -1 for true, scalar ones 1, hence the masking)
+
+	struct Add {template <typename V> static SIMD_INLINE V apply(const V& x, const V& y) {return x + y;}};
+	struct Subtract {template <typename V> static SIMD_INLINE V apply(const V& x, const V& y) {return x - y;}};
+	struct Multiply {template <typename V> static SIMD_INLINE V apply(const V& x, const V& y) {return x * y;}};
+	struct Less {template <typename V> static SIMD_INLINE V apply(const V& x, const V& y) {return (V)(x < y) & 1;}};
+	struct Greater {template <typename V> static SIMD_INLINE V apply(const V& x, const V& y) {return (V)(x > y) & 1;}};
+	struct Equal {template <typename V> static SIMD_INLINE V apply(const V& x, const V& y) {return (V)(x == y) & 1;}};
+
+
+	//Kernels
+
+	template <typename T, size_t BYTES, typename Op>
+	SIMD_INLINE void arithmeticKernel(const T* a, const T* b, T* out, size_t n)
+	{
+		using L = Lanes<T, BYTES>;
+		using U = typename L::Unsigned;
+		using V = typename L::UnsignedVector;
+		size_t i = 0;
+		for(; i + L::COUNT <= n; i += L::COUNT)
+			store(out + i, Op::apply(load<V>(a + i), load<V>(b + i)));
+		for(; i < n; i++)
+			out[i] = (T)Op::apply((U)a[i], (U)b[i]);
+	}
+
+	template <typename T, size_t BYTES, typename Op>
+	SIMD_INLINE void compareKernel(const T* a, const T* b, T* out, size_t n)
+	{
+		using L = Lanes<T, BYTES>;
+		using V = typename L::Vector;
+		size_t i = 0;
+		for(; i + L::COUNT <= n; i += L::COUNT)
+			store(out + i, Op::apply(load<V>(a + i), load<V>(b + i)));
+		for(; i < n; i++)
+			out[i] = Op::apply(a[i], b[i]);
+	}
+
+	/**	there is no vector division instruction for integers, so this one is scalar everywhere */
+	template <typename T>
+	void divideKernel(const T* a, const T* b, T* out, size_t n)
+	{
+		using U = typename std::make_unsigned<T>::type;
+		for(size_t i = 0; i < n; i++)
+			out[i] = b[i] == -1 ? (T)(0 - (U)a[i]) : a[i] / b[i];
+	}
+
+	/**	adds the 64 bit lanes of values to low and high, split so that a block of SUM_BLOCK elements can't overflow them */
+	template <typename W>
+	SIMD_INLINE void accumulate(const W& values, W& low, W& high)
+	{
+		low += values & 0xFFFFFFFF;
+		high += values >> 32;
+	}
+
+	template <typename W>
+	SIMD_INLINE __int128 total(const W& low, const W& high, size_t count)
+	{
+		__int128 result = 0;
+		for(size_t l = 0; l < count; l++)
+			result += (__int128)high[l] * ((int64_t)1 << 32) + low[l];
+		return result;
+	}
+
+	template <typename T, size_t BYTES>
+	SIMD_INLINE __int128 sumKernel(const T* a, size_t n)
+	{
+		using L = Lanes<T, BYTES>;
+		using W = typename L::Wide;
+		__int128 result = 0;
+		size_t i = 0;
+		while(i < n)
+		{
+			size_t end = n - i > SUM_BLOCK ? i + SUM_BLOCK : n;
+			W low = {}, high = {};
+			for(; i + L::WIDE_COUNT <= end; i += L::WIDE_COUNT)
+				accumulate(__builtin_convertvector(load<typename L::Narrow>(a + i), W), low, high);
+			for(; i < end; i++)
+				result += a[i];
+			result += total(low, high, L::WIDE_COUNT);
+		}
+		return result;
+	}
+
+	template <typename T, size_t BYTES, bool MAX>
+	SIMD_INLINE T extremeKernel(const T* a, size_t n)
+	{
+		using L = Lanes<T, BYTES>;
+		using V = typename L::Vector;
+		T result = a[0];
+		size_t i = 0;
+		if(n >= L::COUNT)
+		{
+			V best = load<V>(a);
+			for(i = L::COUNT; i + L::COUNT <= n; i += L::COUNT)
+			{
+				V x = load<V>(a + i);
+				if(MAX)
+					best = x > best ? x : best;
+				else
+					best = x < best ? x : best;
+			}
+			for(size_t l = 0; l < L::COUNT; l++)
+				result = (MAX ? best[l] > result : best[l] < result) ? best[l] : result;
+		}
+		for(; i < n; i++)
+			result = (MAX ? a[i] > result : a[i] < result) ? a[i] : result;
+		return result;
+	}
+
+	/**	the products of 32 bit values fit in the 64 bit lanes, so their sum is exact */
+	template <size_t BYTES>
+	SIMD_INLINE bool dotKernel(const int32_t* a, const int32_t* b, size_t n, __int128& result)
+	{
+		using L = Lanes<int32_t, BYTES>;
+		using W = typename L::Wide;
+		using N = typename L::Narrow;
+		result = 0;
+		size_t i = 0;
+		while(i < n)
+		{
+			size_t end = n - i > SUM_BLOCK ? i + SUM_BLOCK : n;
+			W low = {}, high = {};
+			for(; i + L::WIDE_COUNT <= end; i += L::WIDE_COUNT)
+				accumulate(__builtin_convertvector(load<N>(a + i), W) * __builtin_convertvector(load<N>(b + i), W), low, high);
+			for(; i < end; i++)
+				result += (int64_t)a[i] * b[i];
+			result += total(low, high, L::WIDE_COUNT);
+		}
+		return true;
+	}
+
+	/**	there is no 64x64->128 bit vector multiplication, so this one is scalar everywhere */
+	template <size_t BYTES>
+	SIMD_INLINE bool dotKernel(const int64_t* a, const int64_t* b, size_t n, __int128& result)
+	{
+		result = 0;
+		for(size_t i = 0; i < n; i++)
+			if(__builtin_add_overflow(result, (__int128)a[i] * b[i], &result))
+				return false;
+		return true;
+	}
+}
+
+
+//Instantiations
+//every instruction set gets the same set of wrappers, the kernels inline into them with the wrapper's target
+
+#define SIMD_DEFINE_KERNELS(NAME, TARGET, BYTES) \
+	namespace NAME \
+	{ \
+		template <typename T, typename Op> TARGET void arithmetic(const T* a, const T* b, T* out, size_t n) {arithmeticKernel<T, BYTES, Op>(a, b, out, n);} \
+		template <typename T, typename Op> TARGET void compare(const T* a, const T* b, T* out, size_t n) {compareKernel<T, BYTES, Op>(a, b, out, n);} \
+		template <typename T> TARGET __int128 sum(const T* a, size_t n) {return sumKernel<T, BYTES>(a, n);} \
+		template <typename T> TARGET T min(const T* a, size_t n) {return extremeKernel<T, BYTES, false>(a, n);} \
+		template <typename T> TARGET T max(const T* a, size_t n) {return extremeKernel<T, BYTES, true>(a, n);} \
+		template <typename T> TARGET bool dot(const T* a, const T* b, size_t n, __int128& result) {return dotKernel<BYTES>(a, b, n, result);} \
+		\
+		template <typename T> \
+		Simd::Kernels<T> kernels() \
+		{ \
+			return {{arithmetic<T, Add>, arithmetic<T, Subtract>, arithmetic<T, Multiply>, divideKernel<T>, \
+					compare<T, Less>, compare<T, Greater>, compare<T, Equal>}, \
+					sum<T>, min<T>, max<T>, dot<T>}; \
+		} \
+	}
+
+namespace
+{
+	SIMD_DEFINE_KERNELS(baseline, , 16)
+#ifdef SIMD_X86
+	SIMD_DEFINE_KERNELS(sse42, __attribute__((target("sse4.2"))), 16)
+	SIMD_DEFINE_KERNELS(avx2, __attribute__((target("avx2"))), 32)
+#endif
+
+	enum class Isa {BASELINE, SSE42, AVX2};
+
+	Isa detect()
+	{
+#ifdef SIMD_X86
+		__builtin_cpu_init();
+		if(__builtin_cpu_supports("avx2"))
+			return Isa::AVX2;
+		if(__builtin_cpu_supports("sse4.2"))
+			return Isa::SSE42;
+#endif
+		return Isa::BASELINE;
+	}
+
+	const Isa selected = detect();
+
+	template <typename T>
+	Simd::Kernels<T> select()
+	{
+		switch(selected)
+		{
+#ifdef SIMD_X86
+			case Isa::AVX2:
+				return avx2::kernels<T>();
+			case Isa::SSE42:
+				return sse42::kernels<T>();
+#endif
+			default:
+				return baseline::kernels<T>();
+		}
+	}
+}
+
+
+//Simd
+
+const Simd::Kernels<int32_t>& Simd::s32()
+{
+	static const Kernels<int32_t> kernels = select<int32_t>();
+	return kernels;
+}
+
+const Simd::Kernels<int64_t>& Simd::s64()
+{
+	static const Kernels<int64_t> kernels = select<int64_t>();
+	return kernels;
+}
+
+const char* Simd::isa()
+{
+	switch(selected)
+	{
+		case Isa::AVX2:
+			return "avx2";
+		case Isa::SSE42:
+			return "sse4.2";
+		default:
+#ifdef SIMD_X86
+			return "sse2";
+#else
+			return "generic";
+#endif
+	}
+}
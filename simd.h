@@ -0,0 +1,39 @@
+#include <cstddef>
+#include <cstdint>
+
+
+
+
+#pragma once
+
+
+/**	kernels of the typed vector operations
+ * 	they are compiled for several instruction sets (AVX2, SSE4.2, and the baseline of the target), and the best one
+ * 	the processor supports is picked at runtime */
+namespace Simd
+{
+	enum Operation : int {ADD, SUBTRACT, MULTIPLY, DIVIDE, LESS, GREATER, EQUAL, OPERATION_COUNT};
+
+	template <typename T>
+	struct Kernels
+	{
+		/**	out[i] = a[i] op b[i]: arithmetic wraps around, comparisons store 1 or 0, divisors must not be 0 */
+		void (*binary[OPERATION_COUNT])(const T* a, const T* b, T* out, size_t n);
+
+		/**	exact sum */
+		__int128 (*sum)(const T* a, size_t n);
+
+		/**	smallest and largest element, n must not be 0 */
+		T (*min)(const T* a, size_t n);
+		T (*max)(const T* a, size_t n);
+
+		/**	exact dot product, false if it doesn't fit in 128 bits */
+		bool (*dot)(const T* a, const T* b, size_t n, __int128& result);
+	};
+
+	const Kernels<int32_t>& s32();
+	const Kernels<int64_t>& s64();
+
+	/**	the instruction set the kernels were picked for */
+	const char* isa();
+}
@@ -0,0 +1,475 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../native.h"
+#include "../scheme.h"
+
+
+
+
+/**	scheme-tests [check...]
+ * 	regression checks of the interpreter, run from the folder containing main.cpp
+ * 	a check evaluates forms on new interpreters, on both engines where the engine matters, and compares the printed values to the expected ones
+ * 	the errors the interpreter logs while a check runs are printed too, some checks expect them
+ * 	the exit status is 1 if a check failed */
+
+namespace
+{
+	const Engine ENGINES[] = {Engine::TREE, Engine::BYTECODE};
+
+	const char* engineName(Engine engine)
+	{
+		return engine == Engine::TREE ? "tree" : "bytecode";
+	}
+
+	std::string toString(const std::shared_ptr<Sexp>& s)
+	{
+		std::ostringstream os;
+		if(s != nullptr)
+			os << *s;
+		return os.str();
+	}
+
+	/**	evaluates forms on si in order, false (the failure is printed) if the last value is not printed as expected, "" stands for an error */
+	bool expect(SchemeInterpreter& si, const std::vector<std::string>& forms, const std::string& expected, const std::string& context)
+	{
+		std::shared_ptr<Sexp> value;
+		for(const std::string& form : forms)
+			value = si.eval(form);
+		if(toString(value) == expected)
+			return true;
+		std::cerr << context << ": " << forms.back() << " returned " << (value == nullptr ? "an error" : toString(value))
+			<< " instead of " << (expected.empty() ? "an error" : expected) << "\n";
+		return false;
+	}
+
+	/**	expect on a new interpreter for each engine, with and without the optimizer */
+	bool expectEverywhere(const std::vector<std::string>& forms, const std::string& expected)
+	{
+		bool passed = true;
+		for(Engine engine : ENGINES)
+		{
+			for(bool optimize : {true, false})
+			{
+				SchemeInterpreter si;
+				si.setEngine(engine);
+				si.setOptimize(optimize);
+				passed = expect(si, forms, expected, std::string(engineName(engine)) + (optimize ? ", optimized" : "")) && passed;
+			}
+		}
+		return passed;
+	}
+
+
+	//user-002: lambdas with arguments that are not a list of symbols are errors
+	bool malformedLambdas()
+	{
+		return expectEverywhere({"(lambda x x)"}, "")
+			&& expectEverywhere({"(lambda (1) 1)"}, "")
+			&& expectEverywhere({"(define (f 1) 1)"}, "")
+			&& expectEverywhere({"(define (g y) (lambda (1) y))", "(g 1)"}, "")
+			&& expectEverywhere({"(lambda (1) 1)", "((lambda (x) x) 5)"}, "5")
+			&& [] {
+				//a define without a name is reported once, when it runs, not when it is compiled too
+				bool passed = true;
+				for(Engine engine : ENGINES)
+				{
+					SchemeInterpreter si;
+					si.setEngine(engine);
+					std::ostringstream errors;
+					std::streambuf* log = std::cout.rdbuf(errors.rdbuf());
+					si.eval("(define (1 x) x)");
+					std::cout.rdbuf(log);
+					const std::string text = errors.str();
+					size_t reported = 0;
+					for(size_t pos = text.find("Error"); pos != std::string::npos; pos = text.find("Error", pos + 1))
+						reported++;
+					if(reported != 1)
+					{
+						std::cerr << engineName(engine) << " reported (define (1 x) x) " << reported << " times: " << text;
+						passed = false;
+					}
+				}
+				return passed;
+			}();
+	}
+
+
+	//user-015: an inlined call must evaluate its argument before the effects of the body
+	bool inliningKeepsOrder()
+	{
+		return expectEverywhere({
+			"(define v (s64vector 1))",
+			"(define (setv) (s64vector-set! v 0 10))",
+			"(define (f x) (+ (s64vector-ref v 0) x))",
+			"(s64vector-set! v 0 1)",
+			"(f (setv))"}, "20")
+			&& expectEverywhere({"(define (g x) (* x 2))", "(define (h y) (+ 1 (g (+ y 1))))", "(h 4)"}, "11");
+	}
+
+	//user-015: closures print the body written, the guard of inlined calls is not a global
+	bool optimizedSource()
+	{
+		return expectEverywhere({"(define (g x) (* x 2))", "(define (h y) (g y))", "h"}, "(lambda (y) (g y))")
+			&& expectEverywhere({"(define (g x) (* x 2))", "(define (k y) (lambda (z) (g (+ y z))))", "(k 1)"}, "(lambda (z) (g (+ y z)))")
+			&& expectEverywhere({"(define (g x) (* x 2))", "(define (h y) (g y))", "(define (inlined) 0)", "(h 3)"}, "6")
+			&& [] {
+				//the bytecode engine reports unbound variables
+				SchemeInterpreter si;
+				si.setEngine(Engine::BYTECODE);
+				return expect(si, {"inlined"}, "", "bytecode");
+			}();
+	}
+
+	//user-010: bignums are multiplied with Karatsuba's algorithm past 32 limbs, divided with Knuth's algorithm D,
+	// fixnum overflow promotes to a bignum and results that fit are demoted back
+	bool bignums()
+	{
+		const std::vector<std::string> library{
+			"(define (sq x) (* x x))",
+			"(define (expt b n) (if (= n 0) 1 (if (= (- n (* (/ n 2) 2)) 0) (sq (expt b (/ n 2))) (* b (expt b (- n 1))))))",
+			"(define (mod x m) (- x (* (/ x m) m)))",
+			"(define a (expt 3 2000))",
+			"(define b (expt 7 400))"};
+		auto with = [&library](std::vector<std::string> forms) {
+			forms.insert(forms.begin(), library.begin(), library.end());
+			return forms;
+		};
+		//a has 100 limbs and b 36, the residues are modulo 1000000007
+		return expectEverywhere(with({"(mod a 1000000007)"}), "480151387")
+			&& expectEverywhere(with({"(mod b 1000000007)"}), "52436363")
+			&& expectEverywhere(with({"(mod (* a b) 1000000007)"}), "247443737")
+			&& expectEverywhere(with({"(mod (* (+ a 12345) (- a 6789)) 1000000007)"}), "461483596")
+			&& expectEverywhere(with({"(- (* (+ a 1) (- a 1)) (* a a))"}), "-1")
+			&& expectEverywhere(with({"(= (/ (+ (* a b) (- b 1)) b) a)"}), "#t")
+			&& expectEverywhere(with({"(= (mod (+ (* a b) (- b 1)) b) (- b 1))"}), "#t")
+			//the quotient limb estimated from the top limbs is one too large, the remainder is added back
+			&& expectEverywhere({"(/ 170141183420855150474555134919112130560 39614081257132168796771975169)"}, "4294967294")
+			&& expectEverywhere({"(- 170141183420855150474555134919112130560 (* 4294967294 39614081257132168796771975169))"},
+				"39614081257132168792477007874")
+			&& expectEverywhere({"(/ -9223372036854775808 -1)"}, "9223372036854775808")
+			&& expectEverywhere({"(* -9223372036854775808 -1)"}, "9223372036854775808")
+			&& expectEverywhere({"(- -9223372036854775808 1)"}, "-9223372036854775809")
+			&& expectEverywhere({"(+ 9223372036854775807 1)"}, "9223372036854775808")
+			//an index has to be a fixnum: the bignum results that fit are fixnums again
+			&& expectEverywhere({"(s64vector-ref (s64vector 5 6) (- (+ 9223372036854775807 2) 9223372036854775808))"}, "6")
+			&& expectEverywhere({"(s64vector-ref (s64vector 5 6) (/ (* 4294967296 4294967296) 18446744073709551616))"}, "6")
+			&& expectEverywhere({"(s64vector-ref (s64vector 5 6) (+ (/ -9223372036854775808 -1) -9223372036854775807))"}, "6");
+	}
+
+	//user-015, user-003: lists whose head is not a function evaluate to themselves, on both engines, the optimizer and the inlined calls leave them alone
+	bool dataLists()
+	{
+		return expectEverywhere({"(1 2 3)"}, "(1 2 3)")
+			&& expectEverywhere({"(foo 1 2)"}, "(foo 1 2)")
+			&& expectEverywhere({"(foo (bar 1) (/ 1 0))"}, "(foo (bar 1) (/ 1 0))")
+			&& expectEverywhere({"(define (g x) (* x 2))", "(5 (g 3))"}, "(5 (g 3))")
+			&& expectEverywhere({"(1 (+ 1 2))"}, "(1 (+ 1 2))")
+			&& expectEverywhere({"(define (h y) (list (+ 1 2) y))", "(h 4)"}, "(list (+ 1 2) y)")
+			&& expectEverywhere({"(define (k y) (y 5))", "(k 4)"}, "(y 5)")
+			&& expectEverywhere({"(define (k y) (y 5))", "(define (t x) (* x 3))", "(k t)"}, "15")
+			&& expectEverywhere({"(define f 1)", "(define (m) (f 2))", "(m)", "(define (f x) (+ x 1))", "(m)"}, "3");
+	}
+
+	//user-025: continuations escape through primitives and syntax, once, while their call/ec runs, and never from a future
+	bool escapes()
+	{
+		bool passed = true;
+		for(const std::string call : {"call/ec", "call/cc"})
+		{
+			passed = expectEverywhere({"(" + call + " (lambda (k) (+ 1 (k 5))))"}, "5")
+				&& expectEverywhere({"(+ 1 (" + call + " (lambda (k) (* 2 (k 3)))))"}, "4")
+				&& expectEverywhere({"(define (f k) (* 10 (k 6)))", "(" + call + " (lambda (k) (+ 1 (f k))))"}, "6")
+				&& expectEverywhere({"(" + call + " (lambda (k) (define x (k 7))))"}, "7")
+				&& expectEverywhere({"(" + call + " (lambda (k) (define x (k 7))))", "x"}, "")
+				&& expectEverywhere({"(" + call + " (lambda (k) (if (k 1) 2 3)))"}, "1")
+				&& expectEverywhere({"(" + call + " (lambda (k) (if (= 1 1) (k 4) 5)))"}, "4")
+				&& expectEverywhere({"(" + call + " (lambda (k) (+ (k 1) (k 2))))"}, "1")
+				&& expectEverywhere({"(" + call + " (lambda (k) 8))"}, "8")
+				&& expectEverywhere({"(define k2 (" + call + " (lambda (k) k)))", "(k2 1)"}, "")
+				&& expectEverywhere({"(define k2 (" + call + " (lambda (k) k)))", "(k2 1)", "(+ 1 2)"}, "3")
+				&& expectEverywhere({"(" + call + " (lambda (k) (touch (future (k 3)))))"}, "")
+				&& expectEverywhere({"(" + call + " (lambda (k) (touch (future (k 3)))))", "(+ 1 2)"}, "3")
+				&& expectEverywhere({"(touch (future (" + call + " (lambda (k) (+ 1 (k 2))))))"}, "2")
+				&& passed;
+		}
+		return passed;
+	}
+
+	//user-011: the SIMD kernels wrap around like the scalar code, widen mixed operands, and reduce exactly
+	bool simdKernels()
+	{
+		return expectEverywhere({"(vector+ (s32vector 2147483647 -2147483648) (s32vector 1 -1))"}, "#s32(-2147483648 2147483647)")
+			&& expectEverywhere({"(vector* (s64vector 9223372036854775807) 2)"}, "#s64(-2)")
+			&& expectEverywhere({"(vector/ (s32vector -2147483648 7) (s32vector -1 -1))"}, "#s32(-2147483648 -7)")
+			&& expectEverywhere({"(vector/ (s64vector -9223372036854775808) -1)"}, "#s64(-9223372036854775808)")
+			&& expectEverywhere({"(vector/ (s32vector 1 2) (s32vector 1 0))"}, "")
+			&& expectEverywhere({"(vector+ (s32vector 2147483647 1) (s64vector 1 2))"}, "#s64(2147483648 3)")
+			&& expectEverywhere({"(vector- (s64vector 4294967296 0) (s32vector 1 -2147483648))"}, "#s64(4294967295 2147483648)")
+			&& expectEverywhere({"(vector- 4294967296 (s32vector 1))"}, "")
+			&& expectEverywhere({"(vector-dot (s32vector 1 2 3) (s64vector 4 5 6))"}, "32")
+			&& expectEverywhere({"(vector-sum (make-s64vector 4 9223372036854775807))"}, "36893488147419103228")
+			&& expectEverywhere({"(vector-sum (make-s32vector 1000 -2147483648))"}, "-2147483648000")
+			&& expectEverywhere({"(vector-dot (make-s64vector 4 9223372036854775807) (make-s64vector 4 9223372036854775807))"},
+				"340282366920938463389587631136930004996")
+			&& expectEverywhere({"(vector-dot (s32vector -2147483648 -2147483648) (s32vector -2147483648 -2147483648))"}, "9223372036854775808")
+			&& expectEverywhere({"(vector-dot (make-s64vector 2 -9223372036854775808) (make-s64vector 2 -9223372036854775808))"},
+				"170141183460469231731687303715884105728")
+			&& expectEverywhere({"(vector-sum (s32vector))"}, "0")
+			&& expectEverywhere({"(vector-min (s64vector))"}, "")
+			&& expectEverywhere({"(vector-max (s32vector))"}, "")
+			&& expectEverywhere({"(vector-min (s32vector 3 -7 5))"}, "-7")
+			&& expectEverywhere({"(make-s64vector 4294967297)"}, "");
+	}
+
+	//user-016: a memoized function counts its hits and misses, and evicts the least recently used results past its capacity
+	bool memoStats()
+	{
+		return expectEverywhere({"(define-memoized (sq x) (* x x) 2)", "(sq 1)", "(sq 2)", "(sq 3)", "(sq 4)", "(memo-stats sq)"},
+				"((hits 0) (misses 4) (evictions 2) (size 2) (capacity 2))")
+			&& expectEverywhere({"(define-memoized (sq x) (* x x) 2)", "(sq 1)", "(sq 2)", "(sq 3)", "(sq 4)", "(sq 4)", "(sq 3)", "(sq 1)", "(memo-stats sq)"},
+				"((hits 2) (misses 5) (evictions 3) (size 2) (capacity 2))")
+			&& expectEverywhere({"(define sq (memoize (lambda (x) (* x x)) 2))", "(sq 1)", "(sq 2)", "(sq 3)", "(sq 4)", "(memo-stats sq)"},
+				"((hits 0) (misses 4) (evictions 2) (size 2) (capacity 2))")
+			&& expectEverywhere({"(define-memoized (sq x) (* x x) 0)"}, "");
+	}
+
+	//user-021: and and or evaluate their arguments once, in order, up to the first false (and) or true (or) one
+	bool andOr()
+	{
+		return expectEverywhere({"(and (= 1 1) (= 2 2))"}, "#t")
+			&& expectEverywhere({"(and (= 1 1) (= 1 2))"}, "#f")
+			&& expectEverywhere({"(or (= 1 2) (= 2 2))"}, "#t")
+			&& expectEverywhere({"(or (= 1 2) (= 2 3))"}, "#f")
+			&& expectEverywhere({"(or #t #f)"}, "#t")
+			&& expectEverywhere({"(and #f (/ 1 0))"}, "#f")
+			&& expectEverywhere({"(or 1 (/ 1 0))"}, "#t")
+			&& expectEverywhere({"(and 1 (/ 1 0))"}, "")
+			&& expectEverywhere({"(and)"}, "")
+			&& expectEverywhere({"(or)"}, "")
+			&& expectEverywhere({"(define (in? x) (and (< 0 x) (or (< x 10) (= x 100))))", "(in? 100)"}, "#t")
+			&& expectEverywhere({"(define (in? x) (and (< 0 x) (or (< x 10) (= x 100))))", "(in? 11)"}, "#f")
+			&& expectEverywhere({"(define v (s64vector 0))", "(define (count) (s64vector-set! v 0 (+ (s64vector-ref v 0) 1)))",
+				"(and (count) (count) (or (count) (count)))", "(s64vector-ref v 0)"}, "3");
+	}
+
+	int64_t add3(int64_t a, int64_t b, int64_t c) {return a + b + c;}
+	int8_t negate8(int8_t a) {return -a;}
+	uint64_t twice(uint32_t a) {return (uint64_t)a * 2;}
+	uint64_t largest() {return UINT64_MAX;}
+	bool both(bool a, bool b) {return a && b;}
+	std::string greet(const std::string& name) {return "hello " + name;}
+	size_t length(std::string s) {return s.size();}
+	std::shared_ptr<Sexp> second(std::shared_ptr<Sexp>, std::shared_ptr<Sexp> b) {return b;}
+	std::shared_ptr<Sexp> fail() {return nullptr;}
+	int64_t counter = 0;
+	void bump(int64_t by) {counter += by;}
+
+	//user-020: defineNative converts the arguments and the result of every supported type, and checks the arity
+	bool nativeFunctions()
+	{
+		bool passed = true;
+		for(Engine engine : ENGINES)
+		{
+			SchemeInterpreter si;
+			si.setEngine(engine);
+			si.defineNative("add3", &add3);
+			si.defineNative("negate8", &negate8);
+			si.defineNative("twice", &twice);
+			si.defineNative("largest", &largest);
+			si.defineNative("both", &both);
+			si.defineNative("greet", &greet);
+			si.defineNative("length", &length);
+			si.defineNative("second", &second);
+			si.defineNative("fail", &fail);
+			si.defineNative("bump", &bump);
+			std::string context = std::string(engineName(engine)) + " native";
+			counter = 0;
+			passed = expect(si, {"(add3 1 2 3)"}, "6", context)
+				&& expect(si, {"(add3 1 2)"}, "", context)
+				&& expect(si, {"(add3 1 2 3 4)"}, "", context)
+				&& expect(si, {"(add3 1 2 100000000000000000000)"}, "", context)
+				&& expect(si, {"(negate8 -127)"}, "127", context)
+				&& expect(si, {"(negate8 128)"}, "", context)
+				&& expect(si, {"(negate8 -129)"}, "", context)
+				&& expect(si, {"(twice 4294967295)"}, "8589934590", context)
+				&& expect(si, {"(twice -1)"}, "", context)
+				&& expect(si, {"(twice 4294967296)"}, "", context)
+				&& expect(si, {"(largest)"}, "18446744073709551615", context)
+				&& expect(si, {"(largest 1)"}, "", context)
+				&& expect(si, {"(both #t 0)"}, "#t", context)
+				&& expect(si, {"(both #t #f)"}, "#f", context)
+				&& expect(si, {"(greet \"you\")"}, "\"hello you\"", context)
+				&& expect(si, {"(greet 1)"}, "", context)
+				&& expect(si, {"(length \"four\")"}, "4", context)
+				&& expect(si, {"(second 1 (s32vector 2))"}, "#s32(2)", context)
+				&& expect(si, {"(fail)"}, "", context)
+				&& expect(si, {"(bump 5)", "(bump 6)"}, "#t", context)
+				&& expect(si, {"(bump)"}, "", context) && passed;
+			if(counter != 11)
+			{
+				std::cerr << context << ": bump was called with " << counter << " in all instead of 11\n";
+				passed = false;
+			}
+		}
+		return passed;
+	}
+
+	//user-014: a heap image with local variables outside of their frames is rejected, corrupt images don't crash the loader
+	bool corruptImages()
+	{
+		const char* path = "scheme-tests.img";
+		bool passed = true;
+		for(Engine engine : ENGINES)
+		{
+			std::string context = std::string(engineName(engine)) + " image";
+			{
+				SchemeInterpreter si;
+				si.setEngine(engine);
+				si.eval("(define (f a b c d e f6 g h) (lambda (x) (lambda (y) (+ h x y))))");
+				si.eval("(define k (f 1 2 3 4 5 6 7 8))");
+				if(!si.saveImage(path))
+				{
+					std::cerr << context << " can't be saved\n";
+					return false;
+				}
+			}
+			std::ifstream file(path, std::ios::binary);
+			const std::string image{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+			file.close();
+
+			auto load = [&](const std::string& data) {
+				std::ofstream(path, std::ios::binary).write(data.data(), data.size());
+				//the errors of the loader are expected, the log is dropped
+				std::ostringstream errors;
+				std::streambuf* log = std::cout.rdbuf(errors.rdbuf());
+				bool loaded;
+				{
+					SchemeInterpreter si(false);
+					si.setEngine(engine);
+					loaded = si.loadImage(path);
+				}
+				std::cout.rdbuf(log);
+				return loaded;
+			};
+
+			{
+				SchemeInterpreter si(false);
+				si.setEngine(engine);
+				passed = si.loadImage(path) && expect(si, {"((k 10) 100)", "(((f 1 2 3 4 5 6 7 8) 1) 2)"}, "11", context) && passed;
+			}
+
+			//h is at depth 2, slot 7 in the innermost lambda: the only place the image has 2 and 7 next to each other
+			const uint32_t address[] = {2, 7};
+			int found = 0;
+			for(size_t pos = image.find(std::string((const char*)address, sizeof(address))); pos != std::string::npos; pos = image.find(std::string((const char*)address, sizeof(address)), pos + 1))
+			{
+				found++;
+				for(size_t field = 0; field < 2; field++)
+				{
+					std::string corrupt = image;
+					uint32_t outside = address[field] + 1;
+					corrupt.replace(pos + field * sizeof(uint32_t), sizeof(uint32_t), (const char*)&outside, sizeof(outside));
+					if(load(corrupt))
+					{
+						std::cerr << context << " with " << (field == 0 ? "depth " : "slot ") << outside << " was loaded\n";
+						passed = false;
+					}
+				}
+			}
+			if(found == 0)
+			{
+				std::cerr << context << " has no local variable at depth 2, slot 7\n";
+				passed = false;
+			}
+
+			//every byte changed in turn: the loader rejects or loads the image, it must not crash
+			for(size_t pos = 0; pos < image.size(); pos++)
+			{
+				std::string corrupt = image;
+				corrupt[pos] = ~corrupt[pos];
+				load(corrupt);
+			}
+		}
+		std::remove(path);
+		return passed;
+	}
+
+	//user-013: a file with a syntax error fails to load, so batch mode exits with an error, the forms around it are still evaluated
+	bool syntaxErrors()
+	{
+		const char* path = "scheme-tests.scm";
+		const struct {const char* text; bool loads;} files[] = {
+			{"(define x 1)\n(+ x 2)\n", true},
+			{"(define x 1)\n(+ x 2))\n", false},
+			{"(define x 1)\n(+ x 2\n", false},
+			{"(define x 1)\n\"x\n", false},
+			{"(define x 1)\n(undefined-function 2)\n", true},
+		};
+		bool passed = true;
+		for(const auto& file : files)
+		{
+			std::ofstream(path) << file.text;
+			std::ostringstream errors;
+			std::streambuf* log = std::cout.rdbuf(errors.rdbuf());
+			SchemeInterpreter si;
+			bool loaded = si.load(path);
+			std::cout.rdbuf(log);
+			if(loaded != file.loads)
+			{
+				std::cerr << "loading " << file.text << (loaded ? "succeeded" : "failed") << "\n";
+				passed = false;
+			}
+			passed = expect(si, {"x"}, "1", std::string("after loading ") + file.text) && passed;
+		}
+		std::remove(path);
+		return passed;
+	}
+
+
+	struct Check
+	{
+		const char* name;
+		std::function<bool()> run;
+	};
+
+	const Check CHECKS[] = {
+		{"malformed-lambdas", malformedLambdas},
+		{"inlining-order", inliningKeepsOrder},
+		{"optimized-source", optimizedSource},
+		{"data-lists", dataLists},
+		{"escapes", escapes},
+		{"simd-kernels", simdKernels},
+		{"memo-stats", memoStats},
+		{"and-or", andOr},
+		{"native-functions", nativeFunctions},
+		{"bignums", bignums},
+		{"corrupt-images", corruptImages},
+		{"syntax-errors", syntaxErrors},
+	};
+}
+
+
+int main(int argc, char* argv[])
+{
+	bool passed = true;
+	for(const Check& check : CHECKS)
+	{
+		bool selected = argc == 1;
+		for(int i = 1; i < argc; i++)
+			selected = selected || std::strcmp(argv[i], check.name) == 0;
+		if(!selected)
+			continue;
+		bool result = check.run();
+		std::cout << (result ? "passed  " : "FAILED  ") << check.name << "\n";
+		passed = passed && result;
+	}
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,128 @@
+#include <chrono>
+#include <iomanip>
+
+#include "trace.h"
+
+
+namespace
+{
+	int64_t now()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	const char* kindName(Kind kind)
+	{
+		switch(kind)
+		{
+		case Kind::NUMBER: return "number";
+		case Kind::SYMBOL: return "symbol";
+		case Kind::LOCAL_VARIABLE: return "local variable";
+		case Kind::GLOBAL_VARIABLE: return "global variable";
+		case Kind::FUTURE: return "future";
+		case Kind::LIST: return "list";
+		case Kind::TYPED_VECTOR: return "typed vector";
+		case Kind::STRING: return "string";
+		case Kind::OPTIMIZED_BODY: return "optimized body";
+		case Kind::LAMBDA_EXPRESSION: return "lambda expression";
+		case Kind::CLOSURE: return "closure";
+		case Kind::COMPILED_CLOSURE: return "compiled closure";
+		case Kind::PRIMITIVE: return "primitive";
+		case Kind::SPECIAL_FORM: return "special form";
+		}
+		return "?";
+	}
+}
+
+
+//TraceBuffer
+
+TraceBuffer::TraceBuffer() : slots{new Slot[CAPACITY]}, next{0}, first{0}, start{now()}
+{
+	for(size_t i = 0; i < CAPACITY; i++)
+		slots[i].state.store(0, std::memory_order_relaxed);
+}
+
+void TraceBuffer::record(TraceEvent::Type type, Kind kind, const void* object, int32_t symbol, int32_t count)
+{
+	TraceBuffer* trace = LogSettings::current().trace;
+	if(trace != nullptr)
+		trace->push(type, kind, object, symbol, count);
+}
+
+void TraceBuffer::push(TraceEvent::Type type, Kind kind, const void* object, int32_t symbol, int32_t count)
+{
+	uint64_t sequence = next.fetch_add(1, std::memory_order_relaxed);
+	Slot& slot = slots[sequence % CAPACITY];
+	slot.state.store(2 * sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	slot.event = TraceEvent{sequence, now() - start, object, symbol, count, type, kind};
+	slot.state.store(2 * sequence + 2, std::memory_order_release);
+}
+
+void TraceBuffer::dump(std::ostream& os, const Environment* global)
+{
+	std::unordered_map<const void*, int> names;
+	if(global != nullptr)
+	{
+		for(const auto& binding : global->getVariables())
+		{
+			if(binding.second->isLambda())
+				names.emplace(binding.second.get(), binding.first);
+		}
+	}
+	auto printObject = [&](const void* object)
+	{
+		auto name = names.find(object);
+		if(name != names.end())
+			os << SymbolTable::name(name->second);
+		else
+			os << object;
+	};
+
+	uint64_t last = next.load(std::memory_order_acquire);
+	uint64_t sequence = last > first + CAPACITY ? last - CAPACITY : first;
+	if(sequence > first)
+		os << "(" << sequence - first << " events were overwritten)\n";
+	std::ios::fmtflags flags = os.flags();
+	for(; sequence < last; sequence++)
+	{
+		const Slot& slot = slots[sequence % CAPACITY];
+		//the slot is skipped if it is not written yet, or it was written again while it was copied
+		if(slot.state.load(std::memory_order_acquire) != 2 * sequence + 2)
+			continue;
+		TraceEvent event = slot.event;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if(slot.state.load(std::memory_order_relaxed) != 2 * sequence + 2)
+			continue;
+
+		os << std::right << std::setw(8) << event.sequence << std::fixed << std::setprecision(3) << std::setw(14) << event.nanoseconds / 1e3 << " us  ";
+		switch(event.type)
+		{
+		case TraceEvent::Type::LIST_EVAL:
+			os << "eval    (";
+			if(event.symbol >= 0)
+				os << SymbolTable::name(event.symbol) << " ...";
+			else
+				os << "...";
+			os << ")";
+			break;
+		case TraceEvent::Type::CALL:
+			os << "call    ";
+			printObject(event.object);
+			os << ", " << event.count << " arguments";
+			break;
+		case TraceEvent::Type::RETURN:
+			os << "return  ";
+			printObject(event.object);
+			os << " -> " << kindName(event.kind);
+			break;
+		case TraceEvent::Type::CREATE_LAMBDA:
+			os << "lambda  " << event.count << " arguments, environment " << event.object;
+			break;
+		}
+		os << "\n";
+	}
+	os.flags(flags);
+	first = last;
+}
@@ -0,0 +1,80 @@
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+
+#include "scheme.h"
+
+
+
+
+#pragma once
+
+
+/**	event of the debug trace: the evaluator records what it does in these instead of printing it
+ * 	object is only compared and printed as an address, it may have been freed by the time the trace is dumped */
+struct TraceEvent
+{
+	enum class Type : unsigned char
+	{
+		/**	a list is evaluated, symbol is the name it is headed by (-1 if it is not headed by a name) */
+		LIST_EVAL,
+		/**	object, a closure is called with count arguments */
+		CALL,
+		/**	object, a closure returned a value of kind */
+		RETURN,
+		/**	a lambda expression made a closure of count arguments in the environment object */
+		CREATE_LAMBDA
+	};
+
+	uint64_t sequence;
+	int64_t nanoseconds;
+	const void* object;
+	int32_t symbol;
+	int32_t count;
+	Type type;
+	Kind kind;
+};
+
+/**	the debug trace of an interpreter: a ring buffer keeping the last CAPACITY events, recorded by the evaluator while the log level is DEBUG
+ * 	futures record into the trace of their interpreter from the worker threads, so recording is lock free:
+ * 	a writer claims a slot with an atomic increment, and marks it with a sequence number while it writes it, dump skips the slots written meanwhile
+ * 	the events are only formatted when the trace is dumped (the dumptrace command) */
+class TraceBuffer
+{
+public:
+	enum : size_t {CAPACITY = 4096};
+
+private:
+	struct Slot
+	{
+		/**	2 * (sequence number of the event) + 1 while it is written, + 2 after that, 0 if it was never written */
+		std::atomic<uint64_t> state;
+		TraceEvent event;
+	};
+
+	std::unique_ptr<Slot[]> slots;
+	std::atomic<uint64_t> next;
+	/**	the sequence number of the first event not dumped yet */
+	uint64_t first;
+	int64_t start;
+
+public:
+	TraceBuffer();
+	TraceBuffer(const TraceBuffer&) = delete;
+	TraceBuffer& operator=(const TraceBuffer&) = delete;
+
+	/**	records an event in the trace of the current LogSettings, if they have one */
+	static void record(TraceEvent::Type type, Kind kind, const void* object, int32_t symbol, int32_t count);
+
+	void push(TraceEvent::Type type, Kind kind, const void* object, int32_t symbol, int32_t count);
+
+	/**	prints the events recorded since the last dump that are still kept in the buffer, the oldest first
+	 * 	closures that are bound to a variable of global are printed with the name of the variable */
+	void dump(std::ostream& os, const Environment* global);
+};
+
+
+/**	records a debug trace event, with a single branch on the log level - nothing at all if SCHEME_DEBUG_LOG is 0 */
+#define SCHEME_TRACE(type, kind, object, symbol, count) \
+	if(!LogSettings::debug()) ; else TraceBuffer::record(TraceEvent::Type::type, kind, object, symbol, count)
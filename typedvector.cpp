@@ -0,0 +1,494 @@
+#include <algorithm>
+#include <new>
+
+#include "typedvector.h"
+
+
+namespace
+{
+	/**	printing stops after this many elements, so defining a big vector in the REPL doesn't flood it */
+	const size_t PRINT_LIMIT = 100;
+	/**	longest vector make-s32vector and make-s64vector create */
+	const int64_t MAX_SIZE = (int64_t)1 << 32;
+
+	template <typename T> const Simd::Kernels<T>& kernels();
+	template <> const Simd::Kernels<int32_t>& kernels<int32_t>() {return Simd::s32();}
+	template <> const Simd::Kernels<int64_t>& kernels<int64_t>() {return Simd::s64();}
+
+	template <typename T> const std::vector<T>& elements(const TypedVector& v);
+	template <> const std::vector<int32_t>& elements<int32_t>(const TypedVector& v) {return v.getS32();}
+	template <> const std::vector<int64_t>& elements<int64_t>(const TypedVector& v) {return v.getS64();}
+
+	template <typename T> std::vector<T>& elements(TypedVector& v);
+	template <> std::vector<int32_t>& elements<int32_t>(TypedVector& v) {return v.getS32();}
+	template <> std::vector<int64_t>& elements<int64_t>(TypedVector& v) {return v.getS64();}
+
+	template <typename T> bool hasType(const TypedVector& v);
+	template <> bool hasType<int32_t>(const TypedVector& v) {return v.getType() == TypedVector::Type::S32;}
+	template <> bool hasType<int64_t>(const TypedVector& v) {return v.getType() == TypedVector::Type::S64;}
+
+	/**	a new vector of size elements, logs an error and returns nullptr if there is not enough memory for it */
+	std::shared_ptr<TypedVector> allocate(TypedVector::Type type, size_t size, int64_t fill = 0)
+	{
+		try
+		{
+			return Heap::make<TypedVector>(type, size, fill);
+		}
+		catch(const std::bad_alloc&)
+		{
+			loge << "not enough memory for a vector of " << size << " elements\n";
+			return nullptr;
+		}
+	}
+
+	/**	s if it is a typed vector, nullptr otherwise */
+	TypedVector* asVector(Sexp* s)
+	{
+		return s->getKind() == Kind::TYPED_VECTOR ? static_cast<TypedVector*>(s) : nullptr;
+	}
+
+	/**	like CommonInteger::ConvertAndCheck, logs an error and returns nullptr if s is not a typed vector */
+	TypedVector* convertAndCheck(Sexp* s)
+	{
+		TypedVector* v = asVector(s);
+		if(v == nullptr)
+		{
+			if(s->getKind() == Kind::SYMBOL)
+				loge << *s << " is unbound\n";
+			else
+				loge << *s << " is not a typed vector\n";
+		}
+		return v;
+	}
+
+	/**	an operand of an element-wise operation as n elements of type T: the vector's own elements if it has that type,
+	 * 	otherwise they are widened, or the scalar is repeated, into storage */
+	template <typename T>
+	const T* operandData(const TypedVector* v, const Number* scalar, size_t n, std::vector<T>& storage)
+	{
+		if(v != nullptr && hasType<T>(*v))
+			return elements<T>(*v).data();
+		storage.resize(n);
+		if(v != nullptr)
+		{
+			const std::vector<int32_t>& narrow = v->getS32();
+			std::copy(narrow.begin(), narrow.end(), storage.begin());
+		}
+		else
+			std::fill(storage.begin(), storage.end(), (T)scalar->getFixnum());
+		return storage.data();
+	}
+
+	template <typename T>
+	bool runElementwise(Simd::Operation op, const TypedVector* a, const Number* aScalar, const TypedVector* b, const Number* bScalar, TypedVector& result)
+	{
+		size_t n = result.size();
+		std::vector<T> aStorage, bStorage;
+		const T* left = operandData<T>(a, aScalar, n, aStorage);
+		const T* right = operandData<T>(b, bScalar, n, bStorage);
+		if(op == Simd::DIVIDE && std::find(right, right + n, 0) != right + n)
+		{
+			loge << "division by zero.\n";
+			return false;
+		}
+		kernels<T>().binary[op](left, right, elements<T>(result).data(), n);
+		return true;
+	}
+
+	std::shared_ptr<Number> toNumber(__int128 value)
+	{
+		if(value >= INT64_MIN && value <= INT64_MAX)
+			return Number::make((int64_t)value);
+		//the high 64 bits, then the low ones in two 32 bit halves
+		uint64_t low = (uint64_t)value;
+		BigInt result = BigInt((int64_t)(value >> 64));
+		result = result * BigInt((int64_t)1 << 32) + BigInt((int64_t)(low >> 32));
+		result = result * BigInt((int64_t)1 << 32) + BigInt((int64_t)(low & 0xFFFFFFFF));
+		return Number::make(std::move(result));
+	}
+
+	template <typename T>
+	std::shared_ptr<Sexp> reduce(TypedVectorFunction::Operation operation, const TypedVector& v)
+	{
+		const std::vector<T>& data = elements<T>(v);
+		switch(operation)
+		{
+		case TypedVectorFunction::Operation::SUM:
+			return toNumber(kernels<T>().sum(data.data(), data.size()));
+		case TypedVectorFunction::Operation::MIN:
+			return Number::make(kernels<T>().min(data.data(), data.size()));
+		default:
+			return Number::make(kernels<T>().max(data.data(), data.size()));
+		}
+	}
+
+	template <typename T>
+	std::shared_ptr<Sexp> dot(const TypedVector* a, const TypedVector* b)
+	{
+		size_t n = a->size();
+		std::vector<T> aStorage, bStorage;
+		const T* left = operandData<T>(a, nullptr, n, aStorage);
+		const T* right = operandData<T>(b, nullptr, n, bStorage);
+		__int128 result;
+		if(kernels<T>().dot(left, right, n, result))
+			return toNumber(result);
+		//it doesn't fit in 128 bits
+		BigInt sum;
+		for(size_t i = 0; i < n; i++)
+			sum = sum + BigInt(left[i]) * BigInt(right[i]);
+		return Number::make(std::move(sum));
+	}
+
+	/**	logs an error if index is not a valid index of v */
+	bool checkIndex(Sexp* s, const TypedVector& v, size_t& index)
+	{
+		Number* num = CommonInteger::ConvertAndCheck(s);
+		if(num == nullptr)
+			return false;
+		if(!num->isFixnum() || num->getFixnum() < 0 || (uint64_t)num->getFixnum() >= v.size())
+		{
+			loge << "index " << *num << " is out of range for a vector of length " << v.size() << "\n";
+			return false;
+		}
+		index = (size_t)num->getFixnum();
+		return true;
+	}
+
+	/**	logs an error if s is not a number that fits in an element of type */
+	Number* checkElement(Sexp* s, TypedVector::Type type)
+	{
+		Number* num = CommonInteger::ConvertAndCheck(s);
+		if(num != nullptr && !TypedVector::fits(type, *num))
+		{
+			loge << *num << " doesn't fit in an " << TypedVector::name(type) << "vector\n";
+			return nullptr;
+		}
+		return num;
+	}
+}
+
+
+//TypedVector
+
+TypedVector::TypedVector(Type type, size_t size, int64_t fill) : Atom{Kind::TYPED_VECTOR}, type{type}
+{
+	if(type == Type::S32)
+		s32.assign(size, (int32_t)fill);
+	else
+		s64.assign(size, fill);
+}
+
+TypedVector::Type TypedVector::getType() const
+{
+	return type;
+}
+
+size_t TypedVector::size() const
+{
+	return type == Type::S32 ? s32.size() : s64.size();
+}
+
+int64_t TypedVector::get(size_t index) const
+{
+	return type == Type::S32 ? s32[index] : s64[index];
+}
+
+void TypedVector::set(size_t index, int64_t value)
+{
+	if(type == Type::S32)
+		s32[index] = (int32_t)value;
+	else
+		s64[index] = value;
+}
+
+bool TypedVector::fits(Type type, const Number& value)
+{
+	if(!value.isFixnum())
+		return false;
+	return type == Type::S64 || (value.getFixnum() >= INT32_MIN && value.getFixnum() <= INT32_MAX);
+}
+
+const char* TypedVector::name(Type type)
+{
+	return type == Type::S32 ? "s32" : "s64";
+}
+
+std::vector<int32_t>& TypedVector::getS32()
+{
+	return s32;
+}
+
+std::vector<int64_t>& TypedVector::getS64()
+{
+	return s64;
+}
+
+const std::vector<int32_t>& TypedVector::getS32() const
+{
+	return s32;
+}
+
+const std::vector<int64_t>& TypedVector::getS64() const
+{
+	return s64;
+}
+
+std::shared_ptr<Sexp> TypedVector::eval(std::shared_ptr<Environment> context) const
+{
+	return std::const_pointer_cast<Sexp>(shared_from_this());
+}
+
+void TypedVector::print(std::ostream &os) const
+{
+	os << "#" << name(type) << "(";
+	size_t n = std::min(size(), PRINT_LIMIT);
+	for(size_t i = 0; i < n; i++)
+		os << (i == 0 ? "" : " ") << get(i);
+	if(n < size())
+		os << " ... (" << size() << " elements)";
+	os << ")";
+}
+
+
+//TypedVectorFunction
+
+TypedVectorFunction::TypedVectorFunction(std::shared_ptr<Environment> env, std::string name, Operation operation, TypedVector::Type type, Simd::Operation simd)
+	: Lambda{env}, operation{operation}, type{type}, simd{simd}, name{std::move(name)} {}
+
+std::shared_ptr<Sexp> TypedVectorFunction::eval(std::shared_ptr<Environment> context, std::shared_ptr<List> params) const
+{
+	std::vector<std::shared_ptr<Sexp>> args;
+	for(auto s : *params)
+		args.push_back(s);
+
+	//expected number of arguments: at least min, at most max
+	size_t min = 1, max = 1;
+	switch(operation)
+	{
+	case Operation::MAKE:
+		max = 2;
+		break;
+	case Operation::CONSTRUCT:
+		min = 0;
+		max = SIZE_MAX;
+		break;
+	case Operation::REF:
+	case Operation::ELEMENTWISE:
+	case Operation::DOT:
+		min = max = 2;
+		break;
+	case Operation::SET:
+	case Operation::MAP:
+		min = max = 3;
+		break;
+	case Operation::ISA:
+		min = max = 0;
+		break;
+	default:
+		break;
+	}
+	if(args.size() < min || args.size() > max)
+	{
+		loge << "wrong number of arguments for " << *this << ". (Expected: " << min;
+		if(max != min)
+			logerror << (max == SIZE_MAX ? " or more" : " or " + std::to_string(max));
+		logerror << ", got: " << args.size() << ")\n";
+		return nullptr;
+	}
+
+	switch(operation)
+	{
+	case Operation::MAKE:
+		{
+			Number* size = CommonInteger::ConvertAndCheck(args[0].get());
+			if(size == nullptr)
+				return nullptr;
+			if(!size->isFixnum() || size->getFixnum() < 0 || size->getFixnum() > MAX_SIZE)
+			{
+				loge << "invalid vector length: " << *size << "\n";
+				return nullptr;
+			}
+			Number* fill = args.size() > 1 ? checkElement(args[1].get(), type) : nullptr;
+			if(args.size() > 1 && fill == nullptr)
+				return nullptr;
+			return allocate(type, (size_t)size->getFixnum(), fill == nullptr ? 0 : fill->getFixnum());
+		}
+	case Operation::CONSTRUCT:
+		{
+			std::shared_ptr<TypedVector> v = allocate(type, args.size());
+			if(v == nullptr)
+				return nullptr;
+			for(size_t i = 0; i < args.size(); i++)
+			{
+				Number* num = checkElement(args[i].get(), type);
+				if(num == nullptr)
+					return nullptr;
+				v->set(i, num->getFixnum());
+			}
+			return v;
+		}
+	case Operation::LENGTH:
+		{
+			TypedVector* v = convertAndCheck(args[0].get());
+			if(v == nullptr)
+				return nullptr;
+			return Number::make((int64_t)v->size());
+		}
+	case Operation::REF:
+	case Operation::SET:
+		{
+			TypedVector* v = convertAndCheck(args[0].get());
+			size_t index;
+			if(v == nullptr || !checkIndex(args[1].get(), *v, index))
+				return nullptr;
+			if(operation == Operation::REF)
+				return Number::make(v->get(index));
+			Number* num = checkElement(args[2].get(), v->getType());
+			if(num == nullptr)
+				return nullptr;
+			v->set(index, num->getFixnum());
+			return args[2];
+		}
+	case Operation::ELEMENTWISE:
+		return elementwise(simd, args[0], args[1]);
+	case Operation::MAP:
+		{
+			Sexp* op = args[0].get();
+			Simd::Operation mapped;
+			if(dynamic_cast<AddFunction*>(op) != nullptr)
+				mapped = Simd::ADD;
+			else if(dynamic_cast<MinusFunction*>(op) != nullptr)
+				mapped = Simd::SUBTRACT;
+			else if(dynamic_cast<MultiplyFunction*>(op) != nullptr)
+				mapped = Simd::MULTIPLY;
+			else if(dynamic_cast<DivisionFunction*>(op) != nullptr)
+				mapped = Simd::DIVIDE;
+			else if(dynamic_cast<LessFunction*>(op) != nullptr)
+				mapped = Simd::LESS;
+			else if(dynamic_cast<GreaterFunction*>(op) != nullptr)
+				mapped = Simd::GREATER;
+			else if(dynamic_cast<EqualFunction*>(op) != nullptr)
+				mapped = Simd::EQUAL;
+			else if(dynamic_cast<TypedVectorFunction*>(op) != nullptr && static_cast<TypedVectorFunction*>(op)->operation == Operation::ELEMENTWISE)
+				mapped = static_cast<TypedVectorFunction*>(op)->simd;
+			else
+			{
+				loge << *this << " maps +, -, *, /, <, > or =, not " << *op << "\n";
+				return nullptr;
+			}
+			return elementwise(mapped, args[1], args[2]);
+		}
+	case Operation::SUM:
+	case Operation::MIN:
+	case Operation::MAX:
+		{
+			TypedVector* v = convertAndCheck(args[0].get());
+			if(v == nullptr)
+				return nullptr;
+			if(v->size() == 0 && operation != Operation::SUM)
+			{
+				loge << *this << " of an empty vector\n";
+				return nullptr;
+			}
+			if(v->getType() == TypedVector::Type::S32)
+				return reduce<int32_t>(operation, *v);
+			return reduce<int64_t>(operation, *v);
+		}
+	case Operation::DOT:
+		{
+			TypedVector* a = convertAndCheck(args[0].get());
+			TypedVector* b = a == nullptr ? nullptr : convertAndCheck(args[1].get());
+			if(b == nullptr)
+				return nullptr;
+			if(a->size() != b->size())
+			{
+				loge << "vectors of different lengths: " << a->size() << " and " << b->size() << "\n";
+				return nullptr;
+			}
+			if(a->getType() == TypedVector::Type::S32 && b->getType() == TypedVector::Type::S32)
+				return dot<int32_t>(a, b);
+			return dot<int64_t>(a, b);
+		}
+	default:
+		return Symbol::intern(Simd::isa());
+	}
+}
+
+std::shared_ptr<Sexp> TypedVectorFunction::elementwise(Simd::Operation op, std::shared_ptr<Sexp> left, std::shared_ptr<Sexp> right) const
+{
+	TypedVector* a = asVector(left.get());
+	TypedVector* b = asVector(right.get());
+	if(a == nullptr && b == nullptr)
+	{
+		loge << *this << " expects a typed vector, got " << *left << " and " << *right << "\n";
+		return nullptr;
+	}
+	if(a != nullptr && b != nullptr && a->size() != b->size())
+	{
+		loge << "vectors of different lengths: " << a->size() << " and " << b->size() << "\n";
+		return nullptr;
+	}
+	bool wide = (a != nullptr && a->getType() == TypedVector::Type::S64) || (b != nullptr && b->getType() == TypedVector::Type::S64);
+	TypedVector::Type resultType = wide ? TypedVector::Type::S64 : TypedVector::Type::S32;
+
+	//the other operand is a number, it is used for every element
+	Number* aScalar = a == nullptr ? checkElement(left.get(), resultType) : nullptr;
+	Number* bScalar = b == nullptr ? checkElement(right.get(), resultType) : nullptr;
+	if((a == nullptr && aScalar == nullptr) || (b == nullptr && bScalar == nullptr))
+		return nullptr;
+
+	size_t size = a != nullptr ? a->size() : b->size();
+	std::shared_ptr<TypedVector> result = allocate(resultType, size);
+	if(result == nullptr)
+		return nullptr;
+	//a narrow or scalar operand is widened into a temporary vector of the same length
+	try
+	{
+		bool ok = wide ? runElementwise<int64_t>(op, a, aScalar, b, bScalar, *result) : runElementwise<int32_t>(op, a, aScalar, b, bScalar, *result);
+		if(!ok)
+			return nullptr;
+	}
+	catch(const std::bad_alloc&)
+	{
+		loge << "not enough memory for a vector of " << size << " elements\n";
+		return nullptr;
+	}
+	return result;
+}
+
+void TypedVectorFunction::print(std::ostream &os) const
+{
+	os << name;
+}
+
+void TypedVectorFunction::defineAll(std::shared_ptr<Environment> global)
+{
+	auto define = [&global](std::string name, Operation operation, TypedVector::Type type, Simd::Operation simd)
+	{
+		global->bindArg(name, Heap::make<TypedVectorFunction>(global, name, operation, type, simd));
+	};
+	for(TypedVector::Type type : {TypedVector::Type::S32, TypedVector::Type::S64})
+	{
+		std::string prefix = std::string(TypedVector::name(type)) + "vector";
+		define("make-" + prefix, Operation::MAKE, type, Simd::ADD);
+		define(prefix, Operation::CONSTRUCT, type, Simd::ADD);
+		define(prefix + "-length", Operation::LENGTH, type, Simd::ADD);
+		define(prefix + "-ref", Operation::REF, type, Simd::ADD);
+		define(prefix + "-set!", Operation::SET, type, Simd::ADD);
+	}
+
+	const TypedVector::Type any = TypedVector::Type::S64;
+	define("vector+", Operation::ELEMENTWISE, any, Simd::ADD);
+	define("vector-", Operation::ELEMENTWISE, any, Simd::SUBTRACT);
+	define("vector*", Operation::ELEMENTWISE, any, Simd::MULTIPLY);
+	define("vector/", Operation::ELEMENTWISE, any, Simd::DIVIDE);
+	define("vector<", Operation::ELEMENTWISE, any, Simd::LESS);
+	define("vector>", Operation::ELEMENTWISE, any, Simd::GREATER);
+	define("vector=", Operation::ELEMENTWISE, any, Simd::EQUAL);
+	define("vector-map", Operation::MAP, any, Simd::ADD);
+	define("vector-sum", Operation::SUM, any, Simd::ADD);
+	define("vector-min", Operation::MIN, any, Simd::ADD);
+	define("vector-max", Operation::MAX, any, Simd::ADD);
+	define("vector-dot", Operation::DOT, any, Simd::ADD);
+	define("simd-isa", Operation::ISA, any, Simd::ADD);
+}
@@ -0,0 +1,102 @@
+#include <cstdint>
+#include <vector>
+
+#include "scheme.h"
+#include "simd.h"
+
+
+
+
+#pragma once
+
+
+/**	SRFI-4 homogeneous numeric vector: an s32vector or an s64vector, with the elements stored contiguously and unboxed
+ * 	element-wise arithmetic wraps around like fixed width integers do, reductions (sum, dot) are exact */
+class TypedVector : public Atom
+{
+public:
+	enum class Type : unsigned char {S32, S64};
+
+private:
+	Type type;
+	/**	only the one belonging to type is used */
+	std::vector<int32_t> s32;
+	std::vector<int64_t> s64;
+
+public:
+	TypedVector(Type type, size_t size, int64_t fill = 0);
+
+	Type getType() const;
+	size_t size() const;
+
+	int64_t get(size_t index) const;
+	/**	value must fit in the element type (see fits) */
+	void set(size_t index, int64_t value);
+
+	/**	if value is in the range of the elements of type */
+	static bool fits(Type type, const Number& value);
+	/**	"s32" or "s64" */
+	static const char* name(Type type);
+
+	std::vector<int32_t>& getS32();
+	std::vector<int64_t>& getS64();
+	const std::vector<int32_t>& getS32() const;
+	const std::vector<int64_t>& getS64() const;
+
+	/**	typed vectors evaluate to themselves */
+	std::shared_ptr<Sexp> eval(std::shared_ptr<Environment> context) const;
+	/**	#s32(1 2 3) */
+	void print(std::ostream &os) const;
+};
+
+
+/**	the typed vector primitives, one class for all of them, eval dispatches on the operation
+ * 	the element-wise operations take two typed vectors of the same length, or a typed vector and a number that is used for every element
+ * 	and they run the Simd kernels: the result is an s64vector if any operand is one, an s32vector otherwise */
+class TypedVectorFunction : public Lambda
+{
+public:
+	enum class Operation : unsigned char
+	{
+		/**	(make-s32vector n [fill]) */
+		MAKE,
+		/**	(s32vector x ...) */
+		CONSTRUCT,
+		/**	(s32vector-length v) */
+		LENGTH,
+		/**	(s32vector-ref v i) */
+		REF,
+		/**	(s32vector-set! v i x), returns x */
+		SET,
+		/**	(vector+ a b), also -, *, /, <, >, =, the comparisons give vectors of 1 and 0 */
+		ELEMENTWISE,
+		/**	(vector-map op a b) with op one of the arithmetic or compare primitives */
+		MAP,
+		/**	(vector-sum v), (vector-min v), (vector-max v), (vector-dot a b) */
+		SUM,
+		MIN,
+		MAX,
+		DOT,
+		/**	(simd-isa) the instruction set the kernels run on */
+		ISA
+	};
+
+private:
+	Operation operation;
+	/**	element type for the s32/s64 prefixed functions */
+	TypedVector::Type type;
+	/**	for ELEMENTWISE */
+	Simd::Operation simd;
+	std::string name;
+
+	std::shared_ptr<Sexp> elementwise(Simd::Operation op, std::shared_ptr<Sexp> left, std::shared_ptr<Sexp> right) const;
+
+public:
+	TypedVectorFunction(std::shared_ptr<Environment> env, std::string name, Operation operation, TypedVector::Type type = TypedVector::Type::S64, Simd::Operation simd = Simd::ADD);
+
+	virtual std::shared_ptr<Sexp> eval(std::shared_ptr<Environment> context, std::shared_ptr<List> params) const;
+	void print(std::ostream &os) const;
+
+	/**	binds all the typed vector primitives in global */
+	static void defineAll(std::shared_ptr<Environment> global);
+};